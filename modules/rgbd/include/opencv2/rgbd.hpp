@@ -104,6 +104,16 @@ namespace cv
       RGBD_NORMALS_METHOD_FALS, RGBD_NORMALS_METHOD_LINEMOD, RGBD_NORMALS_METHOD_SRI
     };
 
+    /** How FALS keeps the inverse of the matrix M it needs at every pixel, set with the "fals_m_inv" parameter
+     * RGBD_NORMALS_FALS_M_INV_FULL: the 6 distinct values of the symmetric M_inv are cached for every pixel
+     * RGBD_NORMALS_FALS_M_INV_RECOMPUTE: nothing is cached, M is box filtered and inverted along with the normals.
+     *   It saves 24 bytes per pixel in float (7.4 MB at VGA) for a slower computation
+     */
+    enum RGBD_NORMALS_FALS_M_INV
+    {
+      RGBD_NORMALS_FALS_M_INV_FULL, RGBD_NORMALS_FALS_M_INV_RECOMPUTE
+    };
+
     RgbdNormals()
         :
           rows_(0),
@@ -112,6 +122,7 @@ namespace cv
           K_(Mat()),
           window_size_(0),
           method_(RGBD_NORMALS_METHOD_FALS),
+          fals_m_inv_(RGBD_NORMALS_FALS_M_INV_FULL),
           rgbd_normals_impl_(0)
     {
     }
@@ -133,7 +144,8 @@ namespace cv
     info() const;
 
     /** Given a set of 3d points in a depth image, compute the normals at each point.
-     * @param points a rows x cols x 3 matrix of CV_32F/CV64F or a rows x cols x 1 CV_U16S
+     * @param points a rows x cols x 3 matrix of CV_32F/CV64F or a rows x cols x 1 CV_U16S, or a vector of the
+     *        3 planes x, y and z of the points, as given by depthTo3dPlanar
      * @param normals a rows x cols x 3 matrix
      */
     void
@@ -141,6 +153,7 @@ namespace cv
 
     /** Initializes some data that is cached for later computation
      * If that function is not called, it will be called the first time normals are computed
+     * That data is shared by all the RgbdNormals of the process with the same parameters
      */
     void
     initialize() const;
@@ -155,12 +168,14 @@ namespace cv
     }
   protected:
     void
-    initialize_normals_impl(int rows, int cols, int depth, const Mat & K, int window_size, int method) const;
+    initialize_normals_impl(int rows, int cols, int depth, const Mat & K, int window_size, int method,
+                            int fals_m_inv) const;
 
     int rows_, cols_, depth_;
     Mat K_;
     int window_size_;
     int method_;
+    int fals_m_inv_;
     mutable void* rgbd_normals_impl_;
   };
 
@@ -172,10 +187,15 @@ namespace cv
     /** NIL method is from
      * ``Modeling Kinect Sensor Noise for Improved 3d Reconstruction and Tracking``
      * by C. Nguyen, S. Izadi, D. Lovel
+     * DEPTH_CLEANER_BILATERAL is a separable bilateral filter whose range sigma is the noise of the sensor at the
+     * depth of the pixel, from the same paper
+     * DEPTH_CLEANER_TEMPORAL_MEDIAN and DEPTH_CLEANER_TEMPORAL_MEAN give the median or the mean of the depths of a pixel
+     * in the last window_size frames, and fill the holes with them. They keep those frames between calls and are
+     * meant for static or slowly moving cameras
      */
     enum DEPTH_CLEANER_METHOD
     {
-      DEPTH_CLEANER_NIL
+      DEPTH_CLEANER_NIL, DEPTH_CLEANER_BILATERAL, DEPTH_CLEANER_TEMPORAL_MEDIAN, DEPTH_CLEANER_TEMPORAL_MEAN
     };
 
     DepthCleaner()
@@ -188,9 +208,12 @@ namespace cv
     }
 
     /** Constructor
-     * @param depth the depth of the normals (only CV_32F or CV_64F for FALS and SRI, CV_16U for LINEMOD)
-     * @param window_size the window size to compute the normals: can only be 1,3,5 or 7
-     * @param method one of the methods to use: RGBD_NORMALS_METHOD_SRI, RGBD_NORMALS_METHOD_FALS
+     * @param depth the depth of the depth images: CV_16U (in millimeters), CV_32F or CV_64F (in meters). Except for
+     *        NIL, it must also be the depth of the images to clean
+     * @param window_size the window size of the filter, or the number of frames for the temporal methods: can only
+     *        be 1,3,5 or 7
+     * @param method one of the methods to use: DEPTH_CLEANER_NIL, DEPTH_CLEANER_BILATERAL,
+     *        DEPTH_CLEANER_TEMPORAL_MEDIAN, DEPTH_CLEANER_TEMPORAL_MEAN
      */
     DepthCleaner(int depth, int window_size = 5, int method = DEPTH_CLEANER_NIL);
 
@@ -253,6 +276,16 @@ namespace cv
   void
   depthTo3d(InputArray depth, InputArray K, OutputArray points3d, InputArray mask = noArray());
 
+  /** Same as depthTo3d without a mask, but the coordinates are given as 3 planes x, y and z (a structure of arrays)
+   * instead of an organized 3-channel matrix
+   * @param depth the depth image, as in depthTo3d
+   * @param K The calibration matrix
+   * @param points3d the 3 planes of the coordinates, of the size of `depth` and of the depth described in depthTo3d
+   */
+  CV_EXPORTS
+  void
+  depthTo3dPlanar(InputArray depth, InputArray K, OutputArrayOfArrays points3d);
+
   /** If the input image is of type CV_16UC1 (like the Kinect one), the image is converted to floats, divided
    * by 1000 to get a depth in meters, and the values 0 are converted to std::numeric_limits<float>::quiet_NaN()
    * Otherwise, the image is simply converted to floats
@@ -283,15 +316,18 @@ namespace cv
           threshold_(0.01),
           sensor_error_a_(0),
           sensor_error_b_(0),
-          sensor_error_c_(0)
+          sensor_error_c_(0),
+          mask_type_(CV_8U),
+          block_levels_(1)
     {
     }
 
     /** Find The planes in a depth image
-     * @param points3d the 3d points organized like the depth image: rows x cols with 3 channels
+     * @param points3d the 3d points organized like the depth image: rows x cols with 3 channels, or a vector of
+     *        the 3 planes x, y and z of the points, as given by depthTo3dPlanar
      * @param the normals for every point in the depth image
-     * @param mask An image where each pixel is labeled with the plane it belongs to
-     *        and 255 if it does not belong to any plane
+     * @param mask An image of type mask_type where each pixel is labeled with the plane it belongs to
+     *        and the maximum value of the type (255 for CV_8U) if it does not belong to any plane
      * @param the coefficients of the corresponding planes (a,b,c,d) such that ax+by+cz+d=0, norm(a,b,c)=1
      *        and c < 0 (so that the normal points towards the camera)
      */
@@ -300,14 +336,37 @@ namespace cv
                OutputArray plane_coefficients);
 
     /** Find The planes in a depth image but without doing a normal check, which is faster but less accurate
-     * @param points3d the 3d points organized like the depth image: rows x cols with 3 channels
-     * @param mask An image where each pixel is labeled with the plane it belongs to
-     *        and 255 if it does not belong to any plane
+     * @param points3d the 3d points organized like the depth image: rows x cols with 3 channels, or a vector of
+     *        the 3 planes x, y and z of the points
+     * @param mask An image of type mask_type where each pixel is labeled with the plane it belongs to
+     *        and the maximum value of the type (255 for CV_8U) if it does not belong to any plane
      * @param the coefficients of the corresponding planes (a,b,c,d) such that ax+by+cz+d=0
      */
     void
     operator()(InputArray points3d, OutputArray mask, OutputArray plane_coefficients);
 
+    /** Find the planes in a depth image, starting from the planes found in a previous frame. Every previous plane
+     * is moved to the current frame and grown from the most planar tile that matches it (and that mostly belonged to
+     * it in the previous mask, if given) before the remaining tiles are searched for new planes. The planes found
+     * again come first in the output, in their previous order. The previous planes that are not found again have no
+     * output plane, so the output index of a plane can differ from its previous one: previous_indices tells which
+     * previous plane every output plane is
+     * @param points3d the 3d points, as in operator()
+     * @param normals the normals for every point in the depth image (can be empty)
+     * @param previous_mask the mask computed for the previous frame (can be empty)
+     * @param previous_plane_coefficients the coefficients computed for the previous frame
+     * @param Rt the 4x4 transformation from the previous frame to the current one (dst_p = Rt * src_p) as given by
+     *        Odometry::compute with the previous frame as source. The identity if empty
+     * @param mask An image of type mask_type where each pixel is labeled with the plane it belongs to
+     *        and the maximum value of the type (255 for CV_8U) if it does not belong to any plane
+     * @param plane_coefficients the coefficients of the corresponding planes, as in operator()
+     * @param previous_indices for every plane of plane_coefficients, the index of the previous plane it was tracked
+     *        from, or -1 if it is a new plane (a CV_32SC1 column)
+     */
+    void
+    track(InputArray points3d, InputArray normals, InputArray previous_mask, InputArray previous_plane_coefficients,
+          InputArray Rt, OutputArray mask, OutputArray plane_coefficients, OutputArray previous_indices = noArray());
+
     AlgorithmInfo*
     info() const;
   private:
@@ -321,6 +380,11 @@ namespace cv
     double threshold_;
     /** coefficient of the sensor error with respect to the. All 0 by default but you want a=0.0075 for a Kinect */
     double sensor_error_a_, sensor_error_b_, sensor_error_c_;
+    /** The type of the mask: CV_8U (at most 255 planes), CV_16U or CV_32S */
+    int mask_type_;
+    /** The number of tile sizes to look for planes with: the tiles of a level are half the size of the previous
+     * level ones and only contain the points no plane explained before. 1 only uses block_size */
+    int block_levels_;
   };
 
   /** Object that contains a frame data.
@@ -382,6 +446,87 @@ namespace cv
     std::vector<Mat> pyramidNormalsMask;
   };
 
+  /** Scratch memory that can be shared by the calls of an odometry (or of several odometries processing
+   * frames of the same resolution), so that the frame-sized buffers are not allocated at every call.
+   * It keeps the buffers of the correspondences and of the linear systems between calls, and the pyramids
+   * of the recycled frames which are reused for the next prepared frames.
+   * A workspace is not thread-safe: it must not be used by several calls at the same time.
+   */
+  class CV_EXPORTS OdometryWorkspace
+  {
+  public:
+    OdometryWorkspace();
+    ~OdometryWorkspace();
+
+    /** Gives the memory of a frame which is not needed any more to the workspace and releases the frame.
+     * The matrices of the frame (except the image, depth and mask which are only released) will be
+     * overwritten by the next prepared frames, so they must not be used elsewhere.
+     * @param frame The frame to recycle
+     */
+    void
+    recycleFrame(Ptr<OdometryFrame>& frame);
+
+    /** Frees all the memory kept by the workspace */
+    void
+    release();
+
+    struct Buffers;
+    Buffers*
+    buffers() const
+    {
+      return buffers_;
+    }
+
+  private:
+    OdometryWorkspace(const OdometryWorkspace&);
+    OdometryWorkspace&
+    operator=(const OdometryWorkspace&);
+
+    Buffers* buffers_;
+  };
+
+  /** Statistics of the last call of Odometry::compute, see Odometry::setStats.
+   * The times are in microseconds.
+   */
+  struct CV_EXPORTS OdometryStats
+  {
+    /** Reasons why the iterations of a pyramid level stopped
+     * @param STOP_ITERATIONS All the iterations of iterCounts were done
+     * @param STOP_CORRESPS There were not enough correspondences
+     * @param STOP_SOLVE The system of equations had no solution
+     * @param STOP_CONVERGED The pose converged (see Odometry::DEFAULT_MIN_INCREMENT)
+     */
+    enum
+    {
+      STOP_ITERATIONS = 0, STOP_CORRESPS = 1, STOP_SOLVE = 2, STOP_CONVERGED = 3
+    };
+
+    struct CV_EXPORTS Level
+    {
+      Level();
+
+      int iterations;
+      int stopReason;
+      /** For every iteration, the correspondences count and the standard deviation of the residuals
+       * (-1 if the system was not computed because of too few correspondences)
+       */
+      std::vector<int> rgbdCorrespsCounts, icpCorrespsCounts;
+      std::vector<double> rgbdSigmas, icpSigmas;
+    };
+
+    OdometryStats();
+
+    void
+    reset();
+
+    /** The statistics of every pyramid level, the index is the level */
+    std::vector<Level> levels;
+
+    double prepareSrcTime, prepareDstTime;
+    double correspsTime, lsmTime, solveTime;
+    double totalTime;
+  };
+
   /** Base class for computation of odometry.
    */
   class CV_EXPORTS Odometry: public Algorithm
@@ -424,6 +569,20 @@ namespace cv
     {
       return 15; // in degrees
     }
+    /** The iterations of a pyramid level stop when the norm of the pose increment is less than minIncrement
+     * or when the relative change of the standard deviation of the residuals is less than minResidualChange.
+     * Both tests are disabled by default: all the iterations of iterCounts are done.
+     */
+    static inline float
+    DEFAULT_MIN_INCREMENT()
+    {
+      return 0.f;
+    }
+    static inline float
+    DEFAULT_MIN_RESIDUAL_CHANGE()
+    {
+      return 0.f; // in [0, 1]
+    }
 
     /** Method to compute a transformation from the source frame to the destination one.
      * Some odometry algorithms do not used some data of frames (eg. ICP does not use images).
@@ -453,6 +612,26 @@ namespace cv
     bool
     compute(Ptr<OdometryFrame>& srcFrame, Ptr<OdometryFrame>& dstFrame, Mat& Rt, const Mat& initRt = Mat()) const;
 
+    /** Computes the poses of a sequence of frames, every frame being registered against the previous one.
+     * The frames are processed by batches: the caches of a batch are prepared in parallel for both roles, so that
+     * every frame is prepared once and used as the destination frame of a registration and as the source frame of
+     * the next one, and the registrations of a batch run in parallel with the preparation of the next batch.
+     * The caches of a frame are released (see OdometryFrame::releasePyramids) once it was used in both roles,
+     * so a long sequence does not keep all of them. The last frame keeps its caches, so it can start the next
+     * part of the sequence.
+     * If a workspace or statistics are set, they can not be shared by concurrent registrations and the frames
+     * are processed one after the other; the pyramids of the used frames are then given to the workspace
+     * (see OdometryWorkspace::recycleFrame) instead of being released.
+     * @param frames The frames of the sequence, all of the same size. Their caches are computed in place, and the frames
+     *        without a mask get the first level of their pyramidMask (but the frames recycled to a workspace).
+     * @param poses Resulting poses of the frames, the transformations from their camera coordinates to the ones
+     *        of the first frame (world_p = pose * camera_p, as in KeyframeOdometry), 4x4 matrices of CV_64FC1 type.
+     *        If a registration fails, the frame gets the pose of the previous one.
+     * @return true if all the registrations succeeded
+     */
+    bool
+    computeSequence(std::vector<Ptr<OdometryFrame> >& frames, std::vector<Mat>& poses) const;
+
     /** Prepare a cache for the frame. The function checks the precomputed/passed data (throws the error if this data
      * does not satisfy) and computes all remaining cache data needed for the frame. Returned size is a resolution
      * of the prepared frame.
@@ -462,6 +641,26 @@ namespace cv
     virtual Size
     prepareFrameCache(Ptr<OdometryFrame>& frame, int cacheType) const;
 
+    /** Sets the workspace used to keep the temporary buffers between calls. If it is empty (by default),
+     * the buffers are allocated at every call.
+     * @param workspace The workspace
+     */
+    void
+    setWorkspace(const Ptr<OdometryWorkspace>& workspace);
+
+    Ptr<OdometryWorkspace>
+    getWorkspace() const;
+
+    /** Sets the statistics that are filled by every call of compute. If it is empty (by default),
+     * no statistics are gathered.
+     * @param stats The statistics
+     */
+    void
+    setStats(const Ptr<OdometryStats>& stats);
+
+    Ptr<OdometryStats>
+    getStats() const;
+
   protected:
     virtual void
     checkParams() const = 0;
@@ -469,6 +668,9 @@ namespace cv
     virtual bool
     computeImpl(const Ptr<OdometryFrame>& srcFrame, const Ptr<OdometryFrame>& dstFrame, Mat& Rt,
                 const Mat& initRt) const = 0;
+
+    Ptr<OdometryWorkspace> workspace;
+    Ptr<OdometryStats> stats;
   };
 
   /** Odometry based on the paper "Real-Time Visual Odometry from Dense RGB-D Images", 
@@ -520,6 +722,8 @@ namespace cv
     int transformType;
 
     double maxTranslation, maxRotation;
+
+    double minIncrement, minResidualChange;
   };
 
   /** Odometry based on the paper "KinectFusion: Real-Time Dense Surface Mapping and Tracking", 
@@ -569,6 +773,8 @@ namespace cv
 
     double maxTranslation, maxRotation;
 
+    double minIncrement, minResidualChange;
+
     mutable cv::Ptr<cv::RgbdNormals> normalsComputer;
   };
 
@@ -625,9 +831,360 @@ namespace cv
 
     double maxTranslation, maxRotation;
 
+    double minIncrement, minResidualChange;
+
     mutable cv::Ptr<cv::RgbdNormals> normalsComputer;
   };
 
+  /** Frame-to-frame odometry on a sequence of frames. Every pushed frame is registered against the previous one,
+   * and its caches are kept: the frame is prepared as the destination frame when it is pushed, then it is used
+   * as the source frame for the next one, so only the data needed by the source role (e.g. the point cloud)
+   * is computed at that time.
+   */
+  class CV_EXPORTS OdometryStream
+  {
+  public:
+    OdometryStream();
+    /** Constructor.
+     * @param odometry The odometry used to register the frames
+     */
+    OdometryStream(const Ptr<Odometry>& odometry);
+
+    /** Registers the frame against the previously pushed one and keeps it for the next call.
+     * The method returns false if it is the first frame of the stream or if the odometry failed
+     * (Rt is the identity matrix then), the frame is kept in both cases.
+     * @param frame The new frame. Its caches are computed in place, so it should not be modified after the call.
+     * @param Rt Resulting transformation from the previous frame to the new one (dst_p = Rt * src_p,
+     *           see Odometry::compute), 4x4 matrix of CV_64FC1 type.
+     * @param initRt Initial transformation from the previous frame to the new one (optional)
+     */
+    bool
+    push(const Ptr<OdometryFrame>& frame, Mat& Rt, const Mat& initRt = Mat());
+
+    /** Forgets the previous frame, the next pushed frame starts a new stream. */
+    void
+    reset();
+
+    Ptr<OdometryFrame>
+    getLastFrame() const
+    {
+      return lastFrame;
+    }
+
+    void
+    setOdometry(const Ptr<Odometry>& odometry);
+
+    Ptr<Odometry>
+    getOdometry() const
+    {
+      return odometry;
+    }
+
+  protected:
+    Ptr<Odometry> odometry;
+    Ptr<OdometryFrame> lastFrame;
+  };
+
+  /** Keyframe-based odometry on a sequence of frames. Every pushed frame is registered against the current keyframe
+   * (by default with RgbdICPOdometry), so the keyframe caches are computed once and reused for many frames, and
+   * the drift only accumulates when the keyframe changes. The keyframe is replaced by the new frame when the
+   * overlap between them, measured as the part of the valid pixels of the new frame that have a correspondence
+   * in the keyframe, drops below a threshold.
+   * The poses of the trajectory are the transformations from the camera coordinates of the frames to the
+   * coordinates of the first frame (world_p = pose * camera_p), 4x4 matrices of CV_64FC1 type.
+   */
+  class CV_EXPORTS KeyframeOdometry
+  {
+  public:
+    static inline float
+    DEFAULT_MIN_OVERLAP()
+    {
+      return 0.5f; // in [0, 1]
+    }
+
+    KeyframeOdometry();
+    /** Constructor.
+     * @param odometry The odometry used to register the frames against the keyframe
+     * @param minOverlap The keyframe is replaced when the overlap with the new frame is less than minOverlap
+     */
+    KeyframeOdometry(const Ptr<Odometry>& odometry, float minOverlap = DEFAULT_MIN_OVERLAP());
+
+    /** Registers the frame against the current keyframe and adds its pose to the trajectory.
+     * The method returns false if the odometry failed, the pose of the previous frame is used then
+     * and the frame becomes the new keyframe.
+     * @param frame The new frame. Its caches are computed in place, so it should not be modified after the call.
+     * @param pose The pose of the frame
+     */
+    bool
+    push(const Ptr<OdometryFrame>& frame, Mat& pose);
+
+    /** Forgets the keyframe and the trajectory. */
+    void
+    reset();
+
+    const std::vector<Mat>&
+    getTrajectory() const
+    {
+      return trajectory;
+    }
+
+    /** Indices in the trajectory of the frames that were used as keyframes */
+    const std::vector<int>&
+    getKeyframeIndices() const
+    {
+      return keyframeIndices;
+    }
+
+    Ptr<OdometryFrame>
+    getKeyframe() const
+    {
+      return keyframe;
+    }
+
+    Ptr<Odometry>
+    getOdometry() const
+    {
+      return odometry;
+    }
+
+    float
+    getMinOverlap() const
+    {
+      return minOverlap;
+    }
+    void
+    setMinOverlap(float val)
+    {
+      minOverlap = val;
+    }
+
+  protected:
+    Ptr<Odometry> odometry;
+    float minOverlap;
+
+    Ptr<OdometryFrame> keyframe;
+    Mat keyframePose;
+    /** Transformation from the keyframe to the last frame, the initial guess for the next frame */
+    Mat lastRt;
+
+    std::vector<Mat> trajectory;
+    std::vector<int> keyframeIndices;
+  };
+
+  /** Volume of a truncated signed distance function (TSDF) that fuses depth frames into a surface model, as in
+   * ``KinectFusion: Real-Time Dense Surface Mapping and Tracking`` by R. A. Newcombe et al.
+   * The volume is a dense grid of resolution[0] x resolution[1] x resolution[2] voxels of voxelSize meters, its first
+   * corner being at origin in the world coordinates. Every voxel keeps the signed distance to the surface along the
+   * camera axis, truncated and divided by the truncation distance (so in [-1, 1], positive in front of the surface),
+   * and the weight of this distance (0 if it was never observed).
+   * The poses are the transformations from the camera coordinates to the world ones (world_p = pose * camera_p),
+   * as the poses of KeyframeOdometry.
+   * A frame raycast from the volume can be used as the destination frame of ICPOdometry to register a new frame
+   * against the model rather than against the previous frame: if Rt is computed from the new frame to the model
+   * frame (dst_p = Rt * src_p), the pose of the new frame is the pose of the model frame multiplied by Rt.
+   */
+  class CV_EXPORTS TsdfVolume
+  {
+  public:
+    static inline float
+    DEFAULT_TRUNCATION_DISTANCE()
+    {
+      return 0.03f; // in meters
+    }
+    static inline int
+    DEFAULT_MAX_WEIGHT()
+    {
+      return 64;
+    }
+
+    TsdfVolume();
+    /** Constructor.
+     * @param resolution The number of voxels along the x, y and z axes
+     * @param voxelSize The size of a voxel in meters
+     * @param origin The first corner of the volume in the world coordinates, in meters
+     * @param truncationDistance The distance in meters from which the signed distances are truncated.
+     *        It should be a few voxels.
+     * @param maxWeight The weight of a voxel is not increased over maxWeight, so that the volume keeps
+     *        adapting to the new frames
+     */
+    TsdfVolume(const Vec3i& resolution, float voxelSize, const Vec3f& origin = Vec3f(),
+               float truncationDistance = DEFAULT_TRUNCATION_DISTANCE(), int maxWeight = DEFAULT_MAX_WEIGHT());
+
+    /** Fuses the depth of a frame into the volume. The voxels are processed in parallel by slabs of constant z.
+     * @param frame The frame, only its depth (of type used in depthTo3d) and its mask (CV_8UC1, it can be empty)
+     *        are used
+     * @param cameraMatrix Camera matrix
+     * @param pose The pose of the frame (4x4 matrix of CV_64FC1 or CV_32FC1 type), e.g. from KeyframeOdometry
+     *        or from the registration of the frame against a raycast of the volume
+     */
+    void
+    integrate(const RgbdFrame& frame, const Mat& cameraMatrix, const Mat& pose);
+
+    /** Renders the surface seen by a camera of the given pose by marching along the rays of the pixels in parallel.
+     * The frame gets a depth pyramid with its cloud and normals pyramids computed from the volume, every level
+     * being raycast with the camera matrix of its resolution, so that it is ready to be used by the Odometry.
+     * The pixels whose rays do not meet the surface get NaN values.
+     * @param cameraMatrix Camera matrix of the full resolution
+     * @param pose The pose of the camera
+     * @param frameSize The size of the full resolution
+     * @param levelsCount The number of levels of the pyramids, it has to be at least the number of levels of
+     *        the odometry using the frame
+     * @param frame The resulting frame: depth, normals, pyramidDepth, pyramidCloud and pyramidNormals are set,
+     *        the other data is released
+     */
+    void
+    raycast(const Mat& cameraMatrix, const Mat& pose, const Size& frameSize, int levelsCount,
+            OdometryFrame& frame) const;
+
+    /** Forgets all the fused frames */
+    void
+    reset();
+
+    Vec3i
+    getResolution() const
+    {
+      return resolution;
+    }
+    float
+    getVoxelSize() const
+    {
+      return voxelSize;
+    }
+    Vec3f
+    getOrigin() const
+    {
+      return origin;
+    }
+    float
+    getTruncationDistance() const
+    {
+      return truncationDistance;
+    }
+    int
+    getMaxWeight() const
+    {
+      return maxWeight;
+    }
+
+    /** The voxels, of CV_32FC2 type: the truncated signed distance and the weight. The voxel (x, y, z) is
+     * at the row z * resolution[1] + y and at the column x.
+     */
+    const Mat&
+    getVolume() const
+    {
+      return volume;
+    }
+
+  protected:
+    Vec3i resolution;
+    float voxelSize;
+    Vec3f origin;
+    float truncationDistance;
+    int maxWeight;
+
+    Mat volume;
+  };
+
+  /** Truncated signed distance function stored sparsely, as in ``Real-time 3D Reconstruction at Scale using Voxel
+   * Hashing`` by M. Niessner et al. The space is divided into blocks of blockSize^3 voxels, and only the blocks
+   * crossed by the truncation band around the observed surfaces are allocated and found through a hash table
+   * of their coordinates, so the memory grows with the area of the surfaces rather than with the volume of the scene,
+   * which is not bounded. The voxels are the ones of TsdfVolume.
+   * The poses are the transformations from the camera coordinates to the world ones (world_p = pose * camera_p).
+   */
+  class CV_EXPORTS HashTsdfVolume
+  {
+  public:
+    static inline int
+    DEFAULT_BLOCK_SIZE()
+    {
+      return 8;
+    }
+
+    HashTsdfVolume();
+    /** Constructor.
+     * @param voxelSize The size of a voxel in meters
+     * @param truncationDistance The distance in meters from which the signed distances are truncated
+     * @param maxWeight The weight of a voxel is not increased over maxWeight
+     * @param blockSize The number of voxels of the side of a block
+     */
+    HashTsdfVolume(float voxelSize, float truncationDistance = TsdfVolume::DEFAULT_TRUNCATION_DISTANCE(),
+                   int maxWeight = TsdfVolume::DEFAULT_MAX_WEIGHT(), int blockSize = DEFAULT_BLOCK_SIZE());
+
+    /** Fuses an organized point cloud into the volume. The blocks around the points are found in parallel over
+     * the rows of the cloud and allocated, then the voxels of these blocks are updated in parallel.
+     * @param points3d The points in the camera coordinates, e.g. the output of depthTo3d (CV_32FC3 of the size
+     *        of the depth image, NaN if there is no depth)
+     * @param cameraMatrix Camera matrix of the cloud
+     * @param pose The pose of the camera (4x4 matrix of CV_64FC1 or CV_32FC1 type), e.g. from an Odometry
+     */
+    void
+    integrate(const Mat& points3d, const Mat& cameraMatrix, const Mat& pose);
+
+    /** Exports the points where the distance of the voxels of some blocks changes its sign, with the normals of the
+     * surface there (the gradient of the distance, pointing to the free space). The surface can be streamed by
+     * exporting the blocks by ranges. The points and the normals are in the world coordinates, as vectors of
+     * CV_32FC3 type (1 x N matrices).
+     * @param firstBlock The index of the first exported block
+     * @param blocksCount The number of exported blocks, -1 to export up to the last block
+     * @param points The points of the surface
+     * @param normals The normals of the points (NaN if a voxel around the point was never observed)
+     */
+    void
+    exportSurface(int firstBlock, int blocksCount, Mat& points, Mat& normals) const;
+
+    /** Exports the points and the normals of the whole surface */
+    void
+    exportSurface(Mat& points, Mat& normals) const
+    {
+      exportSurface(0, -1, points, normals);
+    }
+
+    /** Forgets all the fused frames and frees the blocks */
+    void
+    reset();
+
+    int
+    getBlocksCount() const
+    {
+      return static_cast<int>(blockCoords.size());
+    }
+    float
+    getVoxelSize() const
+    {
+      return voxelSize;
+    }
+    float
+    getTruncationDistance() const
+    {
+      return truncationDistance;
+    }
+    int
+    getMaxWeight() const
+    {
+      return maxWeight;
+    }
+    int
+    getBlockSize() const
+    {
+      return blockSize;
+    }
+
+  protected:
+    float voxelSize;
+    float truncationDistance;
+    int maxWeight;
+    int blockSize;
+
+    /** The coordinates of the allocated blocks, in blocks */
+    std::vector<Vec3i> blockCoords;
+    /** Open addressing table of the indices of the blocks (-1 for the free entries), its size is a power of 2 */
+    std::vector<int> hashTable;
+    /** The voxels of the blocks, as in TsdfVolume: the ones of the block i start at i * blockSize^3,
+     * x being the fastest varying coordinate */
+    std::vector<Vec2f> voxels;
+  };
+
   /** Warp the image: compute 3d points from the depth, transform them using given transformation, 
    * then project color point cloud to an image plane. 
    * This function can be used to visualize results of the Odometry algorithm.
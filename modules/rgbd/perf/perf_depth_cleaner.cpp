@@ -0,0 +1,50 @@
+#include "perf_precomp.hpp"
+
+using namespace std;
+using namespace std::tr1;
+using namespace testing;
+using namespace perf;
+using namespace cv;
+
+CV_ENUM(CleanerMethod, DepthCleaner::DEPTH_CLEANER_NIL, DepthCleaner::DEPTH_CLEANER_BILATERAL,
+                       DepthCleaner::DEPTH_CLEANER_TEMPORAL_MEDIAN, DepthCleaner::DEPTH_CLEANER_TEMPORAL_MEAN)
+
+typedef tuple<CleanerMethod, MatDepth, Size> CleanerMethod_DepthType_Size_t;
+typedef TestBaseWithParam<CleanerMethod_DepthType_Size_t> CleanerMethod_DepthType_Size;
+
+/** A noisy tilted wall in front of the camera, in millimeters for CV_16U and in meters otherwise */
+static
+void generateNoisyDepth(const Size& size, int depthType, Mat& depth)
+{
+    Mat_<float> depth_m(size);
+    RNG rng(0);
+    for(int y = 0; y < size.height; y++)
+        for(int x = 0; x < size.width; x++)
+            depth_m(y,x) = static_cast<float>(1.5 + 0.3 * x / size.width + rng.gaussian(0.003));
+
+    if(depthType == CV_16U)
+        depth_m.convertTo(depth, CV_16U, 1000.);
+    else
+        depth_m.convertTo(depth, depthType);
+}
+
+PERF_TEST_P(CleanerMethod_DepthType_Size, DepthCleaner_compute,
+            Combine(CleanerMethod::all(), Values(CV_16U, CV_32F), Values(szQVGA, szVGA)))
+{
+    const int method = get<0>(GetParam());
+    const int depthType = get<1>(GetParam());
+    const Size size = get<2>(GetParam());
+
+    Mat depth;
+    generateNoisyDepth(size, depthType, depth);
+
+    DepthCleaner depthCleaner(depthType, 5, method);
+    depthCleaner.initialize();
+
+    Mat cleaned;
+    declare.in(depth).out(cleaned);
+
+    TEST_CYCLE() depthCleaner(depth, cleaned);
+
+    SANITY_CHECK_NOTHING();
+}
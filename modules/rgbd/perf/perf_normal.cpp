@@ -0,0 +1,135 @@
+#include "perf_precomp.hpp"
+
+using namespace std;
+using namespace std::tr1;
+using namespace testing;
+using namespace perf;
+using namespace cv;
+
+CV_ENUM(NormalsMethod, RgbdNormals::RGBD_NORMALS_METHOD_FALS, RgbdNormals::RGBD_NORMALS_METHOD_LINEMOD,
+                       RgbdNormals::RGBD_NORMALS_METHOD_SRI)
+
+typedef tuple<NormalsMethod, Size> NormalsMethod_Size_t;
+typedef TestBaseWithParam<NormalsMethod_Size_t> NormalsMethod_Size;
+
+typedef TestBaseWithParam<Size> Depth_Size;
+
+typedef tuple<MatDepth, Size> DepthType_Size_t;
+typedef TestBaseWithParam<DepthType_Size_t> DepthType_Size;
+
+/** A tilted wavy wall in front of the camera, in meters */
+static
+void generateDepth(const Size& size, Mat& depth)
+{
+    depth.create(size, CV_32FC1);
+    for(int y = 0; y < size.height; y++)
+        for(int x = 0; x < size.width; x++)
+        {
+            const double u = static_cast<double>(x) / size.width, v = static_cast<double>(y) / size.height;
+            depth.at<float>(y,x) = static_cast<float>(1.5 + 0.3 * u + 0.05 * std::sin(12. * u) * std::cos(9. * v));
+        }
+}
+
+PERF_TEST_P(NormalsMethod_Size, RgbdNormals_compute,
+            Combine(NormalsMethod::all(), Values(szQVGA, szVGA)))
+{
+    const int method = get<0>(GetParam());
+    const Size size = get<1>(GetParam());
+
+    Mat K = getCameraMatrix(size, CV_32F);
+    Mat depth, points3d;
+    generateDepth(size, depth);
+    depthTo3d(depth, K, points3d);
+
+    RgbdNormals normalsComputer(size.height, size.width, CV_32F, K, 5, method);
+    normalsComputer.initialize();
+
+    Mat normals;
+    declare.in(points3d).out(normals);
+
+    TEST_CYCLE() normalsComputer(points3d, normals);
+
+    SANITY_CHECK_NOTHING();
+}
+
+PERF_TEST_P(DepthType_Size, RgbdNormals_LINEMOD_depth,
+            Combine(Values(CV_16U, CV_32F), Values(szQVGA, szVGA)))
+{
+    const int depthType = get<0>(GetParam());
+    const Size size = get<1>(GetParam());
+
+    Mat K = getCameraMatrix(size, CV_32F);
+    Mat depth;
+    generateDepth(size, depth);
+    // LINEMOD works on the raw depth image, in millimeters for CV_16U
+    if(depthType == CV_16U)
+        depth.convertTo(depth, CV_16U, 1000.);
+
+    RgbdNormals normalsComputer(size.height, size.width, CV_32F, K, 5, RgbdNormals::RGBD_NORMALS_METHOD_LINEMOD);
+    normalsComputer.initialize();
+
+    Mat normals;
+    declare.in(depth).out(normals);
+
+    TEST_CYCLE() normalsComputer(depth, normals);
+
+    SANITY_CHECK_NOTHING();
+}
+
+PERF_TEST_P(DepthType_Size, depthTo3d,
+            Combine(Values(CV_16U, CV_32F), Values(szQVGA, szVGA)))
+{
+    const int depthType = get<0>(GetParam());
+    const Size size = get<1>(GetParam());
+
+    Mat K = getCameraMatrix(size, CV_32F);
+    Mat depth, points3d;
+    generateDepth(size, depth);
+    if(depthType == CV_16U)
+        depth.convertTo(depth, CV_16U, 1000.);
+
+    declare.in(depth).out(points3d);
+
+    TEST_CYCLE() depthTo3d(depth, K, points3d);
+
+    SANITY_CHECK_NOTHING();
+}
+
+PERF_TEST_P(Depth_Size, depthTo3dPlanar, Values(szQVGA, szVGA))
+{
+    const Size size = GetParam();
+
+    Mat K = getCameraMatrix(size, CV_32F);
+    Mat depth;
+    generateDepth(size, depth);
+    depth.convertTo(depth, CV_16U, 1000.);
+
+    vector<Mat> planes;
+    declare.in(depth);
+
+    TEST_CYCLE() depthTo3dPlanar(depth, K, planes);
+
+    SANITY_CHECK_NOTHING();
+}
+
+PERF_TEST_P(Depth_Size, RgbdPlane_compute, Values(szQVGA, szVGA))
+{
+    const Size size = GetParam();
+
+    Mat K = getCameraMatrix(size, CV_32F);
+    Mat depth, points3d;
+    generateDepth(size, depth);
+    depthTo3d(depth, K, points3d);
+
+    RgbdNormals normalsComputer(size.height, size.width, CV_32F, K, 5, RgbdNormals::RGBD_NORMALS_METHOD_FALS);
+    Mat normals;
+    normalsComputer(points3d, normals);
+
+    RgbdPlane planeComputer;
+    Mat mask, coefficients;
+    declare.in(points3d, normals).out(mask);
+
+    TEST_CYCLE() planeComputer(points3d, normals, mask, coefficients);
+
+    SANITY_CHECK_NOTHING();
+}
@@ -0,0 +1,279 @@
+#include <opencv2/calib3d.hpp>
+
+#include "perf_precomp.hpp"
+
+using namespace std;
+using namespace std::tr1;
+using namespace testing;
+using namespace perf;
+using namespace cv;
+
+typedef tuple<string, Size, int> Odometry_Size_Levels_t;
+typedef TestBaseWithParam<Odometry_Size_Levels_t> Odometry_Size_Levels;
+
+#define ODOMETRY_TYPES Values(string("RGBD.RgbdOdometry"), string("RGBD.ICPOdometry"), string("RGBD.RgbdICPOdometry"))
+#define ODOMETRY_SIZES Values(szQVGA, szVGA)
+#define ODOMETRY_LEVELS Values(1, 2, 4)
+
+/** Renders a textured wavy wall seen by a camera translated by t, so that the frames have some
+ * geometric and photometric structure for the odometry.
+ */
+static
+void renderFrame(const Mat& K, const Size& size, const Point3d& t, Mat& image, Mat& depth)
+{
+    const double fx = K.at<double>(0,0), fy = K.at<double>(1,1),
+                 cx = K.at<double>(0,2), cy = K.at<double>(1,2);
+
+    image.create(size, CV_8UC1);
+    depth.create(size, CV_32FC1);
+    for(int y = 0; y < size.height; y++)
+    {
+        for(int x = 0; x < size.width; x++)
+        {
+            const double xn = (x - cx) / fx, yn = (y - cy) / fy;
+            // intersect the ray with the height field z = f(X, Y) by fixed point iterations
+            double z = 1.5, X = 0, Y = 0;
+            for(int i = 0; i < 8; i++)
+            {
+                X = xn * z + t.x;
+                Y = yn * z + t.y;
+                z = 1.5 + 0.1 * std::sin(4. * X) * std::cos(3. * Y) + 0.2 * X - t.z;
+            }
+            depth.at<float>(y,x) = static_cast<float>(z);
+            image.at<uchar>(y,x) = saturate_cast<uchar>(128. + 60. * std::sin(40. * X) * std::sin(35. * Y) +
+                                                        40. * std::cos(13. * X + 7. * Y));
+        }
+    }
+}
+
+static
+Ptr<Odometry> createOdometry(const string& name, const Mat& K, int levels)
+{
+    Ptr<Odometry> odometry = Algorithm::create<Odometry>(name);
+    odometry->set("cameraMatrix", K);
+    odometry->set("iterCounts", Mat(vector<int>(levels, 7)).clone());
+    if(name != "RGBD.ICPOdometry")
+        odometry->set("minGradientMagnitudes", Mat(vector<float>(levels, 10.f)).clone());
+    return odometry;
+}
+
+PERF_TEST_P(Odometry_Size_Levels, Odometry_prepareFrameCache,
+            Combine(ODOMETRY_TYPES, ODOMETRY_SIZES, ODOMETRY_LEVELS))
+{
+    const string name = get<0>(GetParam());
+    const Size size = get<1>(GetParam());
+    const int levels = get<2>(GetParam());
+
+    Mat K = getCameraMatrix(size);
+    Mat image, depth;
+    renderFrame(K, size, Point3d(), image, depth);
+    Ptr<Odometry> odometry = createOdometry(name, K, levels);
+
+    declare.in(image, depth);
+
+    // the pyramids, the cloud, the gradients and the normals of both roles
+    TEST_CYCLE()
+    {
+        Ptr<OdometryFrame> frame(new OdometryFrame(image, depth));
+        odometry->prepareFrameCache(frame, OdometryFrame::CACHE_ALL);
+    }
+
+    SANITY_CHECK_NOTHING();
+}
+
+PERF_TEST_P(Odometry_Size_Levels, Odometry_compute,
+            Combine(ODOMETRY_TYPES, ODOMETRY_SIZES, ODOMETRY_LEVELS))
+{
+    const string name = get<0>(GetParam());
+    const Size size = get<1>(GetParam());
+    const int levels = get<2>(GetParam());
+
+    Mat K = getCameraMatrix(size);
+    Mat srcImage, srcDepth, dstImage, dstDepth;
+    renderFrame(K, size, Point3d(), srcImage, srcDepth);
+    renderFrame(K, size, Point3d(0.01, -0.005, 0.01), dstImage, dstDepth);
+    Ptr<Odometry> odometry = createOdometry(name, K, levels);
+
+    // the caches are prepared once, so only the iterations are measured:
+    // the correspondences, the linear systems and their solutions
+    Ptr<OdometryFrame> srcFrame(new OdometryFrame(srcImage, srcDepth));
+    Ptr<OdometryFrame> dstFrame(new OdometryFrame(dstImage, dstDepth));
+    odometry->prepareFrameCache(srcFrame, OdometryFrame::CACHE_SRC);
+    odometry->prepareFrameCache(dstFrame, OdometryFrame::CACHE_DST);
+
+    // the time of each step is accumulated from the statistics of the calls
+    Ptr<OdometryStats> stats(new OdometryStats());
+    odometry->setStats(stats);
+    double correspsTime = 0, lsmTime = 0, solveTime = 0;
+    int callsCount = 0;
+
+    Mat Rt;
+    TEST_CYCLE()
+    {
+        odometry->compute(srcFrame, dstFrame, Rt);
+        correspsTime += stats->correspsTime;
+        lsmTime += stats->lsmTime;
+        solveTime += stats->solveTime;
+        callsCount++;
+    }
+
+    // the mean times of the steps in microseconds
+    if(callsCount > 0)
+    {
+        RecordProperty("corresps_time", cvRound(correspsTime / callsCount));
+        RecordProperty("lsm_time", cvRound(lsmTime / callsCount));
+        RecordProperty("solve_time", cvRound(solveTime / callsCount));
+    }
+
+    SANITY_CHECK_NOTHING();
+}
+
+PERF_TEST_P(Odometry_Size_Levels, Odometry_computeFromImages,
+            Combine(ODOMETRY_TYPES, ODOMETRY_SIZES, ODOMETRY_LEVELS))
+{
+    const string name = get<0>(GetParam());
+    const Size size = get<1>(GetParam());
+    const int levels = get<2>(GetParam());
+
+    Mat K = getCameraMatrix(size);
+    Mat srcImage, srcDepth, dstImage, dstDepth;
+    renderFrame(K, size, Point3d(), srcImage, srcDepth);
+    renderFrame(K, size, Point3d(0.01, -0.005, 0.01), dstImage, dstDepth);
+    Ptr<Odometry> odometry = createOdometry(name, K, levels);
+
+    declare.in(srcImage, srcDepth, dstImage, dstDepth);
+
+    Mat Rt;
+    TEST_CYCLE() odometry->compute(srcImage, srcDepth, Mat(), dstImage, dstDepth, Mat(), Rt);
+
+    SANITY_CHECK_NOTHING();
+}
+
+typedef TestBaseWithParam<Size> Odometry_Size;
+
+PERF_TEST_P(Odometry_Size, warpFrame, ODOMETRY_SIZES)
+{
+    const Size size = GetParam();
+
+    Mat K = getCameraMatrix(size);
+    Mat image, depth;
+    renderFrame(K, size, Point3d(), image, depth);
+
+    // a small motion, as the one between two frames of the odometry
+    Mat Rt = Mat::eye(4, 4, CV_64FC1);
+    {
+        Mat R;
+        Rodrigues(Vec3d(0.01, -0.02, 0.005), R);
+        R.copyTo(Rt(Rect(0, 0, 3, 3)));
+        Rt.at<double>(0,3) = 0.01;
+        Rt.at<double>(1,3) = -0.005;
+        Rt.at<double>(2,3) = 0.01;
+    }
+
+    declare.in(image, depth);
+
+    Mat warpedImage, warpedDepth, warpedMask;
+    TEST_CYCLE() warpFrame(image, depth, Mat(), Rt, K, Mat(), warpedImage, &warpedDepth, &warpedMask);
+
+    SANITY_CHECK_NOTHING();
+}
+
+PERF_TEST_P(Odometry_Size, TsdfVolume_integrate, ODOMETRY_SIZES)
+{
+    const Size size = GetParam();
+
+    Mat K = getCameraMatrix(size);
+    Mat image, depth;
+    renderFrame(K, size, Point3d(), image, depth);
+    const Mat pose = Mat::eye(4, 4, CV_64FC1);
+
+    // a 2.56 m cube of 2 cm voxels around the wall
+    TsdfVolume volume(Vec3i(128, 128, 128), 0.02f, Vec3f(-1.28f, -1.28f, 0.3f), 0.06f);
+    const RgbdFrame frame(image, depth);
+
+    declare.in(image, depth);
+
+    TEST_CYCLE() volume.integrate(frame, K, pose);
+
+    SANITY_CHECK_NOTHING();
+}
+
+PERF_TEST_P(Odometry_Size, TsdfVolume_raycast, ODOMETRY_SIZES)
+{
+    const Size size = GetParam();
+
+    Mat K = getCameraMatrix(size);
+    Mat image, depth;
+    renderFrame(K, size, Point3d(), image, depth);
+    const Mat pose = Mat::eye(4, 4, CV_64FC1);
+
+    TsdfVolume volume(Vec3i(128, 128, 128), 0.02f, Vec3f(-1.28f, -1.28f, 0.3f), 0.06f);
+    volume.integrate(RgbdFrame(image, depth), K, pose);
+
+    // the depth, cloud and normals pyramids of the model frame for a 4 levels odometry
+    OdometryFrame frame;
+    TEST_CYCLE() volume.raycast(K, pose, size, 4, frame);
+
+    SANITY_CHECK_NOTHING();
+}
+
+PERF_TEST_P(Odometry_Size, HashTsdfVolume_integrate, ODOMETRY_SIZES)
+{
+    const Size size = GetParam();
+
+    Mat K = getCameraMatrix(size);
+    Mat image, depth, points3d;
+    renderFrame(K, size, Point3d(), image, depth);
+    depthTo3d(depth, K, points3d);
+    const Mat pose = Mat::eye(4, 4, CV_64FC1);
+
+    declare.in(points3d);
+
+    // the blocks are allocated by the first frame, the next ones find them in the hash table
+    HashTsdfVolume volume(0.01f, 0.03f);
+    TEST_CYCLE() volume.integrate(points3d, K, pose);
+
+    SANITY_CHECK_NOTHING();
+}
+
+PERF_TEST_P(Odometry_Size, HashTsdfVolume_exportSurface, ODOMETRY_SIZES)
+{
+    const Size size = GetParam();
+
+    Mat K = getCameraMatrix(size);
+    Mat image, depth, points3d;
+    renderFrame(K, size, Point3d(), image, depth);
+    depthTo3d(depth, K, points3d);
+
+    HashTsdfVolume volume(0.01f, 0.03f);
+    volume.integrate(points3d, K, Mat::eye(4, 4, CV_64FC1));
+
+    Mat points, normals;
+    TEST_CYCLE() volume.exportSurface(points, normals);
+
+    SANITY_CHECK_NOTHING();
+}
+
+PERF_TEST_P(Odometry_Size, Odometry_computeSequence, ODOMETRY_SIZES)
+{
+    const Size size = GetParam();
+    const int framesCount = 16;
+
+    Mat K = getCameraMatrix(size);
+    vector<Mat> images(framesCount), depths(framesCount);
+    for(int i = 0; i < framesCount; i++)
+        renderFrame(K, size, Point3d(0.005 * i, -0.002 * i, 0.004 * i), images[i], depths[i]);
+    Ptr<Odometry> odometry = createOdometry("RGBD.RgbdICPOdometry", K, 3);
+
+    // the caches of the frames are prepared and released by the call, as for a recorded sequence
+    vector<Ptr<OdometryFrame> > frames(framesCount);
+    vector<Mat> poses;
+    TEST_CYCLE()
+    {
+        for(int i = 0; i < framesCount; i++)
+            frames[i] = new OdometryFrame(images[i], depths[i]);
+        odometry->computeSequence(frames, poses);
+    }
+
+    SANITY_CHECK_NOTHING();
+}
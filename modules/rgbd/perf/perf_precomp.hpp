@@ -0,0 +1,34 @@
+#ifdef __GNUC__
+#  pragma GCC diagnostic ignored "-Wmissing-declarations"
+#  if defined __clang__ || defined __APPLE__
+#    pragma GCC diagnostic ignored "-Wmissing-prototypes"
+#    pragma GCC diagnostic ignored "-Wextra"
+#  endif
+#endif
+
+#ifndef __OPENCV_PERF_PRECOMP_HPP__
+#define __OPENCV_PERF_PRECOMP_HPP__
+
+#include <opencv2/ts.hpp>
+#include <opencv2/rgbd.hpp>
+
+#ifdef GTEST_CREATE_SHARED_LIBRARY
+#error no modules except ts should have GTEST_CREATE_SHARED_LIBRARY defined
+#endif
+
+/** The intrinsics of a VGA Kinect scaled to the frame size
+ * @param depth CV_32F or CV_64F, the depth of the matrix
+ */
+static inline
+cv::Mat getCameraMatrix(const cv::Size& size, int depth = CV_64F)
+{
+    const double scale = size.width / 640.;
+    cv::Mat K = (cv::Mat_<double>(3,3) << 525. * scale, 0., 0.5 * (size.width - 1),
+                                          0., 525. * scale, 0.5 * (size.height - 1),
+                                          0., 0., 1.);
+    if(depth != CV_64F)
+        K.convertTo(K, depth);
+    return K;
+}
+
+#endif
@@ -34,6 +34,7 @@
  */
 
 #include <opencv2/calib3d.hpp>
+#include <opencv2/core/utility.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/rgbd.hpp>
 #include <iostream>
@@ -61,6 +62,9 @@ namespace
     virtual void
     cache()=0;
 
+    virtual void
+    compute(const cv::Mat& depth_in, cv::Mat& depth_out) const=0;
+
     bool
     validate(int depth, int window_size, int method) const
     {
@@ -77,9 +81,119 @@ namespace
 
 namespace
 {
-  /** Given a depth image, compute the normals as detailed in the LINEMOD paper
-   * ``Gradient Response Maps for Real-Time Detection of Texture-Less Objects``
-   * by S. Hinterstoisser, C. Cagniart, S. Ilic, P. Sturm, N. Navab, P. Fua, and V. Lepetit
+  /** Clean some rows of a depth image with the NIL method. In the original formulation, every pixel gives weighted
+   * depths to itself and to its 4 next neighbors in the row-major order, and receives theirs. Here every pixel
+   * gathers the weighted depths of its 8 neighbors instead, so that the rows can be processed independently.
+   * The weights are always computed with the sigma_z of the pixel receiving the depth.
+   */
+  template<typename DepthDepth, typename ContainerDepth>
+  class NILInvoker: public cv::ParallelLoopBody
+  {
+  public:
+    NILInvoker(const cv::Mat_<DepthDepth> &depth_in, cv::Mat_<DepthDepth> &depth_out, ContainerDepth scale)
+        :
+          depth_in_(depth_in),
+          depth_out_(depth_out),
+          scale_(scale)
+    {
+    }
+
+    virtual void
+    operator()(const cv::Range &range) const
+    {
+      const int rows = depth_in_.rows, cols = depth_in_.cols;
+      const ContainerDepth theta_mean = 30. * CV_PI / 180;
+      const ContainerDepth sigma_L = 0.8 + 0.035 * theta_mean / (CV_PI / 2 - theta_mean);
+      const ContainerDepth difference_threshold = 10;
+
+      // The first 4 neighbors are the ones a pixel gives its depth to in the original formulation, the last 4 ones
+      // are the pixels giving it their depth
+      static const int offsets_y[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+      static const int offsets_x[8] = { 1, -1, 0, 1, -1, 1, 0, -1 };
+      ContainerDepth spatial_exponents[8];
+      for (int k = 0; k < 8; ++k)
+      {
+        ContainerDepth delta_u2 = ContainerDepth(offsets_y[k] * offsets_y[k] + offsets_x[k] * offsets_x[k]);
+        spatial_exponents[k] = -delta_u2 / 2 / sigma_L / sigma_L;
+      }
+
+      // The weights of the neighbors of a row, computed with one vectorized call to cv::exp
+      cv::Mat_<ContainerDepth> weights(8, cols);
+      cv::Mat_<uchar> valid(8, cols);
+
+      for (int y = range.start; y < range.end; ++y)
+      {
+        const DepthDepth *row_in = depth_in_[y];
+        for (int x = 0; x < cols; ++x)
+        {
+          const DepthDepth d = row_in[x];
+          const ContainerDepth z = d * scale_ - ContainerDepth(0.4);
+          const ContainerDepth sigma_z = ContainerDepth(0.0012) + ContainerDepth(0.0019) * z * z;
+          for (int k = 0; k < 8; ++k)
+          {
+            const int y_neighbor = y + offsets_y[k], x_neighbor = x + offsets_x[k];
+            // The pixel giving its depth must be in the area the original loops go over
+            const int y_giver = (k < 4) ? y : y_neighbor, x_giver = (k < 4) ? x : x_neighbor;
+            bool is_valid = (y_giver >= 0) && (y_giver < rows - 1) && (x_giver >= 1) && (x_giver < cols - 1);
+            ContainerDepth exponent = 0;
+            if (is_valid)
+            {
+              const DepthDepth d_neighbor = depth_in_(y_neighbor, x_neighbor);
+              ContainerDepth delta_z;
+              if (d > d_neighbor)
+                delta_z = d - d_neighbor;
+              else
+                delta_z = d_neighbor - d;
+              is_valid = delta_z < difference_threshold;
+              if (is_valid)
+              {
+                delta_z *= scale_;
+                exponent = spatial_exponents[k] - delta_z * delta_z / 2 / sigma_z / sigma_z;
+              }
+            }
+            valid(k, x) = is_valid;
+            weights(k, x) = exponent;
+          }
+        }
+
+        cv::exp(weights, weights);
+
+        DepthDepth *row_out = depth_out_[y];
+        for (int x = 0; x < cols; ++x)
+        {
+          const DepthDepth d = row_in[x];
+          ContainerDepth w_sum = 0, Dw_sum = 0;
+          // The pixel itself, with a weight of 1
+          if ((y < rows - 1) && (x >= 1) && (x < cols - 1) && !cvIsNaN(ContainerDepth(d)))
+          {
+            w_sum = 1;
+            Dw_sum = d;
+          }
+          for (int k = 0; k < 8; ++k)
+          {
+            if (!valid(k, x))
+              continue;
+            const ContainerDepth w = weights(k, x);
+            w_sum += w;
+            Dw_sum += depth_in_(y + offsets_y[k], x + offsets_x[k]) * w;
+          }
+          // Same as the division of cv::divide, that gives 0 when dividing by 0
+          row_out[x] = (w_sum == 0) ? DepthDepth(0) : cv::saturate_cast<DepthDepth>(Dw_sum / w_sum);
+        }
+      }
+    }
+
+  private:
+    NILInvoker& operator=(const NILInvoker&);
+
+    const cv::Mat_<DepthDepth> &depth_in_;
+    cv::Mat_<DepthDepth> &depth_out_;
+    ContainerDepth scale_;
+  };
+
+  /** Given a depth image, clean it with the NIL method described in
+   * ``Modeling Kinect Sensor Noise for Improved 3d Reconstruction and Tracking``
+   * by C. Nguyen, S. Izadi, D. Lovel
    */
   template<typename T>
   class NIL: public DepthCleanerImpl
@@ -101,11 +215,11 @@ namespace
     {
     }
 
-    /** Compute the normals
-     * @param r
-     * @return
+    /** Clean the depth
+     * @param depth_in the depth image to clean
+     * @param depth_out the cleaned depth
      */
-    void
+    virtual void
     compute(const cv::Mat& depth_in, cv::Mat& depth_out) const
     {
       switch (depth_in.depth())
@@ -113,9 +227,7 @@ namespace
         case CV_16U:
         {
           const cv::Mat_<unsigned short> &depth(depth_in);
-          cv::Mat depth_out_tmp;
-          computeImpl<unsigned short, float>(depth, depth_out_tmp, 0.001);
-          depth_out_tmp.convertTo(depth_out, CV_16U);
+          computeImpl<unsigned short, float>(depth, depth_out, 0.001f);
           break;
         }
         case CV_32F:
@@ -134,67 +246,389 @@ namespace
     }
 
   private:
-    /** Compute the normals
-     * @param r
-     * @return
+    /** Clean the depth, in parallel over the rows
+     * @param depth_in the depth image to clean
+     * @param depth_out the cleaned depth, written directly if it has the depth of depth_in and does not share
+     * its data: the pixels read the rows above and below them
+     * @param scale the scale converting the depth to meters
      */
     template<typename DepthDepth, typename ContainerDepth>
     void
     computeImpl(const cv::Mat_<DepthDepth> &depth_in, cv::Mat & depth_out, ContainerDepth scale) const
     {
-      const ContainerDepth theta_mean = 30. * CV_PI / 180;
-      int rows = depth_in.rows;
-      int cols = depth_in.cols;
+      const bool is_in_place = (depth_out.datastart < depth_in.dataend) && (depth_in.datastart < depth_out.dataend);
+      cv::Mat_<DepthDepth> depth_out_T;
+      if ((depth_out.depth() == depth_in.depth()) && !is_in_place)
+        depth_out_T = depth_out;
+      else
+        depth_out_T.create(depth_in.size());
 
-      // Precompute some data
-      const ContainerDepth sigma_L = 0.8 + 0.035 * theta_mean / (CV_PI / 2 - theta_mean);
-      cv::Mat_<ContainerDepth> sigma_z(rows, cols);
-      for (int y = 0; y < rows; ++y)
-        for (int x = 0; x < cols; ++x)
-          sigma_z(y, x) = 0.0012 + 0.0019 * (depth_in(y, x) * scale - 0.4) * (depth_in(y, x) * scale - 0.4);
+      cv::parallel_for_(cv::Range(0, depth_in.rows),
+                        NILInvoker<DepthDepth, ContainerDepth>(depth_in, depth_out_T, scale));
+
+      if (depth_out_T.data != depth_out.data)
+        depth_out_T.convertTo(depth_out, depth_out.type());
+    }
+  };
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+  /** The type in which the depths of type T are filtered */
+  template<typename T>
+  struct DepthCleanerWork
+  {
+    typedef T Type;
+  };
+
+  template<>
+  struct DepthCleanerWork<unsigned short>
+  {
+    typedef float Type;
+  };
+
+  /** The scale converting a depth of type T to meters: CV_16U depths are in millimeters */
+  template<typename T>
+  inline double
+  depthScale()
+  {
+    return 1;
+  }
+
+  template<>
+  inline double
+  depthScale<unsigned short>()
+  {
+    return 0.001;
+  }
+
+  /** The standard deviation of the axial noise of a Kinect-style sensor at a given depth, in meters, from
+   * ``Modeling Kinect Sensor Noise for Improved 3d Reconstruction and Tracking``
+   * @param z the depth in meters
+   */
+  template<typename T>
+  inline T
+  sigmaZ(T z)
+  {
+    return T(0.0012) + T(0.0019) * (z - T(0.4)) * (z - T(0.4));
+  }
+
+  /** One pass of the separable bilateral filter, along the rows or along the columns
+   */
+  template<typename Src, typename Dst, typename Work>
+  class BilateralPassInvoker: public cv::ParallelLoopBody
+  {
+  public:
+    BilateralPassInvoker(const cv::Mat_<Src> &src, cv::Mat_<Dst> &dst, bool vertical, const std::vector<Work> &spatial,
+                         const std::vector<Work> &exp_table, Work exp_table_scale, Work scale)
+        :
+          src_(src),
+          dst_(dst),
+          vertical_(vertical),
+          spatial_(spatial),
+          exp_table_(exp_table),
+          exp_table_scale_(exp_table_scale),
+          scale_(scale)
+    {
+    }
+
+    virtual void
+    operator()(const cv::Range &range) const
+    {
+      const int half = static_cast<int>(spatial_.size()) / 2;
+      const int table_size = static_cast<int>(exp_table_.size());
+      const int length = vertical_ ? src_.rows : src_.cols;
+      const size_t step = vertical_ ? src_.step1() : 1;
+
+      for (int y = range.start; y < range.end; ++y)
+      {
+        const Src *row_src = src_[y];
+        Dst *row_dst = dst_[y];
+        for (int x = 0; x < src_.cols; ++x)
+        {
+          const Src d_center = row_src[x];
+          // Invalid depths stay as they are
+          if (!(d_center > 0))
+          {
+            row_dst[x] = cv::saturate_cast<Dst>(d_center);
+            continue;
+          }
+
+          // The range weights depend on the noise of the sensor at that depth
+          const Work sigma = sigmaZ<Work>(Work(d_center) * scale_) / scale_;
+          const Work range_factor = exp_table_scale_ / (2 * sigma * sigma);
+
+          const int position = vertical_ ? y : x;
+          const int k_begin = std::max(-half, -position), k_end = std::min(half, length - 1 - position);
+          const Src *neighbor = row_src + x + k_begin * static_cast<ptrdiff_t>(step);
+          Work w_sum = 0, Dw_sum = 0;
+          for (int k = k_begin; k <= k_end; ++k, neighbor += step)
+          {
+            const Src d = *neighbor;
+            if (!(d > 0))
+              continue;
+            const Work delta = Work(d) - Work(d_center);
+            const Work index = delta * delta * range_factor;
+            if (index >= table_size)
+              continue;
+            const Work w = spatial_[k + half] * exp_table_[static_cast<int>(index)];
+            w_sum += w;
+            Dw_sum += w * Work(d);
+          }
+          row_dst[x] = cv::saturate_cast<Dst>(Dw_sum / w_sum);
+        }
+      }
+    }
+
+  private:
+    BilateralPassInvoker& operator=(const BilateralPassInvoker&);
+
+    const cv::Mat_<Src> &src_;
+    cv::Mat_<Dst> &dst_;
+    bool vertical_;
+    const std::vector<Work> &spatial_;
+    const std::vector<Work> &exp_table_;
+    Work exp_table_scale_;
+    Work scale_;
+  };
+
+  /** Smooth the depth with a separable bilateral filter: a horizontal pass followed by a vertical one. The range
+   * sigma is the noise of the sensor at the depth of the pixel (as in NIL), so the discontinuities larger than the
+   * noise are kept. Invalid depths (0 or NaN) do not contribute and are not filled.
+   */
+  template<typename T>
+  class Bilateral: public DepthCleanerImpl
+  {
+  public:
+    typedef typename DepthCleanerWork<T>::Type Work;
+
+    enum
+    {
+      /** Number of entries of the exp table, and largest exponent in it: the weights below exp(-MAX_EXPONENT)
+       * are ignored */
+      EXP_TABLE_SIZE = 1024, MAX_EXPONENT = 8
+    };
+
+    Bilateral(int window_size, int depth, cv::DepthCleaner::DEPTH_CLEANER_METHOD method)
+        :
+          DepthCleanerImpl(window_size, depth, method)
+    {
+    }
+
+    /** Compute cached data
+     */
+    virtual void
+    cache()
+    {
+      const int half = window_size_ / 2;
+      const double sigma_spatial = std::max(window_size_ / 3., 0.5);
+      spatial_.resize(window_size_);
+      for (int k = -half; k <= half; ++k)
+        spatial_[k + half] = Work(std::exp(-k * k / (2 * sigma_spatial * sigma_spatial)));
+
+      exp_table_.resize(EXP_TABLE_SIZE);
+      for (int i = 0; i < EXP_TABLE_SIZE; ++i)
+        exp_table_[i] = Work(std::exp(-double(i) * MAX_EXPONENT / EXP_TABLE_SIZE));
+    }
+
+    /** Clean the depth
+     * @param depth_in the depth image to clean, of the depth of the cleaner
+     * @param depth_out the cleaned depth
+     */
+    virtual void
+    compute(const cv::Mat& depth_in, cv::Mat& depth_out) const
+    {
+      CV_Assert(depth_in.depth() == depth_);
+
+      const cv::Mat_<T> &src(depth_in);
+      cv::Mat_<T> dst(depth_out);
+      cv::Mat_<Work> horizontal(src.size());
+      const Work exp_table_scale = Work(EXP_TABLE_SIZE) / MAX_EXPONENT;
+      const Work scale = Work(depthScale<T>());
+
+      cv::parallel_for_(cv::Range(0, src.rows),
+                        BilateralPassInvoker<T, Work, Work>(src, horizontal, false, spatial_, exp_table_,
+                                                            exp_table_scale, scale));
+      cv::parallel_for_(cv::Range(0, src.rows),
+                        BilateralPassInvoker<Work, T, Work>(horizontal, dst, true, spatial_, exp_table_,
+                                                            exp_table_scale, scale));
+    }
+
+  private:
+    std::vector<Work> spatial_;
+    std::vector<Work> exp_table_;
+  };
+
+  /** Compute the median or the mean of the depths of the last frames, for some rows
+   */
+  template<typename T>
+  class TemporalInvoker: public cv::ParallelLoopBody
+  {
+  public:
+    typedef typename DepthCleanerWork<T>::Type Work;
 
-      ContainerDepth difference_threshold = 10;
-      cv::Mat_<ContainerDepth> Dw_sum = cv::Mat_<ContainerDepth>::zeros(rows, cols), w_sum =
-          cv::Mat_<ContainerDepth>::zeros(rows, cols);
-      for (int y = 0; y < rows - 1; ++y)
+    TemporalInvoker(const std::vector<cv::Mat> &frames, int frame_count, int current, bool median,
+                    cv::Mat_<T> &depth_out)
+        :
+          frames_(frames),
+          frame_count_(frame_count),
+          current_(current),
+          median_(median),
+          depth_out_(depth_out)
+    {
+    }
+
+    virtual void
+    operator()(const cv::Range &range) const
+    {
+      const Work scale = Work(depthScale<T>());
+      const T *rows[7];
+      Work samples[7];
+
+      for (int y = range.start; y < range.end; ++y)
       {
-        // Every pixel has had the contribution of previous pixels (in a row-major way)
-        for (int x = 1; x < cols - 1; ++x)
+        for (int f = 0; f < frame_count_; ++f)
+          rows[f] = frames_[f].ptr<T>(y);
+        T *row_out = depth_out_[y];
+
+        for (int x = 0; x < depth_out_.cols; ++x)
         {
-          for (int j = 0; j <= 1; ++j)
-            for (int i = -1; i <= 1; ++i)
+          const T d_current = rows[current_][x];
+          // A valid depth is only filtered with the depths within 3 sigma of it, so that moving edges do not get
+          // blurred. A hole is filled with all the valid depths of the previous frames.
+          const bool is_valid = d_current > 0;
+          const Work max_delta = is_valid ? 3 * sigmaZ<Work>(Work(d_current) * scale) / scale : Work(0);
+
+          int n = 0;
+          for (int f = 0; f < frame_count_; ++f)
+          {
+            const T d = rows[f][x];
+            if (!(d > 0))
+              continue;
+            if (is_valid && std::abs(Work(d) - Work(d_current)) > max_delta)
+              continue;
+            samples[n++] = Work(d);
+          }
+
+          if (n == 0)
+          {
+            row_out[x] = d_current;
+            continue;
+          }
+
+          Work value;
+          if (median_)
+          {
+            // Insertion sort: there are at most 7 samples
+            for (int i = 1; i < n; ++i)
             {
-              if ((j == 0) && (i == -1))
-                continue;
-              ContainerDepth delta_u = sqrt(
-                  ContainerDepth(j) * ContainerDepth(j) + ContainerDepth(i) * ContainerDepth(i));
-              ContainerDepth delta_z;
-              if (depth_in(y, x) > depth_in(y + j, x + i))
-                delta_z = depth_in(y, x) - depth_in(y + j, x + i);
-              else
-                delta_z = depth_in(y + j, x + i) - depth_in(y, x);
-              if (delta_z < difference_threshold)
-              {
-                delta_z *= scale;
-                ContainerDepth w = exp(
-                    -delta_u * delta_u / 2 / sigma_L / sigma_L - delta_z * delta_z / 2 / sigma_z(y, x) / sigma_z(y, x));
-                w_sum(y, x) += w;
-                Dw_sum(y, x) += depth_in(y + j, x + i) * w;
-                if ((j != 0) || (i != 0))
-                {
-                  w = exp(
-                      -delta_u * delta_u / 2 / sigma_L / sigma_L - delta_z * delta_z / 2 / sigma_z(y + j, x + i)
-                                                                   / sigma_z(y + j, x + i));
-                  w_sum(y + j, x + i) += w;
-                  Dw_sum(y + j, x + i) += depth_in(y, x) * w;
-                }
-              }
+              const Work sample = samples[i];
+              int j = i;
+              for (; (j > 0) && (samples[j - 1] > sample); --j)
+                samples[j] = samples[j - 1];
+              samples[j] = sample;
             }
+            value = (n % 2) ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+          }
+          else
+          {
+            value = 0;
+            for (int i = 0; i < n; ++i)
+              value += samples[i];
+            value /= n;
+          }
+          row_out[x] = cv::saturate_cast<T>(value);
         }
       }
-      cv::Mat(Dw_sum / w_sum).copyTo(depth_out);
     }
+
+  private:
+    TemporalInvoker& operator=(const TemporalInvoker&);
+
+    const std::vector<cv::Mat> &frames_;
+    int frame_count_;
+    int current_;
+    bool median_;
+    cv::Mat_<T> &depth_out_;
   };
+
+  /** Filter the depth over time: every pixel gets the median or the mean of its depths in the last window_size
+   * frames given to the cleaner, which also fills the holes of the current frame. It is meant for static or slowly
+   * moving cameras. The frames are kept in a ring buffer that is reset when the size of the images changes.
+   */
+  template<typename T>
+  class Temporal: public DepthCleanerImpl
+  {
+  public:
+    Temporal(int window_size, int depth, cv::DepthCleaner::DEPTH_CLEANER_METHOD method)
+        :
+          DepthCleanerImpl(window_size, depth, method),
+          frame_count_(0),
+          next_(0)
+    {
+    }
+
+    /** Compute cached data
+     */
+    virtual void
+    cache()
+    {
+      frames_.assign(window_size_, cv::Mat());
+      frame_count_ = 0;
+      next_ = 0;
+    }
+
+    /** Add the depth to the ring buffer and compute its filtered version
+     * @param depth_in the new depth image, of the depth of the cleaner
+     * @param depth_out the filtered depth
+     */
+    virtual void
+    compute(const cv::Mat& depth_in, cv::Mat& depth_out) const
+    {
+      CV_Assert(depth_in.depth() == depth_);
+
+      if ((frame_count_ > 0) && (frames_[0].size() != depth_in.size()))
+      {
+        frame_count_ = 0;
+        next_ = 0;
+      }
+
+      const int current = next_;
+      depth_in.copyTo(frames_[current]);
+      next_ = (next_ + 1) % window_size_;
+      frame_count_ = std::min(frame_count_ + 1, window_size_);
+
+      cv::Mat_<T> dst(depth_out);
+      cv::parallel_for_(cv::Range(0, depth_in.rows),
+                        TemporalInvoker<T>(frames_, frame_count_, current,
+                                           method_ == cv::DepthCleaner::DEPTH_CLEANER_TEMPORAL_MEDIAN, dst));
+    }
+
+  private:
+    /** The ring buffer of the last frames */
+    mutable std::vector<cv::Mat> frames_;
+    mutable int frame_count_;
+    /** The index of the next frame to replace */
+    mutable int next_;
+  };
+
+  template<typename T>
+  DepthCleanerImpl *
+  createDepthCleanerImpl(int window_size, int depth, int method)
+  {
+    switch (method)
+    {
+      case cv::DepthCleaner::DEPTH_CLEANER_BILATERAL:
+        return new Bilateral<T>(window_size, depth, cv::DepthCleaner::DEPTH_CLEANER_BILATERAL);
+      case cv::DepthCleaner::DEPTH_CLEANER_TEMPORAL_MEDIAN:
+      case cv::DepthCleaner::DEPTH_CLEANER_TEMPORAL_MEAN:
+        return new Temporal<T>(window_size, depth, cv::DepthCleaner::DEPTH_CLEANER_METHOD(method));
+      default:
+        return new NIL<T>(window_size, depth, cv::DepthCleaner::DEPTH_CLEANER_NIL);
+    }
+  }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -217,27 +651,7 @@ namespace cv
    */
   DepthCleaner::~DepthCleaner()
   {
-    if (depth_cleaner_impl_ == 0)
-      return;
-    switch (method_)
-    {
-      case DEPTH_CLEANER_NIL:
-      {
-        switch (depth_)
-        {
-          case CV_16U:
-            delete reinterpret_cast<const NIL<unsigned short> *>(depth_cleaner_impl_);
-            break;
-          case CV_32F:
-            delete reinterpret_cast<const NIL<float> *>(depth_cleaner_impl_);
-            break;
-          case CV_64F:
-            delete reinterpret_cast<const NIL<double> *>(depth_cleaner_impl_);
-            break;
-        }
-        break;
-      }
-    }
+    delete reinterpret_cast<DepthCleanerImpl *>(depth_cleaner_impl_);
   }
 
   void
@@ -245,25 +659,20 @@ namespace cv
   {
     CV_Assert(depth_ == CV_16U || depth_ == CV_32F || depth_ == CV_64F);
     CV_Assert(window_size_ == 1 || window_size_ == 3 || window_size_ == 5 || window_size_ == 7);
-    CV_Assert( method_ == DEPTH_CLEANER_NIL);
-    switch (method_)
+    CV_Assert(
+        method_ == DEPTH_CLEANER_NIL || method_ == DEPTH_CLEANER_BILATERAL || method_ == DEPTH_CLEANER_TEMPORAL_MEDIAN
+        || method_ == DEPTH_CLEANER_TEMPORAL_MEAN);
+    switch (depth_)
     {
-      case (DEPTH_CLEANER_NIL):
-      {
-        switch (depth_)
-        {
-          case CV_16U:
-            depth_cleaner_impl_ = new NIL<unsigned short>(window_size_, depth_, DEPTH_CLEANER_NIL);
-            break;
-          case CV_32F:
-            depth_cleaner_impl_ = new NIL<float>(window_size_, depth_, DEPTH_CLEANER_NIL);
-            break;
-          case CV_64F:
-            depth_cleaner_impl_ = new NIL<double>(window_size_, depth_, DEPTH_CLEANER_NIL);
-            break;
-        }
+      case CV_16U:
+        depth_cleaner_impl_ = createDepthCleanerImpl<unsigned short>(window_size_, depth_, method_);
+        break;
+      case CV_32F:
+        depth_cleaner_impl_ = createDepthCleanerImpl<float>(window_size_, depth_, method_);
+        break;
+      case CV_64F:
+        depth_cleaner_impl_ = createDepthCleanerImpl<double>(window_size_, depth_, method_);
         break;
-      }
     }
 
     reinterpret_cast<DepthCleanerImpl *>(depth_cleaner_impl_)->cache();
@@ -278,7 +687,11 @@ namespace cv
     if (depth_cleaner_impl_ == 0)
       initialize_cleaner_impl();
     else if (!reinterpret_cast<DepthCleanerImpl *>(depth_cleaner_impl_)->validate(depth_, window_size_, method_))
+    {
+      delete reinterpret_cast<DepthCleanerImpl *>(depth_cleaner_impl_);
+      depth_cleaner_impl_ = 0;
       initialize_cleaner_impl();
+    }
   }
 
   /** Given a set of 3d points in a depth image, compute the normals at each point
@@ -303,24 +716,6 @@ namespace cv
     initialize();
 
     // Clean the depth
-    switch (method_)
-    {
-      case (DEPTH_CLEANER_NIL):
-      {
-        switch (depth_)
-        {
-          case CV_16U:
-            reinterpret_cast<const NIL<unsigned short> *>(depth_cleaner_impl_)->compute(depth_in, depth_out);
-            break;
-          case CV_32F:
-            reinterpret_cast<const NIL<float> *>(depth_cleaner_impl_)->compute(depth_in, depth_out);
-            break;
-          case CV_64F:
-            reinterpret_cast<const NIL<double> *>(depth_cleaner_impl_)->compute(depth_in, depth_out);
-            break;
-        }
-        break;
-      }
-    }
+    reinterpret_cast<const DepthCleanerImpl *>(depth_cleaner_impl_)->compute(depth_in, depth_out);
   }
 }
@@ -34,8 +34,13 @@
  */
 
 #include <opencv2/rgbd.hpp>
+#include <opencv2/core/utility.hpp>
 #include <limits>
 
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
 #include "depth_to_3d.h"
 #include "utils.h"
 
@@ -70,17 +75,23 @@ namespace
     float cx = K(0, 2);
     float cy = K(1, 2);
 
-    std::vector<cv::Mat> coordinates(3);
-
-    coordinates[0] = (u_mat - cx) / fx;
-
-    if (s != 0)
-      coordinates[0] = coordinates[0] + (-(s / fy) * v_mat + cy * s / fy) / fx;
-
-    coordinates[0] = coordinates[0].mul(z_mat);
-    coordinates[1] = (v_mat - cy).mul(z_mat) * (1. / fy);
-    coordinates[2] = z_mat;
-    cv::merge(coordinates, points3d);
+    // Write the interleaved coordinates directly instead of building and merging 3 temporary planes
+    points3d.create(z_mat.size(), CV_32FC3);
+    const int rows = z_mat.rows, cols = z_mat.cols;
+    for (int y = 0; y < rows; ++y)
+    {
+      const float *u = u_mat.ptr<float>(y), *v = v_mat.ptr<float>(y), *z = z_mat.ptr<float>(y);
+      cv::Vec3f *point = points3d.ptr<cv::Vec3f>(y);
+      for (int x = 0; x < cols; ++x)
+      {
+        float x_factor = (u[x] - cx) / fx;
+        if (s != 0)
+          x_factor = x_factor + (-(s / fy) * v[x] + cy * s / fy) / fx;
+        point[x][0] = x_factor * z[x];
+        point[x][1] = (v[x] - cy) * z[x] * float(1. / fy);
+        point[x][2] = z[x];
+      }
+    }
   }
 
   /**
@@ -124,26 +135,85 @@ namespace
     points3d = points3d.reshape(3, 1);
   }
 
+  /** Back-project the beginning of a row of a CV_16U depth image with SIMD. Only floats are vectorized
+   * @return the number of pixels processed
+   */
+  template<typename T>
+  int
+  depthTo3dRow16USIMD(const unsigned short *, const T *, T, int, int, T *, T *, T *)
+  {
+    return 0;
+  }
+
+#if CV_SSE2
+  int
+  depthTo3dRow16USIMD(const unsigned short *depth, const float *x_cache, float y_factor, int cols, int stride,
+                      float *xs, float *ys, float *zs)
+  {
+    if (!cv::checkHardwareSupport(CV_CPU_SSE2))
+      return 0;
+
+    const __m128 scale = _mm_set1_ps(0.001f), nan = _mm_set1_ps(std::numeric_limits<float>::quiet_NaN());
+    const __m128 v_y_factor = _mm_set1_ps(y_factor);
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 4 <= cols; x += 4)
+    {
+      const __m128i d = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(depth + x)), zero);
+      const __m128 invalid = _mm_castsi128_ps(_mm_cmpeq_epi32(d, zero));
+      __m128 z = _mm_mul_ps(_mm_cvtepi32_ps(d), scale);
+      z = _mm_or_ps(_mm_andnot_ps(invalid, z), _mm_and_ps(invalid, nan));
+      const __m128 px = _mm_mul_ps(_mm_loadu_ps(x_cache + x), z);
+      const __m128 py = _mm_mul_ps(v_y_factor, z);
+
+      if (stride == 1)
+      {
+        _mm_storeu_ps(xs + x, px);
+        _mm_storeu_ps(ys + x, py);
+        _mm_storeu_ps(zs + x, z);
+      }
+      else
+      {
+        // Interleave (x0 x1 x2 x3), (y0 y1 y2 y3), (z0 z1 z2 z3) into (x0 y0 z0 x1), (y1 z1 x2 y2), (z2 x3 y3 z3)
+        const __m128 xy01 = _mm_unpacklo_ps(px, py), xy23 = _mm_unpackhi_ps(px, py);
+        const __m128 z0x1 = _mm_shuffle_ps(z, xy01, _MM_SHUFFLE(2, 2, 0, 0));
+        const __m128 y1z1 = _mm_shuffle_ps(xy01, z, _MM_SHUFFLE(1, 1, 3, 3));
+        const __m128 z2x3 = _mm_shuffle_ps(z, xy23, _MM_SHUFFLE(2, 2, 2, 2));
+        const __m128 y3z3 = _mm_shuffle_ps(xy23, z, _MM_SHUFFLE(3, 3, 3, 3));
+        _mm_storeu_ps(xs + 3 * x, _mm_shuffle_ps(xy01, z0x1, _MM_SHUFFLE(2, 0, 1, 0)));
+        _mm_storeu_ps(xs + 3 * x + 4, _mm_shuffle_ps(y1z1, xy23, _MM_SHUFFLE(1, 0, 2, 0)));
+        _mm_storeu_ps(xs + 3 * x + 8, _mm_shuffle_ps(z2x3, y3z3, _MM_SHUFFLE(2, 0, 2, 0)));
+      }
+    }
+    return x;
+  }
+#endif
+
   /**
    * @param K
    * @param depth the depth image
-   * @param points3d the resulting 3d points
+   * @param points3d the resulting 3d points, if planes is 0
+   * @param planes the resulting x, y and z planes, or 0 to write points3d
    */
   template<typename T>
   void
-  depthTo3dNoMask(const cv::Mat& in_depth, const cv::Mat_<T>& K, cv::Mat& points3d)
+  depthTo3dNoMask(const cv::Mat& in_depth, const cv::Mat_<T>& K, cv::Mat& points3d, std::vector<cv::Mat>* planes)
   {
     const T inv_fx = T(1) / K(0, 0);
     const T inv_fy = T(1) / K(1, 1);
     const T ox = K(0, 2);
     const T oy = K(1, 2);
 
-    // Build z
+    // Build z. CV_16U depths are scaled in the loop directly, as rescaleDepth would do it
+    const bool from_16U = (in_depth.depth() == CV_16U);
     cv::Mat_<T> z_mat;
-    if (z_mat.depth() == in_depth.depth())
-      z_mat = in_depth;
-    else
-      rescaleDepthTemplated<T>(in_depth, z_mat);
+    if (!from_16U)
+    {
+      if (z_mat.depth() == in_depth.depth())
+        z_mat = in_depth;
+      else
+        rescaleDepthTemplated<T>(in_depth, z_mat);
+    }
 
     // Pre-compute some constants
     cv::Mat_<T> x_cache(1, in_depth.cols), y_cache(in_depth.rows, 1);
@@ -153,18 +223,48 @@ namespace
     for (int y = 0; y < in_depth.rows; ++y, ++y_cache_ptr)
       *y_cache_ptr = (y - oy) * inv_fy;
 
+    const T scale_16U = T(0.001);
+    const int stride = planes ? 1 : 3;
+    x_cache_ptr = x_cache[0];
     y_cache_ptr = y_cache[0];
     for (int y = 0; y < in_depth.rows; ++y, ++y_cache_ptr)
     {
-      cv::Vec<T, 3>* point = points3d.ptr<cv::Vec<T, 3> >(y);
-      const T* x_cache_ptr_end = x_cache[0] + in_depth.cols;
-      const T* depth = z_mat[y];
-      for (x_cache_ptr = x_cache[0]; x_cache_ptr != x_cache_ptr_end; ++x_cache_ptr, ++point, ++depth)
+      T *xs, *ys, *zs;
+      if (planes)
+      {
+        xs = (*planes)[0].ptr<T>(y);
+        ys = (*planes)[1].ptr<T>(y);
+        zs = (*planes)[2].ptr<T>(y);
+      }
+      else
       {
-        T z = *depth;
-        (*point)[0] = (*x_cache_ptr) * z;
-        (*point)[1] = (*y_cache_ptr) * z;
-        (*point)[2] = z;
+        xs = points3d.ptr<T>(y);
+        ys = xs + 1;
+        zs = xs + 2;
+      }
+
+      if (from_16U)
+      {
+        const unsigned short* depth = in_depth.ptr<unsigned short>(y);
+        int x = depthTo3dRow16USIMD(depth, x_cache_ptr, *y_cache_ptr, in_depth.cols, stride, xs, ys, zs);
+        for (; x < in_depth.cols; ++x)
+        {
+          T z = (depth[x] == 0) ? std::numeric_limits<T>::quiet_NaN() : T(depth[x]) * scale_16U;
+          xs[x * stride] = x_cache_ptr[x] * z;
+          ys[x * stride] = (*y_cache_ptr) * z;
+          zs[x * stride] = z;
+        }
+      }
+      else
+      {
+        const T* depth = z_mat[y];
+        for (int x = 0; x < in_depth.cols; ++x)
+        {
+          T z = depth[x];
+          xs[x * stride] = x_cache_ptr[x] * z;
+          ys[x * stride] = (*y_cache_ptr) * z;
+          zs[x * stride] = z;
+        }
       }
     }
   }
@@ -200,7 +300,7 @@ namespace cv
 
     if (depth.depth() == CV_16U)
       convertDepthToFloat<uint16_t>(depth, 1.0 / 1000.0f, points_float, z_mat);
-    else if (depth.depth() == CV_16U)
+    else if (depth.depth() == CV_16S)
       convertDepthToFloat<int16_t>(depth, 1.0 / 1000.0f, points_float, z_mat);
     else
     {
@@ -257,9 +357,45 @@ namespace cv
       points3d_out.create(depth.size(), CV_MAKETYPE(K_new.depth(), 3));
       cv::Mat points3d = points3d_out.getMat();
       if (K_new.depth() == CV_64F)
-        depthTo3dNoMask<double>(depth, K_new, points3d);
+        depthTo3dNoMask<double>(depth, K_new, points3d, 0);
       else
-        depthTo3dNoMask<float>(depth, K_new, points3d);
+        depthTo3dNoMask<float>(depth, K_new, points3d, 0);
+    }
+  }
+
+  /**
+   * @param depth the depth image, as in depthTo3d
+   * @param K The calibration matrix
+   * @param points3d the 3 planes x, y and z of the 3d points
+   */
+  void
+  depthTo3dPlanar(InputArray depth_in, InputArray K_in, OutputArrayOfArrays points3d_out)
+  {
+    cv::Mat depth = depth_in.getMat();
+    cv::Mat K = K_in.getMat();
+    CV_Assert(K.cols == 3 && K.rows == 3 && (K.depth() == CV_64F || K.depth()==CV_32F));
+    CV_Assert(
+        depth.type() == CV_64FC1 || depth.type() == CV_32FC1 || depth.type() == CV_16UC1 || depth.type() == CV_16SC1);
+
+    cv::Mat K_new;
+    if ((depth.depth() == CV_32F || depth.depth() == CV_64F) && depth.depth() != K.depth())
+      K.convertTo(K_new, depth.depth());
+    else
+      K_new = K;
+
+    // Create the planes the way cv::split does
+    points3d_out.create(3, 1, K_new.depth(), -1, true);
+    std::vector<cv::Mat> planes(3);
+    for (int i = 0; i < 3; ++i)
+    {
+      points3d_out.create(depth.size(), K_new.depth(), i);
+      planes[i] = points3d_out.getMat(i);
     }
+
+    cv::Mat points3d;
+    if (K_new.depth() == CV_64F)
+      depthTo3dNoMask<double>(depth, K_new, points3d, &planes);
+    else
+      depthTo3dNoMask<float>(depth, K_new, points3d, &planes);
   }
 }
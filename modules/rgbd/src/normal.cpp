@@ -34,10 +34,15 @@
  */
 
 #include <opencv2/calib3d.hpp>
+#include <opencv2/core/utility.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/imgproc/types_c.h>
 #include <opencv2/rgbd.hpp>
 
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace
 {
   /** Just compute the norm of a vector
@@ -78,6 +83,26 @@ namespace
     return r;
   }
 
+  /** Given 3d points as 3 planes x, y and z, compute their distance to the origin
+   * @param planes
+   * @return
+   */
+  template<typename T>
+  cv::Mat_<T>
+  computeRadiusPlanar(const std::vector<cv::Mat> &planes)
+  {
+    cv::Mat_<T> r(planes[0].size());
+    for (int y = 0; y < r.rows; ++y)
+    {
+      const T *xs = planes[0].ptr<T>(y), *ys = planes[1].ptr<T>(y), *zs = planes[2].ptr<T>(y);
+      T * row = r[y];
+      for (int x = 0; x < r.cols; ++x)
+        row[x] = std::sqrt(xs[x] * xs[x] + ys[x] * ys[x] + zs[x] * zs[x]);
+    }
+
+    return r;
+  }
+
   // Compute theta and phi according to equation 3 of
   // ``Fast and Accurate Computation of Surface Normals from Range Images``
   // by H. Badino, D. Huber, Y. Park and T. Kanade
@@ -169,13 +194,15 @@ namespace
   {
   public:
     RgbdNormalsImpl(int rows, int cols, int window_size, int depth, const cv::Mat &K,
-                    cv::RgbdNormals::RGBD_NORMALS_METHOD method)
+                    cv::RgbdNormals::RGBD_NORMALS_METHOD method,
+                    int fals_m_inv = cv::RgbdNormals::RGBD_NORMALS_FALS_M_INV_FULL)
         :
           rows_(rows),
           cols_(cols),
           depth_(depth),
           window_size_(window_size),
-          method_(method)
+          method_(method),
+          fals_m_inv_(fals_m_inv)
     {
       K.convertTo(K_, depth);
       K.copyTo(K_ori_);
@@ -190,23 +217,53 @@ namespace
     cache()=0;
 
     bool
-    validate(int rows, int cols, int depth, const cv::Mat &K_ori, int window_size, int method) const
+    validate(int rows, int cols, int depth, const cv::Mat &K_ori, int window_size, int method, int fals_m_inv) const
     {
       if ((K_ori.cols != K_ori_.cols) || (K_ori.rows != K_ori_.rows) || (K_ori.type() != K_ori_.type()))
         return false;
       bool K_test = !(cv::countNonZero(K_ori != K_ori_));
-      return (rows == rows_) && (cols = cols_) && (window_size == window_size_) && (depth == depth_) && (K_test)
-             && (method == method_);
+      return (rows == rows_) && (cols == cols_) && (window_size == window_size_) && (depth == depth_) && (K_test)
+             && (method == method_)
+             && ((method != cv::RgbdNormals::RGBD_NORMALS_METHOD_FALS) || (fals_m_inv == fals_m_inv_));
     }
   protected:
     int rows_, cols_, depth_;
     cv::Mat K_, K_ori_;
     int window_size_;
     cv::RgbdNormals::RGBD_NORMALS_METHOD method_;
+    int fals_m_inv_;
   };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+  /** Run the computeTiles function of a normals implementation on a range of tiles
+   */
+  template<typename Impl>
+  class TilesInvoker: public cv::ParallelLoopBody
+  {
+  public:
+    TilesInvoker(const Impl &impl, const cv::Mat &r, cv::Mat &normals)
+        :
+          impl_(impl),
+          r_(r),
+          normals_(normals)
+    {
+    }
+
+    virtual void
+    operator()(const cv::Range &tiles) const
+    {
+      impl_.computeTiles(tiles, r_, normals_);
+    }
+
+  private:
+    TilesInvoker& operator=(const TilesInvoker&);
+
+    const Impl &impl_;
+    const cv::Mat &r_;
+    cv::Mat &normals_;
+  };
+
   /** Given a set of 3d points in a depth image, compute the normals at each point
    * using the FALS method described in
    * ``Fast and Accurate Computation of Surface Normals from Range Images``
@@ -217,12 +274,19 @@ namespace
   {
   public:
     typedef cv::Matx<T, 3, 3> Mat33T;
-    typedef cv::Vec<T, 9> Vec9T;
+    typedef cv::Vec<T, 6> Vec6T;
     typedef cv::Vec<T, 3> Vec3T;
 
-    FALS(int rows, int cols, int window_size, int depth, const cv::Mat &K, cv::RgbdNormals::RGBD_NORMALS_METHOD method)
+    /** Number of rows processed at once: B, its box filter and the products of a tile stay in cache */
+    enum
+    {
+      TILE_ROWS = 16
+    };
+
+    FALS(int rows, int cols, int window_size, int depth, const cv::Mat &K, cv::RgbdNormals::RGBD_NORMALS_METHOD method,
+         int fals_m_inv)
         :
-          RgbdNormalsImpl(rows, cols, window_size, depth, K, method)
+          RgbdNormalsImpl(rows, cols, window_size, depth, K, method, fals_m_inv)
     {
     }
     ~FALS()
@@ -245,28 +309,31 @@ namespace
       channels[2] = cos_theta.mul(cos_phi);
       cv::merge(channels, V_);
 
-      // Compute M
-      cv::Mat_<Vec9T> M(rows_, cols_);
-      Mat33T VVt;
-      const Vec3T * vec = V_[0];
-      Vec9T * M_ptr = M[0], *M_ptr_end = M_ptr + rows_ * cols_;
-      for (; M_ptr != M_ptr_end; ++vec, ++M_ptr)
+      // M and its inverse are recomputed with B for every frame
+      if (fals_m_inv_ == cv::RgbdNormals::RGBD_NORMALS_FALS_M_INV_RECOMPUTE)
       {
-        VVt = (*vec) * vec->t();
-        *M_ptr = Vec9T(VVt.val);
+        M_inv_.release();
+        return;
       }
 
+      // Compute M: it is symmetric, only its 6 distinct values are kept
+      cv::Mat_<Vec6T> M(rows_, cols_);
+      const Vec3T * vec = V_[0];
+      Vec6T * M_ptr = M[0], *M_ptr_end = M_ptr + rows_ * cols_;
+      for (; M_ptr != M_ptr_end; ++vec, ++M_ptr)
+        *M_ptr = packSymmetric((*vec) * vec->t());
+
       cv::boxFilter(M, M, M.depth(), cv::Size(window_size_, window_size_), cv::Point(-1, -1), false);
 
       // Compute M's inverse
       Mat33T M_inv;
       M_inv_.create(rows_, cols_);
-      Vec9T * M_inv_ptr = M_inv_[0];
+      Vec6T * M_inv_ptr = M_inv_[0];
       for (M_ptr = &M(0); M_ptr != M_ptr_end; ++M_inv_ptr, ++M_ptr)
       {
         // We have a semi-definite matrix
-        cv::invert(Mat33T(M_ptr->val), M_inv, cv::DECOMP_CHOLESKY);
-        *M_inv_ptr = Vec9T(M_inv.val);
+        cv::invert(unpackSymmetric(*M_ptr), M_inv, cv::DECOMP_CHOLESKY);
+        *M_inv_ptr = packSymmetric(M_inv);
       }
     }
 
@@ -277,42 +344,152 @@ namespace
     virtual void
     compute(const cv::Mat&, const cv::Mat &r, cv::Mat & normals) const
     {
-      // Compute B
-      cv::Mat_<Vec3T> B(rows_, cols_);
+      const int tiles = (rows_ + TILE_ROWS - 1) / TILE_ROWS;
+      cv::parallel_for_(cv::Range(0, tiles), TilesInvoker<FALS<T> >(*this, r, normals));
+    }
 
-      const T* row_r = r.ptr < T > (0), *row_r_end = row_r + rows_ * cols_;
-      const Vec3T *row_V = V_[0];
-      Vec3T *row_B = B[0];
-      for (; row_r != row_r_end; ++row_r, ++row_B, ++row_V)
+    /** Compute the normals of some tiles of rows in a single pass: B is built for the rows of a tile and the
+     * rows its box filter needs, then filtered and multiplied by M_inv row by row while it is still in cache.
+     * When M_inv is not cached, the 6 distinct values of M are filtered along with B and M is inverted there.
+     * @param tiles the range of tiles of TILE_ROWS rows
+     * @param r the distance of the points to the origin
+     * @param normals the output normals
+     */
+    void
+    computeTiles(const cv::Range &tiles, const cv::Mat &r, cv::Mat &normals) const
+    {
+      const bool recompute = M_inv_.empty();
+      // The values filtered for every pixel: B, then M when it is recomputed
+      const int cn = recompute ? 9 : 3;
+      const int half = window_size_ / 2;
+      const int row_size = cols_ * cn;
+
+      // The unfiltered rows of a tile and of its borders, then the vertical sums of a row with its border
+      std::vector<T> band((TILE_ROWS + 2 * half) * row_size);
+      std::vector<T> column_sums((cols_ + 2 * half) * cn);
+      T * column_sum = &column_sums[half * cn];
+
+      for (int tile = tiles.start; tile < tiles.end; ++tile)
       {
-        if (cvIsNaN(*row_r))
-          *row_B = Vec3T();
-        else
-          *row_B = (*row_V) / (*row_r);
-      }
+        const int y_begin = tile * TILE_ROWS, y_end = std::min(y_begin + TILE_ROWS, rows_);
 
-      // Apply a box filter to B
-      cv::boxFilter(B, B, B.depth(), cv::Size(window_size_, window_size_), cv::Point(-1, -1), false);
+        // Compute B, with the border of cv::boxFilter
+        for (int y = y_begin - half; y < y_end + half; ++y)
+        {
+          const int y_src = cv::borderInterpolate(y, rows_, cv::BORDER_REFLECT_101);
+          const T * row_r = r.ptr<T>(y_src);
+          const Vec3T * row_V = V_[y_src];
+          T * row_band = &band[(y - y_begin + half) * row_size];
+          for (int x = 0; x < cols_; ++x, row_band += cn)
+          {
+            Vec3T B;
+            if (!cvIsNaN(row_r[x]))
+              B = row_V[x] / row_r[x];
+            row_band[0] = B[0];
+            row_band[1] = B[1];
+            row_band[2] = B[2];
+            if (recompute)
+            {
+              const Vec3T & v = row_V[x];
+              row_band[3] = v[0] * v[0];
+              row_band[4] = v[0] * v[1];
+              row_band[5] = v[0] * v[2];
+              row_band[6] = v[1] * v[1];
+              row_band[7] = v[1] * v[2];
+              row_band[8] = v[2] * v[2];
+            }
+          }
+        }
 
-      // compute the Minv*B products
-      row_r = r.ptr < T > (0);
-      const Vec3T * B_vec = B[0];
-      const Mat33T * M_inv = reinterpret_cast<const Mat33T *>(M_inv_.ptr(0));
-      Vec3T *normal = normals.ptr<Vec3T>(0);
-      for (; row_r != row_r_end; ++row_r, ++B_vec, ++normal, ++M_inv)
-        if (cvIsNaN(*row_r))
+        for (int y = y_begin; y < y_end; ++y)
         {
-          (*normal)[0] = *row_r;
-          (*normal)[1] = *row_r;
-          (*normal)[2] = *row_r;
+          // Sum the window vertically
+          const T * window_rows = &band[(y - y_begin) * row_size];
+          for (int i = 0; i < row_size; ++i)
+          {
+            T sum = window_rows[i];
+            for (int k = 1; k < window_size_; ++k)
+              sum += window_rows[k * row_size + i];
+            column_sum[i] = sum;
+          }
+          for (int x = 1; x <= half; ++x)
+          {
+            const int x_left = cv::borderInterpolate(-x, cols_, cv::BORDER_REFLECT_101);
+            const int x_right = cv::borderInterpolate(cols_ - 1 + x, cols_, cv::BORDER_REFLECT_101);
+            for (int c = 0; c < cn; ++c)
+            {
+              column_sum[-x * cn + c] = column_sum[x_left * cn + c];
+              column_sum[(cols_ - 1 + x) * cn + c] = column_sum[x_right * cn + c];
+            }
+          }
+
+          // Sum the window horizontally and compute the M_inv*B products
+          const T * row_r = r.ptr<T>(y);
+          const Vec6T * row_M_inv = recompute ? 0 : M_inv_[y];
+          Vec3T * normal = normals.ptr<Vec3T>(y);
+          for (int x = 0; x < cols_; ++x)
+          {
+            if (cvIsNaN(row_r[x]))
+            {
+              normal[x] = Vec3T(row_r[x], row_r[x], row_r[x]);
+              continue;
+            }
+
+            T sums[9];
+            const T * window = column_sum + (x - half) * cn;
+            for (int c = 0; c < cn; ++c)
+            {
+              T sum = window[c];
+              for (int k = 1; k < window_size_; ++k)
+                sum += window[k * cn + c];
+              sums[c] = sum;
+            }
+
+            if (recompute)
+              signNormal(solveUpToScale(sums + 3, sums), normal[x]);
+            else
+            {
+              const Vec6T & M_inv = row_M_inv[x];
+              signNormal(M_inv[0] * sums[0] + M_inv[1] * sums[1] + M_inv[2] * sums[2],
+                         M_inv[1] * sums[0] + M_inv[3] * sums[1] + M_inv[4] * sums[2],
+                         M_inv[2] * sums[0] + M_inv[4] * sums[1] + M_inv[5] * sums[2], normal[x]);
+            }
+          }
         }
-        else
-          signNormal((*M_inv) * (*B_vec), *normal);
+      }
     }
 
   private:
+    static Vec6T
+    packSymmetric(const Mat33T &m)
+    {
+      return Vec6T(m(0, 0), m(0, 1), m(0, 2), m(1, 1), m(1, 2), m(2, 2));
+    }
+
+    static Mat33T
+    unpackSymmetric(const Vec6T &m)
+    {
+      return Mat33T(m[0], m[1], m[2], m[1], m[3], m[4], m[2], m[4], m[5]);
+    }
+
+    /** Solve M x = B with the adjugate of M, without dividing by its determinant as the normals get normalized
+     * @param m the 6 distinct values of the symmetric M
+     * @param B
+     * @return x multiplied by the determinant of M
+     */
+    static Vec3T
+    solveUpToScale(const T *m, const T *B)
+    {
+      const double a = m[0], b = m[1], c = m[2], d = m[3], e = m[4], f = m[5];
+      const double adj00 = d * f - e * e, adj01 = c * e - b * f, adj02 = b * e - c * d;
+      const double adj11 = a * f - c * c, adj12 = b * c - a * e, adj22 = a * d - b * b;
+      return Vec3T(T(adj00 * B[0] + adj01 * B[1] + adj02 * B[2]), T(adj01 * B[0] + adj11 * B[1] + adj12 * B[2]),
+                   T(adj02 * B[0] + adj12 * B[1] + adj22 * B[2]));
+    }
+
     cv::Mat_<Vec3T> V_;
-    cv::Mat_<Vec9T> M_inv_;
+    /** The 6 distinct values of M_inv, empty if it is recomputed */
+    cv::Mat_<Vec6T> M_inv_;
   };
 }
 
@@ -337,6 +514,225 @@ multiply_by_K_inv(const cv::Matx<T, 3, 3> & K_inv, U a, U b, U c, cv::Vec<T, 3>
 
 namespace
 {
+  /** The types used by LINEMOD for a given depth type: the accumulators only sum small integers, or small integers
+   * times depth differences, so they can be as narrow as the depth. Integer depths need a wider type once the
+   * gradients get multiplied by the depth.
+   */
+  template<typename DepthDepth>
+  struct LinemodTypes
+  {
+    typedef DepthDepth Accumulator;
+    typedef DepthDepth Wide;
+  };
+
+  template<>
+  struct LinemodTypes<unsigned short>
+  {
+    typedef int Accumulator;
+    typedef cv::int64 Wide;
+  };
+
+#if CV_SSE2
+  /** Load 4 depths as floats. This is exact for CV_16U and CV_32F, so the vectorized accumulation gives the same
+   * results as the scalar one
+   */
+  inline __m128
+  linemodLoad4(const float *depth)
+  {
+    return _mm_loadu_ps(depth);
+  }
+
+  inline __m128
+  linemodLoad4(const unsigned short *depth)
+  {
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(depth)),
+                                              _mm_setzero_si128()));
+  }
+
+  /** CV_64F depths would lose precision in floats: they always go through the scalar loop
+   */
+  inline __m128
+  linemodLoad4(const double *)
+  {
+    return _mm_setzero_ps();
+  }
+
+  template<typename DepthDepth>
+  inline bool
+  linemodCanVectorize()
+  {
+    return true;
+  }
+
+  template<>
+  inline bool
+  linemodCanVectorize<double>()
+  {
+    return false;
+  }
+#endif
+
+  /** Compute the LINEMOD normals of a range of rows
+   */
+  template<typename T, typename DepthDepth>
+  class LinemodInvoker: public cv::ParallelLoopBody
+  {
+  public:
+    typedef cv::Vec<T, 3> Vec3T;
+    typedef cv::Matx<T, 3, 3> Mat33T;
+    typedef typename LinemodTypes<DepthDepth>::Accumulator Accumulator;
+    typedef typename LinemodTypes<DepthDepth>::Wide Wide;
+
+    enum
+    {
+      R = 5, // used to be 7
+      SAMPLE_STEP = R,
+      SQUARE_SIZE = (2 * R / SAMPLE_STEP) + 1,
+      TAPS = SQUARE_SIZE * SQUARE_SIZE
+    };
+
+    LinemodInvoker(const cv::Mat_<DepthDepth> &depth, const Mat33T &K_inv, cv::Mat &normals)
+        :
+          depth_(depth),
+          K_inv_(K_inv),
+          normals_(normals)
+    {
+      for (int j = -R, index = 0; j <= R; j += SAMPLE_STEP)
+        for (int i = -R; i <= R; i += SAMPLE_STEP, ++index)
+        {
+          offsets_x_[index] = i;
+          offsets_y_[index] = j;
+          offsets_x_x_[index] = i * i;
+          offsets_x_y_[index] = i * j;
+          offsets_y_y_[index] = j * j;
+          offsets_[index] = j * static_cast<int>(depth.step1()) + i;
+        }
+#if CV_SSE2
+      haveSSE2_ = cv::checkHardwareSupport(CV_CPU_SSE2) && linemodCanVectorize<DepthDepth>();
+#endif
+    }
+
+    virtual void
+    operator()(const cv::Range &range) const
+    {
+      const Accumulator difference_threshold = 50;
+      const int x_end = depth_.cols - R - 1;
+
+      for (int y = range.start; y < range.end; ++y)
+      {
+        const DepthDepth * p_line = depth_[y];
+        Vec3T *normal = normals_.ptr<Vec3T>(y);
+        int x = R;
+
+#if CV_SSE2
+        if (haveSSE2_)
+        {
+          // Same accumulation as below for 4 pixels at once: the taps over the threshold add zeros instead of
+          // being skipped, and the comparison is negated so that NaN depths are kept as in the scalar loop
+          const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+          const __m128 threshold = _mm_set1_ps(static_cast<float>(difference_threshold));
+          for (; x + 4 <= x_end; x += 4)
+          {
+            const __m128 d = linemodLoad4(p_line + x);
+            __m128 A0 = _mm_setzero_ps(), A1 = _mm_setzero_ps(), A3 = _mm_setzero_ps();
+            __m128 b0 = _mm_setzero_ps(), b1 = _mm_setzero_ps();
+            for (int i = 0; i < TAPS; ++i)
+            {
+              __m128 delta = _mm_sub_ps(linemodLoad4(p_line + x + offsets_[i]), d);
+              const __m128 mask = _mm_cmpngt_ps(_mm_and_ps(delta, abs_mask), threshold);
+              delta = _mm_and_ps(delta, mask);
+
+              A0 = _mm_add_ps(A0, _mm_and_ps(mask, _mm_set1_ps(static_cast<float>(offsets_x_x_[i]))));
+              A1 = _mm_add_ps(A1, _mm_and_ps(mask, _mm_set1_ps(static_cast<float>(offsets_x_y_[i]))));
+              A3 = _mm_add_ps(A3, _mm_and_ps(mask, _mm_set1_ps(static_cast<float>(offsets_y_y_[i]))));
+              b0 = _mm_add_ps(b0, _mm_mul_ps(_mm_set1_ps(static_cast<float>(offsets_x_[i])), delta));
+              b1 = _mm_add_ps(b1, _mm_mul_ps(_mm_set1_ps(static_cast<float>(offsets_y_[i])), delta));
+            }
+
+            float buf[5][4];
+            _mm_storeu_ps(buf[0], A0);
+            _mm_storeu_ps(buf[1], A1);
+            _mm_storeu_ps(buf[2], A3);
+            _mm_storeu_ps(buf[3], b0);
+            _mm_storeu_ps(buf[4], b1);
+            for (int k = 0; k < 4; ++k)
+            {
+              Accumulator A[4], b[2];
+              A[0] = static_cast<Accumulator>(buf[0][k]);
+              A[1] = static_cast<Accumulator>(buf[1][k]);
+              A[3] = static_cast<Accumulator>(buf[2][k]);
+              b[0] = static_cast<Accumulator>(buf[3][k]);
+              b[1] = static_cast<Accumulator>(buf[4][k]);
+              computeNormal(p_line[x + k], A, b, x + k, y, normal[x + k]);
+            }
+          }
+        }
+#endif
+
+        for (; x < x_end; ++x)
+        {
+          DepthDepth d = p_line[x];
+
+          // accum
+          Accumulator A[4];
+          A[0] = A[1] = A[2] = A[3] = 0;
+          Accumulator b[2];
+          b[0] = b[1] = 0;
+          for (int i = 0; i < TAPS; ++i) {
+            // We need to cast to Accumulator in case we have unsigned DepthDepth
+            Accumulator delta = Accumulator(p_line[x + offsets_[i]]) - Accumulator(d);
+            if (std::abs(delta) > difference_threshold)
+               continue;
+
+             A[0] += offsets_x_x_[i];
+             A[1] += offsets_x_y_[i];
+             A[3] += offsets_y_y_[i];
+             b[0] += offsets_x_[i] * delta;
+             b[1] += offsets_y_[i] * delta;
+          }
+
+          computeNormal(d, A, b, x, y, normal[x]);
+        }
+      }
+    }
+
+  private:
+    inline void
+    computeNormal(DepthDepth d, const Accumulator *A, const Accumulator *b, int x, int y, Vec3T &normal) const
+    {
+      // solve for the optimal gradient D of equation (8)
+      Wide det = Wide(A[0]) * A[3] - Wide(A[1]) * A[1];
+      // We should divide the following two by det, but instead, we multiply
+      // X1_minus_X and X2_minus_X by det (which does not matter as we normalize the normals)
+      // Therefore, no division is done: this is only for speedup
+      Wide dx = (Wide(A[3]) * b[0] - Wide(A[1]) * b[1]);
+      Wide dy = (-Wide(A[1]) * b[0] + Wide(A[0]) * b[1]);
+
+      // Compute the dot product
+      //Vec3T X = K_inv * Vec3T(x, y, 1) * depth(y, x);
+      //Vec3T X1 = K_inv * Vec3T(x + 1, y, 1) * (depth(y, x) + dx);
+      //Vec3T X2 = K_inv * Vec3T(x, y + 1, 1) * (depth(y, x) + dy);
+      //Vec3T nor = (X1 - X).cross(X2 - X);
+      Vec3T X1_minus_X, X2_minus_X;
+      multiply_by_K_inv(K_inv_, Wide(d) * det + Wide(x + 1) * dx, Wide(y) * dx, dx, X1_minus_X);
+      multiply_by_K_inv(K_inv_, Wide(x) * dy, Wide(d) * det + Wide(y + 1) * dy, dy, X2_minus_X);
+      Vec3T nor = X1_minus_X.cross(X2_minus_X);
+      signNormal(nor, normal);
+    }
+
+    LinemodInvoker& operator=(const LinemodInvoker&);
+
+    const cv::Mat_<DepthDepth> &depth_;
+    Mat33T K_inv_;
+    cv::Mat &normals_;
+    int offsets_[TAPS];
+    Accumulator offsets_x_[TAPS], offsets_y_[TAPS];
+    Accumulator offsets_x_x_[TAPS], offsets_x_y_[TAPS], offsets_y_y_[TAPS];
+#if CV_SSE2
+    bool haveSSE2_;
+#endif
+  };
+
   /** Given a depth image, compute the normals as detailed in the LINEMOD paper
    * ``Gradient Response Maps for Real-Time Detection of Texture-Less Objects``
    * by S. Hinterstoisser, C. Cagniart, S. Ilic, P. Sturm, N. Navab, P. Fua, and V. Lepetit
@@ -374,52 +770,34 @@ namespace
         case CV_16U:
         {
           const cv::Mat_<unsigned short> &depth(depth_in);
-          computeImpl<unsigned short, long>(depth, normals);
+          computeImpl<unsigned short>(depth, normals);
           break;
         }
         case CV_32F:
         {
           const cv::Mat_<float> &depth(depth_in);
-          computeImpl<float, float>(depth, normals);
+          computeImpl<float>(depth, normals);
           break;
         }
         case CV_64F:
         {
           const cv::Mat_<double> &depth(depth_in);
-          computeImpl<double, double>(depth, normals);
+          computeImpl<double>(depth, normals);
           break;
         }
       }
     }
 
   private:
-    /** Compute the normals
+    /** Compute the normals, in parallel over the rows
      * @param r
      * @return
      */
-    template<typename DepthDepth, typename ContainerDepth>
+    template<typename DepthDepth>
     cv::Mat
     computeImpl(const cv::Mat_<DepthDepth> &depth, cv::Mat & normals) const
     {
-      const int r = 5; // used to be 7
-      const int sample_step = r;
-      const int square_size = ((2 * r / sample_step) + 1);
-      long offsets[square_size * square_size];
-      long offsets_x[square_size * square_size];
-      long offsets_y[square_size * square_size];
-      long offsets_x_x[square_size * square_size];
-      long offsets_x_y[square_size * square_size];
-      long offsets_y_y[square_size * square_size];
-      for (int j = -r, index = 0; j <= r; j += sample_step)
-        for (int i = -r; i <= r; i += sample_step, ++index)
-        {
-          offsets_x[index] = i;
-          offsets_y[index] = j;
-          offsets_x_x[index] = i*i;
-          offsets_x_y[index] = i*j;
-          offsets_y_y[index] = j*j;
-          offsets[index] = j * cols_ + i;
-        }
+      typedef LinemodInvoker<T, DepthDepth> Invoker;
 
       // Define K_inv by hand, just for higher accuracy
       Mat33T K_inv = cv::Matx<T, 3, 3>::eye(), K;
@@ -430,58 +808,9 @@ namespace
       K_inv(1, 1) = 1 / K(1, 1);
       K_inv(1, 2) = -K(1, 2) / K(1, 1);
 
-      Vec3T X1_minus_X, X2_minus_X;
-
-      ContainerDepth difference_threshold = 50;
-      for (int y = r; y < rows_ - r - 1; ++y)
-      {
-        const DepthDepth * p_line = reinterpret_cast<const DepthDepth*>(depth.ptr(y, r));
-        Vec3T *normal = normals.ptr<Vec3T>(y, r);
-
-        for (int x = r; x < cols_ - r - 1; ++x)
-        {
-          DepthDepth d = p_line[0];
-
-          // accum
-          long A[4];
-          A[0] = A[1] = A[2] = A[3] = 0;
-          ContainerDepth b[2];
-          b[0] = b[1] = 0;
-          for (unsigned int i = 0; i < square_size * square_size; ++i) {
-            // We need to cast to ContainerDepth in case we have unsigned DepthDepth
-            ContainerDepth delta = ContainerDepth(p_line[offsets[i]]) - ContainerDepth(d);
-            if (std::abs(delta) > difference_threshold)
-               continue;
-
-             A[0] += offsets_x_x[i];
-             A[1] += offsets_x_y[i];
-             A[3] += offsets_y_y[i];
-             b[0] += offsets_x[i] * delta;
-             b[1] += offsets_y[i] * delta;
-          }
-
-          // solve for the optimal gradient D of equation (8)
-          long det = A[0] * A[3] - A[1] * A[1];
-          // We should divide the following two by det, but instead, we multiply
-          // X1_minus_X and X2_minus_X by det (which does not matter as we normalize the normals)
-          // Therefore, no division is done: this is only for speedup
-          ContainerDepth dx = (A[3] * b[0] - A[1] * b[1]);
-          ContainerDepth dy = (-A[1] * b[0] + A[0] * b[1]);
-
-          // Compute the dot product
-          //Vec3T X = K_inv * Vec3T(x, y, 1) * depth(y, x);
-          //Vec3T X1 = K_inv * Vec3T(x + 1, y, 1) * (depth(y, x) + dx);
-          //Vec3T X2 = K_inv * Vec3T(x, y + 1, 1) * (depth(y, x) + dy);
-          //Vec3T nor = (X1 - X).cross(X2 - X);
-          multiply_by_K_inv(K_inv, d * det + (x + 1) * dx, y * dx, dx, X1_minus_X);
-          multiply_by_K_inv(K_inv, x * dy, d * det + (y + 1) * dy, dy, X2_minus_X);
-          Vec3T nor = X1_minus_X.cross(X2_minus_X);
-          signNormal(nor, *normal);
-
-          ++p_line;
-          ++normal;
-        }
-      }
+      const int y_end = rows_ - Invoker::R - 1;
+      if (y_end > Invoker::R)
+        cv::parallel_for_(cv::Range(Invoker::R, y_end), Invoker(depth, K_inv, normals));
 
       return normals;
     }
@@ -502,10 +831,14 @@ namespace
   class SRI: public RgbdNormalsImpl
   {
   public:
-    typedef cv::Matx<T, 3, 3> Mat33T;
-    typedef cv::Vec<T, 9> Vec9T;
     typedef cv::Vec<T, 3> Vec3T;
 
+    /** Number of output rows processed at once, with the band of the spherical range image they need */
+    enum
+    {
+      TILE_ROWS = 32
+    };
+
     SRI(int rows, int cols, int window_size, int depth, const cv::Mat &K, cv::RgbdNormals::RGBD_NORMALS_METHOD method)
         :
           RgbdNormalsImpl(rows, cols, window_size, depth, K, method),
@@ -531,7 +864,6 @@ namespace
       float min_phi = std::asin(sin_phi(0, cols_/2-1)), max_phi = std::asin(sin_phi(rows_ - 1, cols_/2-1));
 
       std::vector<cv::Point3f> points3d(cols_ * rows_);
-      R_hat_.create(rows_, cols_);
       phi_step_ = float(max_phi - min_phi) / (rows_ - 1);
       theta_step_ = float(max_theta - min_theta) / (cols_ - 1);
       for (int phi_int = 0, k = 0; phi_int < rows_; ++phi_int)
@@ -542,23 +874,31 @@ namespace
           float theta = min_theta + theta_int * theta_step_;
           // Store the 3d point to project it later
           points3d[k] = cv::Point3f(std::sin(theta) * std::cos(phi), std::sin(phi), std::cos(theta) * std::cos(phi));
-
-          // Cache the rotation matrix and negate it
-          cv::Mat_<T> mat =
-              (cv::Mat_ < T > (3, 3) << 0, 1, 0, 0, 0, 1, 1, 0, 0) * ((cv::Mat_ < T > (3, 3) << std::cos(theta), -std::sin(
-                  theta), 0, std::sin(theta), std::cos(theta), 0, 0, 0, 1))
-              * ((cv::Mat_ < T > (3, 3) << std::cos(phi), 0, -std::sin(phi), 0, 1, 0, std::sin(phi), 0, std::cos(phi)));
-          for (unsigned char i = 0; i < 3; ++i)
-            mat(i, 1) = mat(i, 1) / std::cos(phi);
-          // The second part of the matrix is never explained in the paper ... but look at the wikipedia normal article
-          mat(0, 0) = mat(0, 0) - 2 * std::cos(phi) * std::sin(theta);
-          mat(1, 0) = mat(1, 0) - 2 * std::sin(phi);
-          mat(2, 0) = mat(2, 0) - 2 * std::cos(phi) * std::cos(theta);
-
-          R_hat_(phi_int, theta_int) = Vec9T((T*) (mat.data));
         }
       }
 
+      // The rotation matrix R_hat of a pixel of the SRI only depends on its theta and phi:
+      //       | -sin(theta)cos(phi)   cos(theta)/cos(phi)  -sin(theta)sin(phi) |
+      // R  =  | -sin(phi)             0                     cos(phi)           |
+      //       | -cos(theta)cos(phi)  -sin(theta)/cos(phi)  -cos(theta)sin(phi) |
+      // so only the sines and cosines of the columns and of the rows are kept
+      sri_cos_theta_.create(1, cols_);
+      sri_sin_theta_.create(1, cols_);
+      for (int theta_int = 0; theta_int < cols_; ++theta_int)
+      {
+        float theta = min_theta + theta_int * theta_step_;
+        sri_cos_theta_(0, theta_int) = std::cos(theta);
+        sri_sin_theta_(0, theta_int) = std::sin(theta);
+      }
+      sri_cos_phi_.create(rows_, 1);
+      sri_sin_phi_.create(rows_, 1);
+      for (int phi_int = 0; phi_int < rows_; ++phi_int)
+      {
+        float phi = min_phi + phi_int * phi_step_;
+        sri_cos_phi_(phi_int, 0) = std::cos(phi);
+        sri_sin_phi_(phi_int, 0) = std::sin(phi);
+      }
+
       map_.create(rows_, cols_);
       cv::projectPoints(points3d, cv::Mat(3,1,CV_32FC1,cv::Scalar::all(0.0f)), cv::Mat(3,1,CV_32FC1,cv::Scalar::all(0.0f)), K_, cv::Mat(), map_);
       map_ = map_.reshape(2, rows_);
@@ -583,6 +923,35 @@ namespace
       //convert map to 2 maps in short format for increasing speed in remap function
       cv::convertMaps(euclideanMap_, cv::Mat(), invxy_, invfxy_, CV_16SC2);
 
+      // Find the rows of the SRI every tile of output rows samples, and make the rows of the maps relative to them
+      const int tiles = (rows_ + TILE_ROWS - 1) / TILE_ROWS;
+      tile_sri_rows_.resize(tiles);
+      invxy_.copyTo(tile_invxy_);
+      for (int tile = 0; tile < tiles; ++tile)
+      {
+        const int y_begin = tile * TILE_ROWS, y_end = std::min(y_begin + TILE_ROWS, rows_);
+        int sri_begin = rows_ - 1, sri_end = 0;
+        for (int y = y_begin; y < y_end; ++y)
+        {
+          const cv::Vec2s * xy = invxy_.ptr<cv::Vec2s>(y);
+          for (int x = 0; x < cols_; ++x)
+          {
+            // The bilinear interpolation reads the row of the map and the next one
+            sri_begin = std::min(sri_begin, std::max(int(xy[x][1]), 0));
+            sri_end = std::max(sri_end, std::min(int(xy[x][1]) + 2, rows_));
+          }
+        }
+        sri_end = std::max(sri_end, sri_begin + 1);
+        tile_sri_rows_[tile] = cv::Range(sri_begin, sri_end);
+
+        for (int y = y_begin; y < y_end; ++y)
+        {
+          cv::Vec2s * xy = tile_invxy_.ptr<cv::Vec2s>(y);
+          for (int x = 0; x < cols_; ++x)
+            xy[x][1] = cv::saturate_cast<short>(xy[x][1] - sri_begin);
+        }
+      }
+
       // Update the kernels: the steps are due to the fact that derivatives will be computed on a grid where
       // the step is not 1. Only need to do it on one dimension as it computes derivatives in only one direction
       kx_dx_ /= theta_step_;
@@ -594,69 +963,83 @@ namespace
      * @return
      */
     virtual void
-    compute(const cv::Mat& points3d, const cv::Mat &r, cv::Mat & normals) const
+    compute(const cv::Mat&, const cv::Mat &r, cv::Mat & normals) const
     {
-      const cv::Mat_<T>& r_T(r);
-      const cv::Mat_<Vec3T> &points3d_T(points3d);
-      compute(points3d_T, r_T, normals);
+      cv::parallel_for_(cv::Range(0, int(tile_sri_rows_.size())), TilesInvoker<SRI<T> >(*this, r, normals));
     }
 
-    /** Compute the normals
-     * @param r
-     * @return
+    /** Compute the normals of some tiles of output rows. For every tile, only the band of the SRI its rows sample
+     * is interpolated, derived and turned into normals, with the rows the derivative kernels need around it, and
+     * it is remapped to the output while it is still in cache
+     * @param tiles the range of tiles of TILE_ROWS rows
+     * @param r_non_interp the distance of the points to the origin
+     * @param normals_out the output normals
      */
     void
-    compute(const cv::Mat_<Vec3T> &, const cv::Mat_<T> &r_non_interp, cv::Mat & normals_out) const
-    {
-      // Interpolate the radial image to make derivatives meaningful
-      cv::Mat_<T> r;
-      // higher quality remapping does not help here
-      cv::remap(r_non_interp, r, xy_, fxy_, CV_INTER_LINEAR);
-
-      // Compute the derivatives with respect to theta and phi
-      // TODO add bilateral filtering (as done in kinfu)
-      cv::Mat_<T> r_theta, r_phi;
-      cv::sepFilter2D(r, r_theta, r.depth(), kx_dx_, ky_dx_);
-      //current OpenCV version sometimes corrupts r matrix after second call of sepFilter2D
-      //it depends on resolution, be careful
-      cv::sepFilter2D(r, r_phi, r.depth(), kx_dy_, ky_dy_);
-
-      // Fill the result matrix
-      cv::Mat_<Vec3T> normals(rows_, cols_);
-
-      const T* r_theta_ptr = r_theta[0], *r_theta_ptr_end = r_theta_ptr + rows_ * cols_;
-      const T* r_phi_ptr = r_phi[0];
-      const Mat33T * R = reinterpret_cast<const Mat33T *>(R_hat_[0]);
-      const T* r_ptr = r[0];
-      Vec3T * normal = normals[0];
-      for (; r_theta_ptr != r_theta_ptr_end; ++r_theta_ptr, ++r_phi_ptr, ++R, ++r_ptr, ++normal)
+    computeTiles(const cv::Range &tiles, const cv::Mat &r_non_interp, cv::Mat &normals_out) const
+    {
+      const int half = window_size_ / 2;
+      cv::Mat_<T> r_band, r_theta, r_phi;
+      cv::Mat_<Vec3T> normals;
+      for (int tile = tiles.start; tile < tiles.end; ++tile)
       {
-        if (cvIsNaN(*r_ptr))
+        const cv::Range & sri_rows = tile_sri_rows_[tile];
+        const int y_begin = tile * TILE_ROWS, y_end = std::min(y_begin + TILE_ROWS, rows_);
+
+        // Interpolate the radial image to make derivatives meaningful, with the rows the filters need around the
+        // band: they read them as the rows of a bigger image, and only reflect at the real borders of the SRI
+        // higher quality remapping does not help here
+        const int band_begin = std::max(sri_rows.start - half, 0), band_end = std::min(sri_rows.end + half, rows_);
+        cv::remap(r_non_interp, r_band, xy_.rowRange(band_begin, band_end), fxy_.rowRange(band_begin, band_end),
+                  CV_INTER_LINEAR);
+        const cv::Mat_<T> r = r_band.rowRange(sri_rows.start - band_begin, sri_rows.end - band_begin);
+
+        // Compute the derivatives with respect to theta and phi
+        // TODO add bilateral filtering (as done in kinfu)
+        cv::sepFilter2D(r, r_theta, r.depth(), kx_dx_, ky_dx_);
+        cv::sepFilter2D(r, r_phi, r.depth(), kx_dy_, ky_dy_);
+
+        // Fill the normals of the band
+        normals.create(r.rows, cols_);
+        const T * cos_theta = sri_cos_theta_[0], *sin_theta = sri_sin_theta_[0];
+        for (int y = 0; y < r.rows; ++y)
         {
-          (*normal)[0] = *r_ptr;
-          (*normal)[1] = *r_ptr;
-          (*normal)[2] = *r_ptr;
+          const T cos_phi = sri_cos_phi_(sri_rows.start + y, 0), sin_phi = sri_sin_phi_(sri_rows.start + y, 0);
+          const T inv_cos_phi = 1 / cos_phi;
+          const T * r_ptr = r[y], *r_theta_ptr = r_theta[y], *r_phi_ptr = r_phi[y];
+          Vec3T * normal = normals[y];
+          for (int x = 0; x < cols_; ++x)
+          {
+            if (cvIsNaN(r_ptr[x]))
+            {
+              normal[x] = Vec3T(r_ptr[x], r_ptr[x], r_ptr[x]);
+              continue;
+            }
+            const T r_theta_over_r = r_theta_ptr[x] / r_ptr[x];
+            const T r_phi_over_r = r_phi_ptr[x] / r_ptr[x];
+            signNormal(-sin_theta[x] * cos_phi + cos_theta[x] * inv_cos_phi * r_theta_over_r
+                       - sin_theta[x] * sin_phi * r_phi_over_r,
+                       -sin_phi + cos_phi * r_phi_over_r,
+                       -cos_theta[x] * cos_phi - sin_theta[x] * inv_cos_phi * r_theta_over_r
+                       - cos_theta[x] * sin_phi * r_phi_over_r, normal[x]);
+          }
         }
-        else
+
+        // Go back to the image, the maps of the tile being relative to its band
+        cv::Mat normals_tile = normals_out.rowRange(y_begin, y_end);
+        cv::remap(normals, normals_tile, tile_invxy_.rowRange(y_begin, y_end), invfxy_.rowRange(y_begin, y_end),
+                  cv::INTER_LINEAR);
+        for (int y = y_begin; y < y_end; ++y)
         {
-          T r_theta_over_r = (*r_theta_ptr) / (*r_ptr);
-          T r_phi_over_r = (*r_phi_ptr) / (*r_ptr);
-          // R(1,1) is 0
-          signNormal((*R)(0, 0) + (*R)(0, 1) * r_theta_over_r + (*R)(0, 2) * r_phi_over_r,
-                     (*R)(1, 0) + (*R)(1, 2) * r_phi_over_r,
-                     (*R)(2, 0) + (*R)(2, 1) * r_theta_over_r + (*R)(2, 2) * r_phi_over_r, *normal);
+          Vec3T * normal = normals_out.ptr<Vec3T>(y), *normal_end = normal + cols_;
+          for (; normal != normal_end; ++normal)
+            signNormal((*normal)[0], (*normal)[1], (*normal)[2], *normal);
         }
       }
-
-      cv::remap(normals, normals_out, invxy_, invfxy_, cv::INTER_LINEAR);
-      normal = normals_out.ptr<Vec3T>(0);
-      Vec3T * normal_end = normal + rows_ * cols_;
-      for (; normal != normal_end; ++normal)
-        signNormal((*normal)[0], (*normal)[1], (*normal)[2], *normal);
     }
   private:
-    /** Stores R */
-    cv::Mat_<Vec9T> R_hat_;
+    /** The sines and cosines of theta for every column of the SRI, and of phi for every row */
+    cv::Mat_<T> sri_cos_theta_, sri_sin_theta_, sri_cos_phi_, sri_sin_phi_;
     float phi_step_, theta_step_;
 
     /** Derivative kernels */
@@ -667,11 +1050,59 @@ namespace
 
     cv::Mat_<cv::Vec2f> euclideanMap_;
     cv::Mat invxy_, invfxy_;
+    /** The rows of the SRI sampled by every tile of output rows */
+    std::vector<cv::Range> tile_sri_rows_;
+    /** invxy_ with rows relative to the first SRI row of the tile of every output row */
+    cv::Mat tile_invxy_;
   };
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+namespace
+{
+  /** An implementation and the number of RgbdNormals using it
+   */
+  struct SharedNormalsImpl
+  {
+    RgbdNormalsImpl *impl;
+    int refcount;
+  };
+
+  /** The implementations used in the process. Their precomputed data does not change once cached and their compute
+   * functions are const, so all the RgbdNormals with the same rows, cols, depth, K, window size and method (e.g.
+   * the odometries of several identical cameras) share the same one
+   */
+  std::vector<SharedNormalsImpl> shared_normals_impls;
+  cv::Mutex shared_normals_mutex;
+
+  /** Give back an implementation obtained from RgbdNormals::initialize_normals_impl: the last RgbdNormals using it
+   * deletes it
+   * @param rgbd_normals_impl
+   */
+  void
+  releaseNormalsImpl(void *rgbd_normals_impl)
+  {
+    if (rgbd_normals_impl == 0)
+      return;
+
+    cv::AutoLock lock(shared_normals_mutex);
+    for (size_t i = 0; i < shared_normals_impls.size(); ++i)
+    {
+      if (shared_normals_impls[i].impl != reinterpret_cast<RgbdNormalsImpl *>(rgbd_normals_impl))
+        continue;
+      if (--shared_normals_impls[i].refcount == 0)
+      {
+        delete shared_normals_impls[i].impl;
+        shared_normals_impls.erase(shared_normals_impls.begin() + i);
+      }
+      return;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 namespace cv
 {
   /** Default constructor of the Algorithm class that computes normals
@@ -684,57 +1115,23 @@ namespace cv
         K_(K_in.getMat()),
         window_size_(window_size),
         method_(method_in),
+        fals_m_inv_(RGBD_NORMALS_FALS_M_INV_FULL),
         rgbd_normals_impl_(0)
   {
     CV_Assert(depth == CV_32F || depth == CV_64F);
     CV_Assert(K_.cols == 3 && K_.rows == 3);
   }
 
-  // Just to remove a warning
-  void delete_normals_impl(void *rgbd_normals_impl_, int method_, int depth);
-  void delete_normals_impl(void *rgbd_normals_impl_, int method_, int depth)
-  {
-    if (rgbd_normals_impl_ == 0)
-      return;
-    switch (method_)
-    {
-      case RgbdNormals::RGBD_NORMALS_METHOD_LINEMOD:
-      {
-        if (depth == CV_32F)
-          delete reinterpret_cast<const LINEMOD<float> *>(rgbd_normals_impl_);
-        else
-          delete reinterpret_cast<const LINEMOD<double> *>(rgbd_normals_impl_);
-        break;
-      }
-      case RgbdNormals::RGBD_NORMALS_METHOD_SRI:
-      {
-        if (depth == CV_32F)
-          delete reinterpret_cast<const SRI<float> *>(rgbd_normals_impl_);
-        else
-          delete reinterpret_cast<const SRI<double> *>(rgbd_normals_impl_);
-        break;
-      }
-      case (RgbdNormals::RGBD_NORMALS_METHOD_FALS):
-      {
-        if (depth == CV_32F)
-          delete reinterpret_cast<const FALS<float> *>(rgbd_normals_impl_);
-        else
-          delete reinterpret_cast<const FALS<double> *>(rgbd_normals_impl_);
-        break;
-      }
-    }
-  }
-
   /** Destructor
    */
   RgbdNormals::~RgbdNormals()
   {
-    delete_normals_impl(rgbd_normals_impl_, method_, depth_);
+    releaseNormalsImpl(rgbd_normals_impl_);
   }
 
   void
   RgbdNormals::initialize_normals_impl(int rows, int cols, int depth, const cv::Mat & K, int window_size,
-                                       int method_in) const
+                                       int method_in, int fals_m_inv) const
   {
     CV_Assert(rows > 0 && cols > 0 && (depth == CV_32F || depth == CV_64F));
     CV_Assert(window_size == 1 || window_size == 3 || window_size == 5 || window_size == 7);
@@ -742,14 +1139,28 @@ namespace cv
     CV_Assert(
         method_in == RGBD_NORMALS_METHOD_FALS || method_in == RGBD_NORMALS_METHOD_LINEMOD
         || method_in == RGBD_NORMALS_METHOD_SRI);
+    CV_Assert(
+        fals_m_inv == RGBD_NORMALS_FALS_M_INV_FULL || fals_m_inv == RGBD_NORMALS_FALS_M_INV_RECOMPUTE);
+
+    cv::AutoLock lock(shared_normals_mutex);
+
+    // Use the implementation of another RgbdNormals with the same parameters if there is one
+    for (size_t i = 0; i < shared_normals_impls.size(); ++i)
+      if (shared_normals_impls[i].impl->validate(rows, cols, depth, K, window_size, method_in, fals_m_inv))
+      {
+        ++shared_normals_impls[i].refcount;
+        rgbd_normals_impl_ = shared_normals_impls[i].impl;
+        return;
+      }
+
     switch (method_in)
     {
       case (RGBD_NORMALS_METHOD_FALS):
       {
         if (depth == CV_32F)
-          rgbd_normals_impl_ = new FALS<float>(rows, cols, window_size, depth, K, RGBD_NORMALS_METHOD_FALS);
+          rgbd_normals_impl_ = new FALS<float>(rows, cols, window_size, depth, K, RGBD_NORMALS_METHOD_FALS, fals_m_inv);
         else
-          rgbd_normals_impl_ = new FALS<double>(rows, cols, window_size, depth, K, RGBD_NORMALS_METHOD_FALS);
+          rgbd_normals_impl_ = new FALS<double>(rows, cols, window_size, depth, K, RGBD_NORMALS_METHOD_FALS, fals_m_inv);
         break;
       }
       case (RGBD_NORMALS_METHOD_LINEMOD):
@@ -771,6 +1182,11 @@ namespace cv
     }
 
     reinterpret_cast<RgbdNormalsImpl *>(rgbd_normals_impl_)->cache();
+
+    SharedNormalsImpl shared_impl;
+    shared_impl.impl = reinterpret_cast<RgbdNormalsImpl *>(rgbd_normals_impl_);
+    shared_impl.refcount = 1;
+    shared_normals_impls.push_back(shared_impl);
   }
 
   /** Initializes some data that is cached for later computation
@@ -780,22 +1196,40 @@ namespace cv
   RgbdNormals::initialize() const
   {
     if (rgbd_normals_impl_ == 0)
-      initialize_normals_impl(rows_, cols_, depth_, K_, window_size_, method_);
+      initialize_normals_impl(rows_, cols_, depth_, K_, window_size_, method_, fals_m_inv_);
     else if (!reinterpret_cast<RgbdNormalsImpl *>(rgbd_normals_impl_)->validate(rows_, cols_, depth_, K_, window_size_,
-                                                                                method_)) {
-      delete_normals_impl(rgbd_normals_impl_, method_, depth_);
-      initialize_normals_impl(rows_, cols_, depth_, K_, window_size_, method_);
+                                                                                method_, fals_m_inv_)) {
+      releaseNormalsImpl(rgbd_normals_impl_);
+      rgbd_normals_impl_ = 0;
+      initialize_normals_impl(rows_, cols_, depth_, K_, window_size_, method_, fals_m_inv_);
     }
   }
 
   /** Given a set of 3d points in a depth image, compute the normals at each point
-   * @param points3d_in depth a float depth image. Or it can be rows x cols x 3 is they are 3d points
+   * @param points3d_in depth a float depth image. Or it can be rows x cols x 3 is they are 3d points, or a vector of
+   *        the 3 planes x, y and z of the 3d points
    * @param normals a rows x cols x 3 matrix
    */
   void
   RgbdNormals::operator()(InputArray points3d_in, OutputArray normals_out) const
   {
-    cv::Mat points3d_ori = points3d_in.getMat();
+    // The 3d points can be given as 3 planes, that need no splitting nor interleaving
+    std::vector<cv::Mat> planes;
+    cv::Mat points3d_ori;
+    if (points3d_in.kind() == _InputArray::STD_VECTOR_MAT)
+    {
+      points3d_in.getMatVector(planes);
+      CV_Assert(planes.size() == 3);
+      for (int i = 0; i < 3; ++i)
+      {
+        CV_Assert(planes[i].dims == 2 && planes[i].channels() == 1 && planes[i].size() == planes[0].size());
+        CV_Assert(planes[i].depth() == CV_32F || planes[i].depth() == CV_64F);
+      }
+      points3d_ori = planes[2];
+    }
+    else
+      points3d_ori = points3d_in.getMat();
+    const bool is_planar = !planes.empty();
 
     CV_Assert(points3d_ori.dims == 2);
     // Either we have 3d points or a depth image
@@ -803,7 +1237,7 @@ namespace cv
     {
       case (RGBD_NORMALS_METHOD_FALS):
       {
-        CV_Assert(points3d_ori.channels() == 3);
+        CV_Assert(is_planar || points3d_ori.channels() == 3);
         CV_Assert(points3d_ori.depth() == CV_32F || points3d_ori.depth() == CV_64F);
         break;
       }
@@ -815,7 +1249,7 @@ namespace cv
       }
       case RGBD_NORMALS_METHOD_SRI:
       {
-        CV_Assert( ((points3d_ori.channels() == 3) && (points3d_ori.depth() == CV_32F || points3d_ori.depth() == CV_64F)));
+        CV_Assert( (is_planar || (points3d_ori.channels() == 3)) && (points3d_ori.depth() == CV_32F || points3d_ori.depth() == CV_64F));
         break;
       }
     }
@@ -825,7 +1259,20 @@ namespace cv
 
     // Precompute something for RGBD_NORMALS_METHOD_SRI and RGBD_NORMALS_METHOD_FALS
     cv::Mat points3d, radius;
-    if ((method_ == RGBD_NORMALS_METHOD_SRI) || (method_ == RGBD_NORMALS_METHOD_FALS))
+    if (((method_ == RGBD_NORMALS_METHOD_SRI) || (method_ == RGBD_NORMALS_METHOD_FALS)) && is_planar)
+    {
+      // Make the planes have the right depth
+      for (int i = 0; i < 3; ++i)
+        if (planes[i].depth() != depth_)
+          planes[i].convertTo(planes[i], depth_);
+
+      // Compute the distance to the points, the only thing those methods need from them
+      if (depth_ == CV_32F)
+        radius = computeRadiusPlanar<float>(planes);
+      else
+        radius = computeRadiusPlanar<double>(planes);
+    }
+    else if ((method_ == RGBD_NORMALS_METHOD_SRI) || (method_ == RGBD_NORMALS_METHOD_FALS))
     {
       // Make the points have the right depth
       if (points3d_ori.depth() == depth_)
@@ -858,14 +1305,10 @@ namespace cv
       }
       case RGBD_NORMALS_METHOD_LINEMOD:
       {
-        // Only focus on the depth image for LINEMOD
+        // Only focus on the depth image for LINEMOD: the z plane when the points are planar
         cv::Mat depth;
         if (points3d_ori.channels() == 3)
-        {
-          std::vector<cv::Mat> channels;
-          cv::split(points3d, channels);
-          depth = channels[2];
-        }
+          cv::extractChannel(points3d_ori, depth, 2);
         else
           depth = points3d_ori;
 
@@ -44,6 +44,10 @@
 #include <iostream>
 #include <limits>
 
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
 #if defined(HAVE_EIGEN) && EIGEN_WORLD_VERSION == 3
 #define HAVE_EIGEN3_HERE
 #include <Eigen/Core>
@@ -134,8 +138,96 @@ void checkNormals(const Mat& normals, const Size& depthSize)
         CV_Error(CV_StsBadSize, "Normals type has to be CV_32FC3.");
 }
 
+/** The selected pixels of a mask stored row by row, as the column indices of the pixels of each row:
+ * the columns of the row v are cols[rowStarts[v]], ..., cols[rowStarts[v+1]-1].
+ * It is built once per pyramid level, so the iterations do not scan the whole mask again.
+ */
+struct SelectedPixels
+{
+    std::vector<int> rowStarts;
+    std::vector<int> cols;
+};
+
+/** Temporary buffers of computeCorresps */
+struct CorrespsBuffers
+{
+    /** The pixels of the dst frame used on the current pyramid level */
+    SelectedPixels selectedPixels;
+    Mat corresps, zBuffer, compactCorresps;
+    std::vector<std::vector<Vec4i> > stripeCorresps;
+    std::vector<std::vector<float> > stripeDepths;
+    /** The lookup tables of KRK_inv for the columns and the rows of the dst frame */
+    std::vector<float> KRK_inv;
+};
+
+/** Temporary buffers of calcRgbdLsmMatrices and calcICPLsmMatrices */
+struct LsmBuffers
+{
+    std::vector<float> diffs;
+    std::vector<Point3f> transformedPoints0;
+    std::vector<double> stripeSigmas, stripeSums;
+};
+
+struct cv::OdometryWorkspace::Buffers
+{
+    enum
+    {
+        PYRAMID_IMAGE, PYRAMID_DEPTH, PYRAMID_MASK, PYRAMID_CLOUD, PYRAMID_DI_DX, PYRAMID_DI_DY,
+        PYRAMID_TEXTURED_MASK, PYRAMID_NORMALS, PYRAMID_NORMALS_MASK, PYRAMIDS_COUNT
+    };
+
+    /** The pyramids given back by the recycled frames, for every kind of pyramid */
+    std::vector<std::vector<Mat> > recycledPyramids[PYRAMIDS_COUNT];
+    /** The normals given back by the recycled frames */
+    std::vector<Mat> recycledNormals;
+
+    CorrespsBuffers rgbdCorresps, icpCorresps;
+    LsmBuffers lsm;
+};
+
+/** Gives to the pyramid the buffers of a recycled pyramid of the same kind (if there is one),
+ * the pyramid functions then reuse them through Mat::create
+ */
+static inline
+void takeRecycledPyramid(OdometryWorkspace::Buffers* buffers, int pyramidType, std::vector<Mat>& pyramid)
+{
+    if(!buffers)
+        return;
+
+    std::vector<std::vector<Mat> >& recycled = buffers->recycledPyramids[pyramidType];
+    if(!recycled.empty())
+    {
+        pyramid.swap(recycled.back());
+        recycled.pop_back();
+    }
+}
+
+static inline
+void takeRecycledNormals(OdometryWorkspace::Buffers* buffers, Mat& normals)
+{
+    if(buffers && !buffers->recycledNormals.empty())
+    {
+        normals = buffers->recycledNormals.back();
+        buffers->recycledNormals.pop_back();
+    }
+}
+
+/** Returns a size x type header on a buffer that only grows, so that the buffer can be reused
+ * by all the pyramid levels
+ */
+static inline
+Mat getBufferRoi(Mat& buffer, const Size& size, int type)
+{
+    if(size.area() == 0)
+        return Mat(size, type);
+    if(buffer.type() != type || buffer.rows < size.height || buffer.cols < size.width)
+        buffer.create(std::max(buffer.rows, size.height), std::max(buffer.cols, size.width), type);
+    return buffer(Rect(Point(), size));
+}
+
 static
-void preparePyramidImage(const Mat& image, std::vector<Mat>& pyramidImage, size_t levelCount)
+void preparePyramidImage(const Mat& image, std::vector<Mat>& pyramidImage, size_t levelCount,
+                         OdometryWorkspace::Buffers* buffers)
 {
     if(!pyramidImage.empty())
     {
@@ -147,11 +239,15 @@ void preparePyramidImage(const Mat& image, std::vector<Mat>& pyramidImage, size_
             CV_Assert(pyramidImage[i].type() == image.type());
     }
     else
+    {
+        takeRecycledPyramid(buffers, OdometryWorkspace::Buffers::PYRAMID_IMAGE, pyramidImage);
         buildPyramid(image, pyramidImage, levelCount - 1);
+    }
 }
 
 static
-void preparePyramidDepth(const Mat& depth, std::vector<Mat>& pyramidDepth, size_t levelCount)
+void preparePyramidDepth(const Mat& depth, std::vector<Mat>& pyramidDepth, size_t levelCount,
+                         OdometryWorkspace::Buffers* buffers)
 {
     if(!pyramidDepth.empty())
     {
@@ -163,13 +259,16 @@ void preparePyramidDepth(const Mat& depth, std::vector<Mat>& pyramidDepth, size_
             CV_Assert(pyramidDepth[i].type() == depth.type());
     }
     else
+    {
+        takeRecycledPyramid(buffers, OdometryWorkspace::Buffers::PYRAMID_DEPTH, pyramidDepth);
         buildPyramid(depth, pyramidDepth, levelCount - 1);
+    }
 }
 
 static
 void preparePyramidMask(const Mat& mask, const std::vector<Mat>& pyramidDepth, float minDepth, float maxDepth,
                         const std::vector<Mat>& pyramidNormal,
-                        std::vector<Mat>& pyramidMask)
+                        std::vector<Mat>& pyramidMask, OdometryWorkspace::Buffers* buffers)
 {
     minDepth = std::max(0.f, minDepth);
 
@@ -186,43 +285,57 @@ void preparePyramidMask(const Mat& mask, const std::vector<Mat>& pyramidDepth, f
     }
     else
     {
-        Mat validMask;
+        takeRecycledPyramid(buffers, OdometryWorkspace::Buffers::PYRAMID_MASK, pyramidMask);
+        pyramidMask.resize(pyramidDepth.size());
+
+        Mat& validMask = pyramidMask[0];
         if(mask.empty())
-            validMask = Mat(pyramidDepth[0].size(), CV_8UC1, Scalar(255));
+        {
+            validMask.create(pyramidDepth[0].size(), CV_8UC1);
+            validMask.setTo(Scalar(255));
+        }
         else
-            validMask = mask.clone();
+            mask.copyTo(validMask);
 
         buildPyramid(validMask, pyramidMask, pyramidDepth.size() - 1);
 
         for(size_t i = 0; i < pyramidMask.size(); i++)
         {
-            Mat levelDepth = pyramidDepth[i].clone();
-            patchNaNs(levelDepth, 0);
-
+            const Mat& levelDepth = pyramidDepth[i];
             Mat& levelMask = pyramidMask[i];
-            levelMask &= (levelDepth > minDepth) & (levelDepth < maxDepth);
 
             if(!pyramidNormal.empty())
             {
                 CV_Assert(pyramidNormal[i].type() == CV_32FC3);
                 CV_Assert(pyramidNormal[i].size() == pyramidDepth[i].size());
-                Mat levelNormal = pyramidNormal[i].clone();
-
-                Mat validNormalMask = levelNormal == levelNormal; // otherwise it's Nan
-                CV_Assert(validNormalMask.type() == CV_8UC3);
-
-                std::vector<Mat> channelMasks;
-                split(validNormalMask, channelMasks);
-                validNormalMask = channelMasks[0] & channelMasks[1] & channelMasks[2];
+            }
 
-                levelMask &= validNormalMask;
+            // NaN depths and normals fail the comparisons, so they are masked out too
+            for(int y = 0; y < levelMask.rows; y++)
+            {
+                const float* depth_row = levelDepth.ptr<float>(y);
+                const Vec3f* normal_row = pyramidNormal.empty() ? 0 : pyramidNormal[i].ptr<Vec3f>(y);
+                uchar* mask_row = levelMask.ptr<uchar>(y);
+                for(int x = 0; x < levelMask.cols; x++)
+                {
+                    const float d = depth_row[x];
+                    if(!(d > minDepth && d < maxDepth))
+                        mask_row[x] = 0;
+                    else if(normal_row)
+                    {
+                        const Vec3f& n = normal_row[x];
+                        if(cvIsNaN(n[0]) || cvIsNaN(n[1]) || cvIsNaN(n[2]))
+                            mask_row[x] = 0;
+                    }
+                }
             }
         }
     }
 }
 
 static
-void preparePyramidCloud(const std::vector<Mat>& pyramidDepth, const Mat& cameraMatrix, std::vector<Mat>& pyramidCloud)
+void preparePyramidCloud(const std::vector<Mat>& pyramidDepth, const Mat& cameraMatrix, std::vector<Mat>& pyramidCloud,
+                         OdometryWorkspace::Buffers* buffers)
 {
     if(!pyramidCloud.empty())
     {
@@ -240,18 +353,16 @@ void preparePyramidCloud(const std::vector<Mat>& pyramidDepth, const Mat& camera
         std::vector<Mat> pyramidCameraMatrix;
         buildPyramidCameraMatrix(cameraMatrix, pyramidDepth.size(), pyramidCameraMatrix);
 
+        takeRecycledPyramid(buffers, OdometryWorkspace::Buffers::PYRAMID_CLOUD, pyramidCloud);
         pyramidCloud.resize(pyramidDepth.size());
         for(size_t i = 0; i < pyramidDepth.size(); i++)
-        {
-            Mat cloud;
-            depthTo3d(pyramidDepth[i], pyramidCameraMatrix[i], cloud);
-            pyramidCloud[i] = cloud;
-        }
+            depthTo3d(pyramidDepth[i], pyramidCameraMatrix[i], pyramidCloud[i]);
     }
 }
 
 static
-void preparePyramidSobel(const std::vector<Mat>& pyramidImage, int dx, int dy, std::vector<Mat>& pyramidSobel)
+void preparePyramidSobel(const std::vector<Mat>& pyramidImage, int dx, int dy, std::vector<Mat>& pyramidSobel,
+                         OdometryWorkspace::Buffers* buffers)
 {
     if(!pyramidSobel.empty())
     {
@@ -266,6 +377,8 @@ void preparePyramidSobel(const std::vector<Mat>& pyramidImage, int dx, int dy, s
     }
     else
     {
+        takeRecycledPyramid(buffers, dx ? OdometryWorkspace::Buffers::PYRAMID_DI_DX : OdometryWorkspace::Buffers::PYRAMID_DI_DY,
+                            pyramidSobel);
         pyramidSobel.resize(pyramidImage.size());
         for(size_t i = 0; i < pyramidImage.size(); i++)
         {
@@ -274,6 +387,9 @@ void preparePyramidSobel(const std::vector<Mat>& pyramidImage, int dx, int dy, s
     }
 }
 
+/** Keeps a random subset of the non zero pixels of the mask. It works in place: the selected pixels are
+ * marked in the mask itself, so no other image has to be allocated.
+ */
 static
 void randomSubsetOfMask(Mat& mask, float part)
 {
@@ -282,29 +398,41 @@ void randomSubsetOfMask(Mat& mask, float part)
     const int needCount = std::max(minPointsCount, int(mask.total() * part));
     if(needCount < nonzeros)
     {
-        RNG rng;
-        Mat subset(mask.size(), CV_8UC1, Scalar(0));
+        const uchar selected = 128, candidate = 255;
+        for(int y = 0; y < mask.rows; y++)
+        {
+            uchar* mask_row = mask.ptr<uchar>(y);
+            for(int x = 0; x < mask.cols; x++)
+                mask_row[x] = mask_row[x] ? candidate : 0;
+        }
 
+        RNG rng;
         int subsetSize = 0;
         while(subsetSize < needCount)
         {
             int y = rng(mask.rows);
             int x = rng(mask.cols);
-            if(mask.at<uchar>(y,x))
+            uchar& m = mask.at<uchar>(y,x);
+            if(m == candidate)
             {
-                subset.at<uchar>(y,x) = 255;
-                mask.at<uchar>(y,x) = 0;
+                m = selected;
                 subsetSize++;
             }
         }
-        mask = subset;
+
+        for(int y = 0; y < mask.rows; y++)
+        {
+            uchar* mask_row = mask.ptr<uchar>(y);
+            for(int x = 0; x < mask.cols; x++)
+                mask_row[x] = mask_row[x] == selected ? 255 : 0;
+        }
     }
 }
 
 static
 void preparePyramidTexturedMask(const std::vector<Mat>& pyramid_dI_dx, const std::vector<Mat>& pyramid_dI_dy,
                                 const std::vector<float>& minGradMagnitudes, const std::vector<Mat>& pyramidMask, double maxPointsPart,
-                                std::vector<Mat>& pyramidTexturedMask)
+                                std::vector<Mat>& pyramidTexturedMask, OdometryWorkspace::Buffers* buffers)
 {
     if(!pyramidTexturedMask.empty())
     {
@@ -320,6 +448,7 @@ void preparePyramidTexturedMask(const std::vector<Mat>& pyramid_dI_dx, const std
     else
     {
         const float sobelScale2_inv = 1.f / (sobelScale * sobelScale);
+        takeRecycledPyramid(buffers, OdometryWorkspace::Buffers::PYRAMID_TEXTURED_MASK, pyramidTexturedMask);
         pyramidTexturedMask.resize(pyramid_dI_dx.size());
         for(size_t i = 0; i < pyramidTexturedMask.size(); i++)
         {
@@ -327,29 +456,30 @@ void preparePyramidTexturedMask(const std::vector<Mat>& pyramid_dI_dx, const std
             const Mat& dIdx = pyramid_dI_dx[i];
             const Mat& dIdy = pyramid_dI_dy[i];
 
-            Mat texturedMask(dIdx.size(), CV_8UC1, Scalar(0));
+            Mat& texturedMask = pyramidTexturedMask[i];
+            texturedMask.create(dIdx.size(), CV_8UC1);
 
             for(int y = 0; y < dIdx.rows; y++)
             {
                 const short *dIdx_row = dIdx.ptr<short>(y);
                 const short *dIdy_row = dIdy.ptr<short>(y);
+                const uchar *mask_row = pyramidMask[i].ptr<uchar>(y);
                 uchar *texturedMask_row = texturedMask.ptr<uchar>(y);
                 for(int x = 0; x < dIdx.cols; x++)
                 {
                     float magnitude2 = static_cast<float>(dIdx_row[x] * dIdx_row[x] + dIdy_row[x] * dIdy_row[x]);
-                    if(magnitude2 >= minScaledGradMagnitude2)
-                        texturedMask_row[x] = 255;
+                    texturedMask_row[x] = magnitude2 >= minScaledGradMagnitude2 ? mask_row[x] : 0;
                 }
             }
-            pyramidTexturedMask[i] = texturedMask & pyramidMask[i];
 
-            randomSubsetOfMask(pyramidTexturedMask[i], maxPointsPart);
+            randomSubsetOfMask(texturedMask, maxPointsPart);
         }
     }
 }
 
 static
-void preparePyramidNormals(const Mat& normals, const std::vector<Mat>& pyramidDepth, std::vector<Mat>& pyramidNormals)
+void preparePyramidNormals(const Mat& normals, const std::vector<Mat>& pyramidDepth, std::vector<Mat>& pyramidNormals,
+                           OdometryWorkspace::Buffers* buffers)
 {
     if(!pyramidNormals.empty())
     {
@@ -364,6 +494,7 @@ void preparePyramidNormals(const Mat& normals, const std::vector<Mat>& pyramidDe
     }
     else
     {
+        takeRecycledPyramid(buffers, OdometryWorkspace::Buffers::PYRAMID_NORMALS, pyramidNormals);
         buildPyramid(normals, pyramidNormals, pyramidDepth.size() - 1);
         // renormalize normals
         for(size_t i = 1; i < pyramidNormals.size(); i++)
@@ -384,7 +515,7 @@ void preparePyramidNormals(const Mat& normals, const std::vector<Mat>& pyramidDe
 
 static
 void preparePyramidNormalsMask(const std::vector<Mat>& pyramidNormals, const std::vector<Mat>& pyramidMask, double maxPointsPart,
-                               std::vector<Mat>& pyramidNormalsMask)
+                               std::vector<Mat>& pyramidNormalsMask, OdometryWorkspace::Buffers* buffers)
 {
     if(!pyramidNormalsMask.empty())
     {
@@ -399,11 +530,12 @@ void preparePyramidNormalsMask(const std::vector<Mat>& pyramidNormals, const std
     }
     else
     {
+        takeRecycledPyramid(buffers, OdometryWorkspace::Buffers::PYRAMID_NORMALS_MASK, pyramidNormalsMask);
         pyramidNormalsMask.resize(pyramidMask.size());
 
         for(size_t i = 0; i < pyramidNormalsMask.size(); i++)
         {
-            pyramidNormalsMask[i] = pyramidMask[i].clone();
+            pyramidMask[i].copyTo(pyramidNormalsMask[i]);
             Mat& normalsMask = pyramidNormalsMask[i];
             for(int y = 0; y < normalsMask.rows; y++)
             {
@@ -424,6 +556,138 @@ void preparePyramidNormalsMask(const std::vector<Mat>& pyramidNormals, const std
     }
 }
 
+/** Computes the full resolution normals of the frame if they are not given. The normals computer
+ * is created again if the frame size or the camera matrix changed.
+ */
+static
+void prepareNormals(OdometryFrame& frame, const Mat& cameraMatrix, Ptr<RgbdNormals>& normalsComputer,
+                    OdometryWorkspace::Buffers* buffers)
+{
+    if(frame.normals.empty())
+    {
+        if(!frame.pyramidNormals.empty())
+            frame.normals = frame.pyramidNormals[0];
+        else
+        {
+            if(normalsComputer.empty() ||
+               normalsComputer->get<int>("rows") != frame.depth.rows ||
+               normalsComputer->get<int>("cols") != frame.depth.cols ||
+               cv::norm(normalsComputer->get<Mat>("K"), cameraMatrix) > FLT_EPSILON)
+               normalsComputer = cv::Ptr<cv::RgbdNormals>(new RgbdNormals(frame.depth.rows, frame.depth.cols, frame.depth.depth(), cameraMatrix, normalWinSize, normalMethod));
+
+            takeRecycledNormals(buffers, frame.normals);
+            (*normalsComputer)(frame.pyramidCloud[0], frame.normals);
+        }
+    }
+    checkNormals(frame.normals, frame.depth.size());
+}
+
+/** A chain of the frame cache preparation that does not depend on the other chains of the same frame,
+ * so the chains can run concurrently
+ */
+class FrameCacheChain
+{
+public:
+    virtual ~FrameCacheChain() {}
+
+    virtual void run() const = 0;
+};
+
+class FrameCacheChainsInvoker : public ParallelLoopBody
+{
+public:
+    FrameCacheChainsInvoker(const FrameCacheChain* const* _chains) : chains(_chains)
+    {}
+
+    virtual void operator()(const Range& range) const
+    {
+        for(int i = range.start; i < range.end; i++)
+            chains[i]->run();
+    }
+
+private:
+    const FrameCacheChain* const* chains;
+};
+
+static inline
+void runFrameCacheChains(const FrameCacheChain* const* chains, int chainsCount)
+{
+    parallel_for_(Range(0, chainsCount), FrameCacheChainsInvoker(chains), chainsCount);
+}
+
+/** The image pyramid and, for the dst frames, its gradients */
+class ImagePyramidChain : public FrameCacheChain
+{
+public:
+    ImagePyramidChain(OdometryFrame& _frame, size_t _levelCount, bool _withSobel, OdometryWorkspace::Buffers* _buffers) :
+        frame(_frame), levelCount(_levelCount), withSobel(_withSobel), buffers(_buffers)
+    {}
+
+    virtual void run() const
+    {
+        preparePyramidImage(frame.image, frame.pyramidImage, levelCount, buffers);
+        if(withSobel)
+        {
+            preparePyramidSobel(frame.pyramidImage, 1, 0, frame.pyramid_dI_dx, buffers);
+            preparePyramidSobel(frame.pyramidImage, 0, 1, frame.pyramid_dI_dy, buffers);
+        }
+    }
+
+private:
+    ImagePyramidChain& operator=(const ImagePyramidChain&);
+
+    OdometryFrame& frame;
+    size_t levelCount;
+    bool withSobel;
+    OdometryWorkspace::Buffers* buffers;
+};
+
+/** The depth pyramid and what is computed from it: the clouds, the normals and the masks */
+class DepthPyramidChain : public FrameCacheChain
+{
+public:
+    DepthPyramidChain(OdometryFrame& _frame, size_t _levelCount, const Mat& _cameraMatrix,
+                      float _minDepth, float _maxDepth, double _maxPointsPart, bool _withCloud, bool _withNormals,
+                      Ptr<RgbdNormals>* _normalsComputer, OdometryWorkspace::Buffers* _buffers) :
+        frame(_frame), levelCount(_levelCount), cameraMatrix(_cameraMatrix),
+        minDepth(_minDepth), maxDepth(_maxDepth), maxPointsPart(_maxPointsPart),
+        withCloud(_withCloud), withNormals(_withNormals), normalsComputer(_normalsComputer), buffers(_buffers)
+    {}
+
+    virtual void run() const
+    {
+        preparePyramidDepth(frame.depth, frame.pyramidDepth, levelCount, buffers);
+
+        if(withCloud || withNormals)
+            preparePyramidCloud(frame.pyramidDepth, cameraMatrix, frame.pyramidCloud, buffers);
+
+        if(withNormals)
+        {
+            CV_Assert(normalsComputer);
+            prepareNormals(frame, cameraMatrix, *normalsComputer, buffers);
+            preparePyramidNormals(frame.normals, frame.pyramidDepth, frame.pyramidNormals, buffers);
+        }
+
+        preparePyramidMask(frame.mask, frame.pyramidDepth, minDepth, maxDepth,
+                           frame.pyramidNormals, frame.pyramidMask, buffers);
+
+        if(withNormals)
+            preparePyramidNormalsMask(frame.pyramidNormals, frame.pyramidMask, maxPointsPart, frame.pyramidNormalsMask, buffers);
+    }
+
+private:
+    DepthPyramidChain& operator=(const DepthPyramidChain&);
+
+    OdometryFrame& frame;
+    size_t levelCount;
+    const Mat& cameraMatrix;
+    float minDepth, maxDepth;
+    double maxPointsPart;
+    bool withCloud, withNormals;
+    Ptr<RgbdNormals>* normalsComputer;
+    OdometryWorkspace::Buffers* buffers;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////
 
 static
@@ -457,30 +721,187 @@ void computeProjectiveMatrix(const Mat& ksi, Mat& Rt)
 #endif
 }
 
+static
+void buildSelectedPixels(const Mat& mask, SelectedPixels& pixels)
+{
+    CV_Assert(mask.type() == CV_8UC1);
+
+    pixels.rowStarts.resize(mask.rows + 1);
+    pixels.cols.clear();
+    for(int v = 0; v < mask.rows; v++)
+    {
+        pixels.rowStarts[v] = static_cast<int>(pixels.cols.size());
+        const uchar* mask_row = mask.ptr<uchar>(v);
+        for(int u = 0; u < mask.cols; u++)
+            if(mask_row[u])
+                pixels.cols.push_back(u);
+    }
+    pixels.rowStarts[mask.rows] = static_cast<int>(pixels.cols.size());
+}
+
+/** Projects the selected pixels of some rows of depth1 into the image of depth0 and keeps the pixels
+ * that pass the depth tests. Every stripe of rows writes its candidates in its own list, in the row-major
+ * order of depth1, so the lists can be merged afterwards exactly as the serial loop would have done it.
+ */
+class ComputeCorrespsInvoker : public ParallelLoopBody
+{
+public:
+    ComputeCorrespsInvoker(const Mat& _depth0, const Mat& _validMask0,
+                           const Mat& _depth1, const SelectedPixels& _selectedPixels1, float _maxDepthDiff,
+                           const float* _KRK_inv_u1, const float* _KRK_inv_v1, const float* _Kt,
+                           int _rowsPerStripe,
+                           std::vector<std::vector<Vec4i> >& _stripeCorresps,
+                           std::vector<std::vector<float> >& _stripeDepths) :
+        depth0(_depth0), validMask0(_validMask0), depth1(_depth1), selectedPixels1(_selectedPixels1),
+        maxDepthDiff(_maxDepthDiff), KRK_inv_u1(_KRK_inv_u1), KRK_inv_v1(_KRK_inv_v1), Kt(_Kt),
+        rowsPerStripe(_rowsPerStripe), stripeCorresps(_stripeCorresps), stripeDepths(_stripeDepths)
+    {}
+
+    virtual void operator()(const Range& range) const
+    {
+        const int cols = depth1.cols;
+        const float *KRK_inv0_u1 = KRK_inv_u1,
+                    *KRK_inv3_u1 = KRK_inv_u1 + cols,
+                    *KRK_inv6_u1 = KRK_inv_u1 + 2 * cols;
+        const int *rowStarts = &selectedPixels1.rowStarts[0];
+        const int *selectedCols = selectedPixels1.cols.empty() ? 0 : &selectedPixels1.cols[0];
+
+#if CV_SSE2
+        const bool haveSSE2 = checkHardwareSupport(CV_CPU_SSE2);
+        const __m128 v_Kt0 = _mm_set1_ps(Kt[0]), v_Kt1 = _mm_set1_ps(Kt[1]), v_Kt2 = _mm_set1_ps(Kt[2]);
+        CV_DECL_ALIGNED(16) int u0_buf[4], v0_buf[4];
+        CV_DECL_ALIGNED(16) float d_buf[4];
+#endif
+
+        for(int stripe = range.start; stripe < range.end; stripe++)
+        {
+            std::vector<Vec4i>& corresps = stripeCorresps[stripe];
+            std::vector<float>& depths = stripeDepths[stripe];
+            corresps.clear();
+            depths.clear();
+
+            const int rowStart = stripe * rowsPerStripe,
+                      rowEnd = std::min(rowStart + rowsPerStripe, depth1.rows);
+            for(int v1 = rowStart; v1 < rowEnd; v1++)
+            {
+                const float *depth1_row = depth1.ptr<float>(v1);
+                const float KRK_inv1_v1_plus_KRK_inv2 = KRK_inv_v1[v1],
+                            KRK_inv4_v1_plus_KRK_inv5 = KRK_inv_v1[depth1.rows + v1],
+                            KRK_inv7_v1_plus_KRK_inv8 = KRK_inv_v1[2 * depth1.rows + v1];
+
+                int i = rowStarts[v1];
+                const int pixelsEnd = rowStarts[v1 + 1];
+#if CV_SSE2
+                if(haveSSE2)
+                {
+                    // The depths and the column terms of 4 selected pixels are loaded one by one,
+                    // their projection is done at once
+                    const __m128 v_KRK_inv1 = _mm_set1_ps(KRK_inv1_v1_plus_KRK_inv2),
+                                 v_KRK_inv4 = _mm_set1_ps(KRK_inv4_v1_plus_KRK_inv5),
+                                 v_KRK_inv7 = _mm_set1_ps(KRK_inv7_v1_plus_KRK_inv8);
+                    for(; i <= pixelsEnd - 4; i += 4)
+                    {
+                        const int *u1 = selectedCols + i;
+                        __m128 d1 = _mm_setr_ps(depth1_row[u1[0]], depth1_row[u1[1]], depth1_row[u1[2]], depth1_row[u1[3]]);
+                        __m128 KRK_inv0 = _mm_setr_ps(KRK_inv0_u1[u1[0]], KRK_inv0_u1[u1[1]], KRK_inv0_u1[u1[2]], KRK_inv0_u1[u1[3]]);
+                        __m128 KRK_inv3 = _mm_setr_ps(KRK_inv3_u1[u1[0]], KRK_inv3_u1[u1[1]], KRK_inv3_u1[u1[2]], KRK_inv3_u1[u1[3]]);
+                        __m128 KRK_inv6 = _mm_setr_ps(KRK_inv6_u1[u1[0]], KRK_inv6_u1[u1[1]], KRK_inv6_u1[u1[2]], KRK_inv6_u1[u1[3]]);
+
+                        __m128 transformed_d1 = _mm_add_ps(_mm_mul_ps(d1, _mm_add_ps(KRK_inv6, v_KRK_inv7)), v_Kt2);
+                        __m128 transformed_d1_inv = _mm_div_ps(_mm_set1_ps(1.f), transformed_d1);
+                        __m128 x = _mm_add_ps(_mm_mul_ps(d1, _mm_add_ps(KRK_inv0, v_KRK_inv1)), v_Kt0);
+                        __m128 y = _mm_add_ps(_mm_mul_ps(d1, _mm_add_ps(KRK_inv3, v_KRK_inv4)), v_Kt1);
+
+                        _mm_store_si128((__m128i*)u0_buf, _mm_cvtps_epi32(_mm_mul_ps(transformed_d1_inv, x)));
+                        _mm_store_si128((__m128i*)v0_buf, _mm_cvtps_epi32(_mm_mul_ps(transformed_d1_inv, y)));
+                        _mm_store_ps(d_buf, transformed_d1);
+
+                        for(int k = 0; k < 4; k++)
+                        {
+                            CV_DbgAssert(!cvIsNaN(depth1_row[u1[k]]));
+                            if(d_buf[k] > 0)
+                                addCandidate(u0_buf[k], v0_buf[k], u1[k], v1, d_buf[k], corresps, depths);
+                        }
+                    }
+                }
+#endif
+                for(; i < pixelsEnd; i++)
+                {
+                    const int u1 = selectedCols[i];
+                    float d1 = depth1_row[u1];
+                    CV_DbgAssert(!cvIsNaN(d1));
+                    float transformed_d1 = d1 * (KRK_inv6_u1[u1] + KRK_inv7_v1_plus_KRK_inv8) + Kt[2];
+                    if(transformed_d1 > 0)
+                    {
+                        float transformed_d1_inv = 1.f / transformed_d1;
+                        int u0 = cvRound(transformed_d1_inv * (d1 * (KRK_inv0_u1[u1] + KRK_inv1_v1_plus_KRK_inv2) + Kt[0]));
+                        int v0 = cvRound(transformed_d1_inv * (d1 * (KRK_inv3_u1[u1] + KRK_inv4_v1_plus_KRK_inv5) + Kt[1]));
+                        addCandidate(u0, v0, u1, v1, transformed_d1, corresps, depths);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    inline void addCandidate(int u0, int v0, int u1, int v1, float transformed_d1,
+                             std::vector<Vec4i>& corresps, std::vector<float>& depths) const
+    {
+        if(static_cast<unsigned>(u0) >= static_cast<unsigned>(depth0.cols) ||
+           static_cast<unsigned>(v0) >= static_cast<unsigned>(depth0.rows))
+            return;
+
+        float d0 = depth0.at<float>(v0,u0);
+        if(validMask0.at<uchar>(v0,u0) && std::abs(transformed_d1 - d0) <= maxDepthDiff)
+        {
+            CV_DbgAssert(!cvIsNaN(d0));
+            corresps.push_back(Vec4i(u0,v0,u1,v1));
+            depths.push_back(transformed_d1);
+        }
+    }
+
+    ComputeCorrespsInvoker& operator=(const ComputeCorrespsInvoker&);
+
+    const Mat& depth0;
+    const Mat& validMask0;
+    const Mat& depth1;
+    const SelectedPixels& selectedPixels1;
+    float maxDepthDiff;
+    const float* KRK_inv_u1;
+    const float* KRK_inv_v1;
+    const float* Kt;
+    int rowsPerStripe;
+    std::vector<std::vector<Vec4i> >& stripeCorresps;
+    std::vector<std::vector<float> >& stripeDepths;
+};
+
 static
 void computeCorresps(const Mat& K, const Mat& K_inv, const Mat& Rt,
                      const Mat& depth0, const Mat& validMask0,
-                     const Mat& depth1, const Mat& selectMask1, float maxDepthDiff,
-                     Mat& _corresps)
+                     const Mat& depth1, const SelectedPixels& selectedPixels1, float maxDepthDiff,
+                     Mat& _corresps, CorrespsBuffers& buffers)
 {
     CV_Assert(K.type() == CV_64FC1);
     CV_Assert(K_inv.type() == CV_64FC1);
     CV_Assert(Rt.type() == CV_64FC1);
+    CV_Assert(depth0.size() == depth1.size());
+    CV_Assert(static_cast<int>(selectedPixels1.rowStarts.size()) == depth1.rows + 1);
 
-    Mat corresps(depth1.size(), CV_16SC2, Scalar::all(-1));
-    
-    Rect r(0, 0, depth1.cols, depth1.rows);
-    Mat Kt = Rt(Rect(3,0,1,3)).clone();
-    Kt = K * Kt;
-    const double * Kt_ptr = Kt.ptr<const double>();
-
-    AutoBuffer<float> buf(3 * (depth1.cols + depth1.rows));
-    float *KRK_inv0_u1 = buf;
-    float *KRK_inv1_v1_plus_KRK_inv2 = KRK_inv0_u1 + depth1.cols;
-    float *KRK_inv3_u1 = KRK_inv1_v1_plus_KRK_inv2 + depth1.rows;
-    float *KRK_inv4_v1_plus_KRK_inv5 = KRK_inv3_u1 + depth1.cols;
-    float *KRK_inv6_u1 = KRK_inv4_v1_plus_KRK_inv5 + depth1.rows;
-    float *KRK_inv7_v1_plus_KRK_inv8 = KRK_inv6_u1 + depth1.cols;
+    float Kt[3];
+    {
+        Mat Kt_dbl = K * Rt(Rect(3,0,1,3));
+        const double * Kt_ptr = Kt_dbl.ptr<const double>();
+        for(int i = 0; i < 3; i++)
+            Kt[i] = static_cast<float>(Kt_ptr[i]);
+    }
+
+    // Lookup tables of KRK_inv: 3 rows of depth1.cols values for the columns (KRK_inv0_u1, KRK_inv3_u1, KRK_inv6_u1)
+    // followed by 3 rows of depth1.rows values for the rows (KRK_inv1_v1_plus_KRK_inv2, etc.)
+    const size_t lookupSize = 3 * (depth1.cols + depth1.rows);
+    if(buffers.KRK_inv.size() < lookupSize)
+        buffers.KRK_inv.resize(lookupSize);
+    float *KRK_inv_u1 = &buffers.KRK_inv[0];
+    float *KRK_inv_v1 = KRK_inv_u1 + 3 * depth1.cols;
     {
         Mat R = Rt(Rect(0,0,3,3)).clone();
 
@@ -488,69 +909,64 @@ void computeCorresps(const Mat& K, const Mat& K_inv, const Mat& Rt,
         const double * KRK_inv_ptr = KRK_inv.ptr<const double>();
         for(int u1 = 0; u1 < depth1.cols; u1++)
         {
-            KRK_inv0_u1[u1] = KRK_inv_ptr[0] * u1;
-            KRK_inv3_u1[u1] = KRK_inv_ptr[3] * u1;
-            KRK_inv6_u1[u1] = KRK_inv_ptr[6] * u1;
+            KRK_inv_u1[u1] = static_cast<float>(KRK_inv_ptr[0] * u1);
+            KRK_inv_u1[depth1.cols + u1] = static_cast<float>(KRK_inv_ptr[3] * u1);
+            KRK_inv_u1[2 * depth1.cols + u1] = static_cast<float>(KRK_inv_ptr[6] * u1);
         }
-        
+
         for(int v1 = 0; v1 < depth1.rows; v1++)
         {
-            KRK_inv1_v1_plus_KRK_inv2[v1] = KRK_inv_ptr[1] * v1 + KRK_inv_ptr[2];
-            KRK_inv4_v1_plus_KRK_inv5[v1] = KRK_inv_ptr[4] * v1 + KRK_inv_ptr[5];
-            KRK_inv7_v1_plus_KRK_inv8[v1] = KRK_inv_ptr[7] * v1 + KRK_inv_ptr[8];
+            KRK_inv_v1[v1] = static_cast<float>(KRK_inv_ptr[1] * v1 + KRK_inv_ptr[2]);
+            KRK_inv_v1[depth1.rows + v1] = static_cast<float>(KRK_inv_ptr[4] * v1 + KRK_inv_ptr[5]);
+            KRK_inv_v1[2 * depth1.rows + v1] = static_cast<float>(KRK_inv_ptr[7] * v1 + KRK_inv_ptr[8]);
         }
     }
 
+    // Project the selected pixels of depth1 in parallel, stripe by stripe
+    const int rowsPerStripe = 16;
+    const int stripesCount = (depth1.rows + rowsPerStripe - 1) / rowsPerStripe;
+    std::vector<std::vector<Vec4i> >& stripeCorresps = buffers.stripeCorresps;
+    std::vector<std::vector<float> >& stripeDepths = buffers.stripeDepths;
+    if(static_cast<int>(stripeCorresps.size()) < stripesCount)
+    {
+        stripeCorresps.resize(stripesCount);
+        stripeDepths.resize(stripesCount);
+    }
+    parallel_for_(Range(0, stripesCount),
+                  ComputeCorrespsInvoker(depth0, validMask0, depth1, selectedPixels1, maxDepthDiff,
+                                         KRK_inv_u1, KRK_inv_v1, Kt, rowsPerStripe,
+                                         stripeCorresps, stripeDepths));
+
+    // Merge the stripes in the z-buffer: if several pixels of depth1 are projected to the same pixel of depth0,
+    // the closest one is kept (the last one in the row-major order of depth1 if they are at the same depth)
+    Mat corresps = getBufferRoi(buffers.corresps, depth1.size(), CV_16SC2);
+    Mat zBuffer = getBufferRoi(buffers.zBuffer, depth1.size(), CV_32FC1);
+    corresps.setTo(Scalar::all(-1));
     int correspCount = 0;
-    for(int v1 = 0; v1 < depth1.rows; v1++)
+    for(int stripe = 0; stripe < stripesCount; stripe++)
     {
-        const float *depth1_row = depth1.ptr<float>(v1);
-        const uchar *mask1_row = selectMask1.ptr<uchar>(v1);
-        for(int u1 = 0; u1 < depth1.cols; u1++)
+        const std::vector<Vec4i>& candidates = stripeCorresps[stripe];
+        const std::vector<float>& depths = stripeDepths[stripe];
+        for(size_t i = 0; i < candidates.size(); i++)
         {
-            float d1 = depth1_row[u1];
-            if(mask1_row[u1])
+            const Vec4i& candidate = candidates[i];
+            Vec2s& c = corresps.at<Vec2s>(candidate[1], candidate[0]);
+            float& z = zBuffer.at<float>(candidate[1], candidate[0]);
+            if(c[0] != -1)
             {
-                CV_DbgAssert(!cvIsNaN(d1));
-                float transformed_d1 = static_cast<float>(d1 * (KRK_inv6_u1[u1] + KRK_inv7_v1_plus_KRK_inv8[v1]) + 
-                                                          Kt_ptr[2]);
-                if(transformed_d1 > 0)
-                {
-                    float transformed_d1_inv = 1.f / transformed_d1;
-                    int u0 = cvRound(transformed_d1_inv * (d1 * (KRK_inv0_u1[u1] + KRK_inv1_v1_plus_KRK_inv2[v1]) + 
-                                                           Kt_ptr[0]));
-                    int v0 = cvRound(transformed_d1_inv * (d1 * (KRK_inv3_u1[u1] + KRK_inv4_v1_plus_KRK_inv5[v1]) + 
-                                                           Kt_ptr[1]));
-                    
-                    if(r.contains(Point(u0,v0)))
-                    {
-                        float d0 = depth0.at<float>(v0,u0);
-                        if(validMask0.at<uchar>(v0, u0) && std::abs(transformed_d1 - d0) <= maxDepthDiff)
-                        {
-                            CV_DbgAssert(!cvIsNaN(d0));
-                            Vec2s& c = corresps.at<Vec2s>(v0,u0);
-                            if(c[0] != -1)
-                            {
-                                int exist_u1 = c[0], exist_v1 = c[1];
-
-                                float exist_d1 = (float)(depth1.at<float>(exist_v1,exist_u1) * 
-                                    (KRK_inv6_u1[exist_u1] + KRK_inv7_v1_plus_KRK_inv8[exist_v1]) + Kt_ptr[2]);
-
-                                if(transformed_d1 > exist_d1)
-                                    continue;
-                            }
-                            else
-                                correspCount++;
-
-                            c = Vec2s(u1,v1);
-                        }
-                    }
-                }
+                if(depths[i] > z)
+                    continue;
             }
+            else
+                correspCount++;
+
+            c = Vec2s(static_cast<short>(candidate[2]), static_cast<short>(candidate[3]));
+            z = depths[i];
         }
     }
 
-    _corresps.create(correspCount, 1, CV_32SC4);
+    // The buffer of the compact correspondences only grows so that it is not reallocated at every iteration
+    _corresps = getBufferRoi(buffers.compactCorresps, Size(1, correspCount), CV_32SC4);
     Vec4i * corresps_ptr = _corresps.ptr<Vec4i>();
     for(int v0 = 0, i = 0; v0 < corresps.rows; v0++)
     {
@@ -604,8 +1020,33 @@ void calcRgbdEquationCoeffsTranslation(double* C, double dIdx, double dIdy, cons
     C[2] = v2;
 }
 
-typedef
-void (*CalcRgbdEquationCoeffsPtr)(double*, double, double, const Point3f&, double, double);
+/** Compile-time selection of the coefficients of the Rgbd equations for a transformation type */
+struct RgbdEquationCoeffsRigidBodyMotion
+{
+    enum { dim = 6 };
+    static inline void calc(double* C, double dIdx, double dIdy, const Point3f& p3d, double fx, double fy)
+    {
+        calcRgbdEquationCoeffs(C, dIdx, dIdy, p3d, fx, fy);
+    }
+};
+
+struct RgbdEquationCoeffsRotation
+{
+    enum { dim = 3 };
+    static inline void calc(double* C, double dIdx, double dIdy, const Point3f& p3d, double fx, double fy)
+    {
+        calcRgbdEquationCoeffsRotation(C, dIdx, dIdy, p3d, fx, fy);
+    }
+};
+
+struct RgbdEquationCoeffsTranslation
+{
+    enum { dim = 3 };
+    static inline void calc(double* C, double dIdx, double dIdy, const Point3f& p3d, double fx, double fy)
+    {
+        calcRgbdEquationCoeffsTranslation(C, dIdx, dIdy, p3d, fx, fy);
+    }
+};
 
 static inline
 void calcICPEquationCoeffs(double* C, const Point3f& p0, const Vec3f& n1)
@@ -634,168 +1075,481 @@ void calcICPEquationCoeffsTranslation(double* C, const Point3f& /*p0*/, const Ve
     C[2] = n1[2];
 }
 
-typedef
-void (*CalcICPEquationCoeffsPtr)(double*, const Point3f&, const Vec3f&);
-
-static 
-void calcRgbdLsmMatrices(const Mat& image0, const Mat& cloud0, const Mat& Rt,
-               const Mat& image1, const Mat& dI_dx1, const Mat& dI_dy1,
-               const Mat& corresps, double fx, double fy, double sobelScaleIn,
-               Mat& AtA, Mat& AtB, CalcRgbdEquationCoeffsPtr func, int transformDim)
+/** Compile-time selection of the coefficients of the ICP equations for a transformation type */
+struct ICPEquationCoeffsRigidBodyMotion
 {
-    AtA = Mat(transformDim, transformDim, CV_64FC1, Scalar(0));
-    AtB = Mat(transformDim, 1, CV_64FC1, Scalar(0));
-    double* AtB_ptr = AtB.ptr<double>();
-
-    const int correspsCount = corresps.rows;
-
-    CV_Assert(Rt.type() == CV_64FC1);
-    const double * Rt_ptr = Rt.ptr<const double>();
-
-    AutoBuffer<float> diffs(correspsCount);
-    float* diffs_ptr = diffs;
-
-    const Vec4i* corresps_ptr = corresps.ptr<Vec4i>();
-
-    double sigma = 0;
-    for(int correspIndex = 0; correspIndex < corresps.rows; correspIndex++)
+    enum { dim = 6 };
+    static inline void calc(double* C, const Point3f& p0, const Vec3f& n1)
     {
-         const Vec4i& c = corresps_ptr[correspIndex];
-         int u0 = c[0], v0 = c[1];
-         int u1 = c[2], v1 = c[3];
-              
-         diffs_ptr[correspIndex] = static_cast<float>(static_cast<int>(image0.at<uchar>(v0,u0)) - 
-                                                      static_cast<int>(image1.at<uchar>(v1,u1)));
-         sigma += diffs_ptr[correspIndex] * diffs_ptr[correspIndex];
+        calcICPEquationCoeffs(C, p0, n1);
     }
-    sigma = std::sqrt(sigma/correspsCount);
-
-    std::vector<double> A_buf(transformDim);
-    double* A_ptr = &A_buf[0];
+};
 
-    for(int correspIndex = 0; correspIndex < corresps.rows; correspIndex++)
+struct ICPEquationCoeffsRotation
+{
+    enum { dim = 3 };
+    static inline void calc(double* C, const Point3f& p0, const Vec3f& n1)
     {
-         const Vec4i& c = corresps_ptr[correspIndex];
-         int u0 = c[0], v0 = c[1];
-         int u1 = c[2], v1 = c[3];
-
-         double w = sigma + std::abs(diffs_ptr[correspIndex]);
-         w = w > DBL_EPSILON ? 1./w : 1.;
-
-         double w_sobelScale = w * sobelScaleIn;
+        calcICPEquationCoeffsRotation(C, p0, n1);
+    }
+};
 
-         const Point3f& p0 = cloud0.at<Point3f>(v0,u0);
-         Point3f tp0;
-         tp0.x = p0.x * Rt_ptr[0] + p0.y * Rt_ptr[1] + p0.z * Rt_ptr[2] + Rt_ptr[3];
-         tp0.y = p0.x * Rt_ptr[4] + p0.y * Rt_ptr[5] + p0.z * Rt_ptr[6] + Rt_ptr[7];
-         tp0.z = p0.x * Rt_ptr[8] + p0.y * Rt_ptr[9] + p0.z * Rt_ptr[10] + Rt_ptr[11];
+struct ICPEquationCoeffsTranslation
+{
+    enum { dim = 3 };
+    static inline void calc(double* C, const Point3f& p0, const Vec3f& n1)
+    {
+        calcICPEquationCoeffsTranslation(C, p0, n1);
+    }
+};
 
-         func(A_ptr,
-              w_sobelScale * dI_dx1.at<short int>(v1,u1),
-              w_sobelScale * dI_dy1.at<short int>(v1,u1),
-              tp0, fx, fy);
+/** The correspondences are split in a fixed number of stripes (it does not depend on the number of threads,
+ * so the result of the reduction does not either). Every stripe accumulates its own AtA and AtB.
+ */
+static inline
+int getLsmStripesCount(int correspsCount)
+{
+    const int minCorrespsPerStripe = 512;
+    const int maxStripesCount = 64;
+    return std::max(1, std::min(maxStripesCount, correspsCount / minCorrespsPerStripe));
+}
 
-        for(int y = 0; y < transformDim; y++)
-        {
-            double* AtA_ptr = AtA.ptr<double>(y);
-            for(int x = y; x < transformDim; x++)
-                AtA_ptr[x] += A_ptr[y] * A_ptr[x];
+static inline
+Range getLsmStripeRange(int stripe, int stripesCount, int correspsCount)
+{
+    return Range(static_cast<int>(static_cast<int64>(correspsCount) * stripe / stripesCount),
+                 static_cast<int>(static_cast<int64>(correspsCount) * (stripe + 1) / stripesCount));
+}
 
-            AtB_ptr[y] += A_ptr[y] * w * diffs_ptr[correspIndex];
-        }
-    }		
-    
-    for(int y = 0; y < transformDim; y++)
-        for(int x = y+1; x < transformDim; x++)
-            AtA.at<double>(x,y) = AtA.at<double>(y,x);
+template<int dim>
+static inline
+void accumulateLsmEquation(const double* A, double b, double* AtA, double* AtB)
+{
+    for(int y = 0; y < dim; y++)
+    {
+        for(int x = y; x < dim; x++)
+            AtA[y * dim + x] += A[y] * A[x];
+        AtB[y] += A[y] * b;
+    }
 }
 
+/** Sums the AtA and AtB of all the stripes and fills the lower part of AtA */
+template<int dim>
 static
-void calcICPLsmMatrices(const Mat& cloud0, const Mat& Rt,
-                        const Mat& cloud1, const Mat& normals1,
-                        const Mat& corresps,
-                        Mat& AtA, Mat& AtB, CalcICPEquationCoeffsPtr func, int transformDim)
+void sumLsmStripes(const std::vector<double>& stripeSums, int stripesCount, Mat& AtA, Mat& AtB)
 {
-    AtA = Mat(transformDim, transformDim, CV_64FC1, Scalar(0));
-    AtB = Mat(transformDim, 1, CV_64FC1, Scalar(0));
+    const int stripeSize = dim * dim + dim;
+    AtA.create(dim, dim, CV_64FC1);
+    AtB.create(dim, 1, CV_64FC1);
+    AtA.setTo(Scalar(0));
+    AtB.setTo(Scalar(0));
+    double* AtA_ptr = AtA.ptr<double>();
     double* AtB_ptr = AtB.ptr<double>();
 
-    const int correspsCount = corresps.rows;
+    for(int stripe = 0; stripe < stripesCount; stripe++)
+    {
+        const double* stripeSum = &stripeSums[stripe * stripeSize];
+        for(int i = 0; i < dim * dim; i++)
+            AtA_ptr[i] += stripeSum[i];
+        for(int i = 0; i < dim; i++)
+            AtB_ptr[i] += stripeSum[dim * dim + i];
+    }
 
-    CV_Assert(Rt.type() == CV_64FC1);
-    const double * Rt_ptr = Rt.ptr<const double>();
+    for(int y = 0; y < dim; y++)
+        for(int x = y+1; x < dim; x++)
+            AtA_ptr[x * dim + y] = AtA_ptr[y * dim + x];
+}
 
-    AutoBuffer<float> diffs(correspsCount);
-    float * diffs_ptr = diffs;
+/** Computes the photometric residuals of the correspondences and the sum of their squares for every stripe */
+class RgbdDiffsInvoker : public ParallelLoopBody
+{
+public:
+    RgbdDiffsInvoker(const Mat& _image0, const Mat& _image1, const Mat& _corresps, int _stripesCount,
+                     float* _diffs, double* _stripeSigmas) :
+        image0(_image0), image1(_image1), corresps(_corresps), stripesCount(_stripesCount),
+        diffs(_diffs), stripeSigmas(_stripeSigmas)
+    {}
+
+    virtual void operator()(const Range& range) const
+    {
+        const Vec4i* corresps_ptr = corresps.ptr<Vec4i>();
+        const uchar* image0_data = image0.data;
+        const uchar* image1_data = image1.data;
+        const size_t image0_step = image0.step, image1_step = image1.step;
 
-    AutoBuffer<Point3f> transformedPoints0(correspsCount);
-    Point3f * tps0_ptr = transformedPoints0;
+        for(int stripe = range.start; stripe < range.end; stripe++)
+        {
+            const Range r = getLsmStripeRange(stripe, stripesCount, corresps.rows);
+            double sigma = 0;
+            for(int correspIndex = r.start; correspIndex < r.end; correspIndex++)
+            {
+                const Vec4i& c = corresps_ptr[correspIndex];
+                int u0 = c[0], v0 = c[1];
+                int u1 = c[2], v1 = c[3];
+
+                float diff = static_cast<float>(static_cast<int>(image0_data[v0 * image0_step + u0]) -
+                                                static_cast<int>(image1_data[v1 * image1_step + u1]));
+                diffs[correspIndex] = diff;
+                sigma += diff * diff;
+            }
+            stripeSigmas[stripe] = sigma;
+        }
+    }
 
-    const Vec4i* corresps_ptr = corresps.ptr<Vec4i>();
+private:
+    RgbdDiffsInvoker& operator=(const RgbdDiffsInvoker&);
 
-    double sigma = 0;
-    for(int correspIndex = 0; correspIndex < corresps.rows; correspIndex++)
-    {
-        const Vec4i& c = corresps_ptr[correspIndex];
-        int u0 = c[0], v0 = c[1];
-        int u1 = c[2], v1 = c[3];
+    const Mat& image0;
+    const Mat& image1;
+    const Mat& corresps;
+    int stripesCount;
+    float* diffs;
+    double* stripeSigmas;
+};
 
-        const Point3f& p0 = cloud0.at<Point3f>(v0,u0);
-        Point3f tp0;
-        tp0.x = p0.x * Rt_ptr[0] + p0.y * Rt_ptr[1] + p0.z * Rt_ptr[2] + Rt_ptr[3];
-        tp0.y = p0.x * Rt_ptr[4] + p0.y * Rt_ptr[5] + p0.z * Rt_ptr[6] + Rt_ptr[7];
-        tp0.z = p0.x * Rt_ptr[8] + p0.y * Rt_ptr[9] + p0.z * Rt_ptr[10] + Rt_ptr[11];
+/** Accumulates the weighted Rgbd normal equations of every stripe of correspondences */
+template<typename EquationCoeffs>
+class RgbdLsmInvoker : public ParallelLoopBody
+{
+public:
+    enum { dim = EquationCoeffs::dim };
 
-        Vec3f n1 = normals1.at<Vec3f>(v1, u1);
-        Point3f v = cloud1.at<Point3f>(v1,u1) - tp0;
+    RgbdLsmInvoker(const Mat& _cloud0, const double* _Rt_ptr, const Mat& _dI_dx1, const Mat& _dI_dy1,
+                   const Mat& _corresps, const float* _diffs, double _sigma, double _fx, double _fy, double _sobelScale,
+                   int _stripesCount, double* _stripeSums) :
+        cloud0(_cloud0), Rt_ptr(_Rt_ptr), dI_dx1(_dI_dx1), dI_dy1(_dI_dy1), corresps(_corresps), diffs(_diffs),
+        sigma(_sigma), fx(_fx), fy(_fy), sobelScale(_sobelScale), stripesCount(_stripesCount), stripeSums(_stripeSums)
+    {}
 
-        tps0_ptr[correspIndex] = tp0;
-        diffs_ptr[correspIndex] = n1[0] * v.x + n1[1] * v.y + n1[2] * v.z;
-        sigma += diffs_ptr[correspIndex] * diffs_ptr[correspIndex];
-    }
+    virtual void operator()(const Range& range) const
+    {
+        const Vec4i* corresps_ptr = corresps.ptr<Vec4i>();
+        const uchar* cloud0_data = cloud0.data;
+        const uchar* dI_dx1_data = dI_dx1.data;
+        const uchar* dI_dy1_data = dI_dy1.data;
+        const size_t cloud0_step = cloud0.step, dI_dx1_step = dI_dx1.step, dI_dy1_step = dI_dy1.step;
 
-    sigma = std::sqrt(sigma/correspsCount);
+        for(int stripe = range.start; stripe < range.end; stripe++)
+        {
+            double* AtA = stripeSums + stripe * (dim * dim + dim);
+            double* AtB = AtA + dim * dim;
+            std::fill(AtA, AtA + dim * dim + dim, 0.);
 
-    std::vector<double> A_buf(transformDim);
-    double* A_ptr = &A_buf[0];
-    for(int correspIndex = 0; correspIndex < corresps.rows; correspIndex++)
-    {
-        const Vec4i& c = corresps_ptr[correspIndex];
-        int u1 = c[2], v1 = c[3];
+            double A[dim];
+            const Range r = getLsmStripeRange(stripe, stripesCount, corresps.rows);
+            for(int correspIndex = r.start; correspIndex < r.end; correspIndex++)
+            {
+                const Vec4i& c = corresps_ptr[correspIndex];
+                int u0 = c[0], v0 = c[1];
+                int u1 = c[2], v1 = c[3];
 
-        double w = sigma + std::abs(diffs_ptr[correspIndex]);
-        w = w > DBL_EPSILON ? 1./w : 1.;
+                double w = sigma + std::abs(diffs[correspIndex]);
+                w = w > DBL_EPSILON ? 1./w : 1.;
 
-        func(A_ptr, tps0_ptr[correspIndex], normals1.at<Vec3f>(v1, u1) * w);
+                double w_sobelScale = w * sobelScale;
 
-        for(int y = 0; y < transformDim; y++)
-        {
-            double* AtA_ptr = AtA.ptr<double>(y);
-            for(int x = y; x < transformDim; x++)
-                AtA_ptr[x] += A_ptr[y] * A_ptr[x];
+                const Point3f& p0 = reinterpret_cast<const Point3f*>(cloud0_data + v0 * cloud0_step)[u0];
+                Point3f tp0;
+                tp0.x = (float)(p0.x * Rt_ptr[0] + p0.y * Rt_ptr[1] + p0.z * Rt_ptr[2] + Rt_ptr[3]);
+                tp0.y = (float)(p0.x * Rt_ptr[4] + p0.y * Rt_ptr[5] + p0.z * Rt_ptr[6] + Rt_ptr[7]);
+                tp0.z = (float)(p0.x * Rt_ptr[8] + p0.y * Rt_ptr[9] + p0.z * Rt_ptr[10] + Rt_ptr[11]);
 
-            AtB_ptr[y] += A_ptr[y] * w * diffs_ptr[correspIndex];
+                EquationCoeffs::calc(A,
+                                     w_sobelScale * reinterpret_cast<const short*>(dI_dx1_data + v1 * dI_dx1_step)[u1],
+                                     w_sobelScale * reinterpret_cast<const short*>(dI_dy1_data + v1 * dI_dy1_step)[u1],
+                                     tp0, fx, fy);
+
+                accumulateLsmEquation<dim>(A, w * diffs[correspIndex], AtA, AtB);
+            }
         }
     }
 
-    for(int y = 0; y < transformDim; y++)
-        for(int x = y+1; x < transformDim; x++)
-            AtA.at<double>(x,y) = AtA.at<double>(y,x);
-}
+private:
+    RgbdLsmInvoker& operator=(const RgbdLsmInvoker&);
+
+    const Mat& cloud0;
+    const double* Rt_ptr;
+    const Mat& dI_dx1;
+    const Mat& dI_dy1;
+    const Mat& corresps;
+    const float* diffs;
+    double sigma, fx, fy, sobelScale;
+    int stripesCount;
+    double* stripeSums;
+};
 
+template<typename EquationCoeffs>
 static
-bool solveSystem(const Mat& AtA, const Mat& AtB, double detThreshold, Mat& x)
+double calcRgbdLsmMatricesImpl(const Mat& image0, const Mat& cloud0, const Mat& Rt,
+                             const Mat& image1, const Mat& dI_dx1, const Mat& dI_dy1,
+                             const Mat& corresps, double fx, double fy, double sobelScaleIn,
+                             Mat& AtA, Mat& AtB, LsmBuffers& buffers)
 {
-    double det = cv::determinant(AtA);
-
-    if(fabs (det) < detThreshold || cvIsNaN(det) || cvIsInf(det))
-        return false;
+    const int dim = EquationCoeffs::dim;
+    const int correspsCount = corresps.rows;
+
+    CV_Assert(Rt.type() == CV_64FC1);
+    const double * Rt_ptr = Rt.ptr<const double>();
+
+    const int stripesCount = getLsmStripesCount(correspsCount);
+
+    buffers.diffs.resize(correspsCount);
+    buffers.stripeSigmas.resize(stripesCount);
+    float* diffs = &buffers.diffs[0];
+    double* stripeSigmas = &buffers.stripeSigmas[0];
+    parallel_for_(Range(0, stripesCount),
+                  RgbdDiffsInvoker(image0, image1, corresps, stripesCount, diffs, stripeSigmas));
+
+    double sigma = 0;
+    for(int stripe = 0; stripe < stripesCount; stripe++)
+        sigma += stripeSigmas[stripe];
+    sigma = std::sqrt(sigma/correspsCount);
+
+    std::vector<double>& stripeSums = buffers.stripeSums;
+    stripeSums.resize(stripesCount * (dim * dim + dim));
+    parallel_for_(Range(0, stripesCount),
+                  RgbdLsmInvoker<EquationCoeffs>(cloud0, Rt_ptr, dI_dx1, dI_dy1, corresps, diffs, sigma,
+                                                 fx, fy, sobelScaleIn, stripesCount, &stripeSums[0]));
+
+    sumLsmStripes<dim>(stripeSums, stripesCount, AtA, AtB);
+
+    return sigma;
+}
+
+/** Computes the normal equations of the photometric error, returns the standard deviation of the residuals */
+static
+double calcRgbdLsmMatrices(const Mat& image0, const Mat& cloud0, const Mat& Rt,
+               const Mat& image1, const Mat& dI_dx1, const Mat& dI_dy1,
+               const Mat& corresps, double fx, double fy, double sobelScaleIn,
+               Mat& AtA, Mat& AtB, int transformType, LsmBuffers& buffers)
+{
+    switch(transformType)
+    {
+    case Odometry::RIGID_BODY_MOTION:
+        return calcRgbdLsmMatricesImpl<RgbdEquationCoeffsRigidBodyMotion>(image0, cloud0, Rt, image1, dI_dx1, dI_dy1,
+                                                                          corresps, fx, fy, sobelScaleIn, AtA, AtB, buffers);
+    case Odometry::ROTATION:
+        return calcRgbdLsmMatricesImpl<RgbdEquationCoeffsRotation>(image0, cloud0, Rt, image1, dI_dx1, dI_dy1,
+                                                                   corresps, fx, fy, sobelScaleIn, AtA, AtB, buffers);
+    case Odometry::TRANSLATION:
+        return calcRgbdLsmMatricesImpl<RgbdEquationCoeffsTranslation>(image0, cloud0, Rt, image1, dI_dx1, dI_dy1,
+                                                                      corresps, fx, fy, sobelScaleIn, AtA, AtB, buffers);
+    default:
+        CV_Error(CV_StsBadArg, "Incorrect transformation type");
+    }
+    return 0.;
+}
+
+/** Computes the transformed points and the point-to-plane residuals of the correspondences
+ * and the sum of the squared residuals for every stripe
+ */
+class ICPDiffsInvoker : public ParallelLoopBody
+{
+public:
+    ICPDiffsInvoker(const Mat& _cloud0, const double* _Rt_ptr, const Mat& _cloud1, const Mat& _normals1,
+                    const Mat& _corresps, int _stripesCount,
+                    float* _diffs, Point3f* _tps0, double* _stripeSigmas) :
+        cloud0(_cloud0), Rt_ptr(_Rt_ptr), cloud1(_cloud1), normals1(_normals1), corresps(_corresps),
+        stripesCount(_stripesCount), diffs(_diffs), tps0(_tps0), stripeSigmas(_stripeSigmas)
+    {}
+
+    virtual void operator()(const Range& range) const
+    {
+        const Vec4i* corresps_ptr = corresps.ptr<Vec4i>();
+        const uchar* cloud0_data = cloud0.data;
+        const uchar* cloud1_data = cloud1.data;
+        const uchar* normals1_data = normals1.data;
+        const size_t cloud0_step = cloud0.step, cloud1_step = cloud1.step, normals1_step = normals1.step;
+
+        for(int stripe = range.start; stripe < range.end; stripe++)
+        {
+            const Range r = getLsmStripeRange(stripe, stripesCount, corresps.rows);
+            double sigma = 0;
+            for(int correspIndex = r.start; correspIndex < r.end; correspIndex++)
+            {
+                const Vec4i& c = corresps_ptr[correspIndex];
+                int u0 = c[0], v0 = c[1];
+                int u1 = c[2], v1 = c[3];
+
+                const Point3f& p0 = reinterpret_cast<const Point3f*>(cloud0_data + v0 * cloud0_step)[u0];
+                Point3f tp0;
+                tp0.x = (float)(p0.x * Rt_ptr[0] + p0.y * Rt_ptr[1] + p0.z * Rt_ptr[2] + Rt_ptr[3]);
+                tp0.y = (float)(p0.x * Rt_ptr[4] + p0.y * Rt_ptr[5] + p0.z * Rt_ptr[6] + Rt_ptr[7]);
+                tp0.z = (float)(p0.x * Rt_ptr[8] + p0.y * Rt_ptr[9] + p0.z * Rt_ptr[10] + Rt_ptr[11]);
+
+                const Vec3f& n1 = reinterpret_cast<const Vec3f*>(normals1_data + v1 * normals1_step)[u1];
+                Point3f v = reinterpret_cast<const Point3f*>(cloud1_data + v1 * cloud1_step)[u1] - tp0;
+
+                tps0[correspIndex] = tp0;
+                float diff = n1[0] * v.x + n1[1] * v.y + n1[2] * v.z;
+                diffs[correspIndex] = diff;
+                sigma += diff * diff;
+            }
+            stripeSigmas[stripe] = sigma;
+        }
+    }
+
+private:
+    ICPDiffsInvoker& operator=(const ICPDiffsInvoker&);
+
+    const Mat& cloud0;
+    const double* Rt_ptr;
+    const Mat& cloud1;
+    const Mat& normals1;
+    const Mat& corresps;
+    int stripesCount;
+    float* diffs;
+    Point3f* tps0;
+    double* stripeSigmas;
+};
+
+/** Accumulates the weighted ICP normal equations of every stripe of correspondences */
+template<typename EquationCoeffs>
+class ICPLsmInvoker : public ParallelLoopBody
+{
+public:
+    enum { dim = EquationCoeffs::dim };
+
+    ICPLsmInvoker(const Mat& _normals1, const Mat& _corresps, const float* _diffs, const Point3f* _tps0,
+                  double _sigma, int _stripesCount, double* _stripeSums) :
+        normals1(_normals1), corresps(_corresps), diffs(_diffs), tps0(_tps0), sigma(_sigma),
+        stripesCount(_stripesCount), stripeSums(_stripeSums)
+    {}
+
+    virtual void operator()(const Range& range) const
+    {
+        const Vec4i* corresps_ptr = corresps.ptr<Vec4i>();
+        const uchar* normals1_data = normals1.data;
+        const size_t normals1_step = normals1.step;
+
+        for(int stripe = range.start; stripe < range.end; stripe++)
+        {
+            double* AtA = stripeSums + stripe * (dim * dim + dim);
+            double* AtB = AtA + dim * dim;
+            std::fill(AtA, AtA + dim * dim + dim, 0.);
+
+            double A[dim];
+            const Range r = getLsmStripeRange(stripe, stripesCount, corresps.rows);
+            for(int correspIndex = r.start; correspIndex < r.end; correspIndex++)
+            {
+                const Vec4i& c = corresps_ptr[correspIndex];
+                int u1 = c[2], v1 = c[3];
+
+                double w = sigma + std::abs(diffs[correspIndex]);
+                w = w > DBL_EPSILON ? 1./w : 1.;
+
+                const Vec3f& n1 = reinterpret_cast<const Vec3f*>(normals1_data + v1 * normals1_step)[u1];
+                EquationCoeffs::calc(A, tps0[correspIndex], n1 * w);
+
+                accumulateLsmEquation<dim>(A, w * diffs[correspIndex], AtA, AtB);
+            }
+        }
+    }
+
+private:
+    ICPLsmInvoker& operator=(const ICPLsmInvoker&);
+
+    const Mat& normals1;
+    const Mat& corresps;
+    const float* diffs;
+    const Point3f* tps0;
+    double sigma;
+    int stripesCount;
+    double* stripeSums;
+};
+
+template<typename EquationCoeffs>
+static
+double calcICPLsmMatricesImpl(const Mat& cloud0, const Mat& Rt,
+                            const Mat& cloud1, const Mat& normals1,
+                            const Mat& corresps,
+                            Mat& AtA, Mat& AtB, LsmBuffers& buffers)
+{
+    const int dim = EquationCoeffs::dim;
+    const int correspsCount = corresps.rows;
+
+    CV_Assert(Rt.type() == CV_64FC1);
+    const double * Rt_ptr = Rt.ptr<const double>();
+
+    const int stripesCount = getLsmStripesCount(correspsCount);
+
+    buffers.diffs.resize(correspsCount);
+    buffers.transformedPoints0.resize(correspsCount);
+    buffers.stripeSigmas.resize(stripesCount);
+    float* diffs = &buffers.diffs[0];
+    Point3f* transformedPoints0 = &buffers.transformedPoints0[0];
+    double* stripeSigmas = &buffers.stripeSigmas[0];
+    parallel_for_(Range(0, stripesCount),
+                  ICPDiffsInvoker(cloud0, Rt_ptr, cloud1, normals1, corresps, stripesCount,
+                                  diffs, transformedPoints0, stripeSigmas));
+
+    double sigma = 0;
+    for(int stripe = 0; stripe < stripesCount; stripe++)
+        sigma += stripeSigmas[stripe];
+    sigma = std::sqrt(sigma/correspsCount);
+
+    std::vector<double>& stripeSums = buffers.stripeSums;
+    stripeSums.resize(stripesCount * (dim * dim + dim));
+    parallel_for_(Range(0, stripesCount),
+                  ICPLsmInvoker<EquationCoeffs>(normals1, corresps, diffs, transformedPoints0, sigma,
+                                                stripesCount, &stripeSums[0]));
+
+    sumLsmStripes<dim>(stripeSums, stripesCount, AtA, AtB);
+
+    return sigma;
+}
+
+/** Computes the normal equations of the point-to-plane error, returns the standard deviation of the residuals */
+static
+double calcICPLsmMatrices(const Mat& cloud0, const Mat& Rt,
+                        const Mat& cloud1, const Mat& normals1,
+                        const Mat& corresps,
+                        Mat& AtA, Mat& AtB, int transformType, LsmBuffers& buffers)
+{
+    switch(transformType)
+    {
+    case Odometry::RIGID_BODY_MOTION:
+        return calcICPLsmMatricesImpl<ICPEquationCoeffsRigidBodyMotion>(cloud0, Rt, cloud1, normals1, corresps, AtA, AtB, buffers);
+    case Odometry::ROTATION:
+        return calcICPLsmMatricesImpl<ICPEquationCoeffsRotation>(cloud0, Rt, cloud1, normals1, corresps, AtA, AtB, buffers);
+    case Odometry::TRANSLATION:
+        return calcICPLsmMatricesImpl<ICPEquationCoeffsTranslation>(cloud0, Rt, cloud1, normals1, corresps, AtA, AtB, buffers);
+    default:
+        CV_Error(CV_StsBadArg, "Incorrect transformation type");
+    }
+    return 0.;
+}
+
+static inline
+double getElapsedMicroseconds(int64 startTicks)
+{
+    return (getTickCount() - startTicks) * 1e6 / getTickFrequency();
+}
+
+static
+bool solveSystem(const Mat& AtA, const Mat& AtB, double detThreshold, Mat& x)
+{
+    double det = cv::determinant(AtA);
+
+    if(fabs (det) < detThreshold || cvIsNaN(det) || cvIsInf(det))
+        return false;
 
     cv::solve(AtA, AtB, x, DECOMP_CHOLESKY);
 
     return true;
 }
 
+/** Tests if the relative change of the standard deviation of the residuals is less than minChange,
+ * a negative sigma means that the system was not computed
+ */
+static inline
+bool isResidualChangeSmall(double prevSigma, double sigma, double minChange)
+{
+    if(prevSigma < 0 || sigma < 0)
+        return prevSigma == sigma;
+    return std::abs(sigma - prevSigma) <= minChange * prevSigma;
+}
+
 static 
 bool testDeltaTransformation(const Mat& deltaRt, double maxTranslation, double maxRotation)
 {
@@ -815,28 +1569,22 @@ bool RGBDICPOdometryImpl(Mat& Rt, const Mat& initRt,
                          const Ptr<OdometryFrame>& dstFrame,
                          const cv::Mat& cameraMatrix,
                          float maxDepthDiff, const std::vector<int>& iterCounts,
-                         double maxTranslation, double maxRotation,
-                         int method, int transfromType)
+                         double maxTranslation, double maxRotation, double minIncrement, double minResidualChange,
+                         int method, int transfromType, OdometryWorkspace::Buffers* workspaceBuffers,
+                         OdometryStats* stats)
 {
+    OdometryWorkspace::Buffers localBuffers;
+    OdometryWorkspace::Buffers& buffers = workspaceBuffers ? *workspaceBuffers : localBuffers;
+
     int transformDim = -1;
-    CalcRgbdEquationCoeffsPtr rgbdEquationFuncPtr = 0;
-    CalcICPEquationCoeffsPtr icpEquationFuncPtr = 0;
     switch(transfromType)
     {
     case Odometry::RIGID_BODY_MOTION:
         transformDim = 6;
-        rgbdEquationFuncPtr = calcRgbdEquationCoeffs;
-        icpEquationFuncPtr = calcICPEquationCoeffs;
         break;
     case Odometry::ROTATION:
-        transformDim = 3;
-        rgbdEquationFuncPtr = calcRgbdEquationCoeffsRotation;
-        icpEquationFuncPtr = calcICPEquationCoeffsRotation;
-        break;
     case Odometry::TRANSLATION:
         transformDim = 3;
-        rgbdEquationFuncPtr = calcRgbdEquationCoeffsTranslation;
-        icpEquationFuncPtr = calcICPEquationCoeffsTranslation;
         break;
     default:
         CV_Error(CV_StsBadArg, "Incorrect transformation type");
@@ -851,9 +1599,14 @@ bool RGBDICPOdometryImpl(Mat& Rt, const Mat& initRt,
     Mat resultRt = initRt.empty() ? Mat::eye(4,4,CV_64FC1) : initRt.clone();
     Mat currRt, ksi;
 
+    if(stats)
+        stats->levels.assign(iterCounts.size(), OdometryStats::Level());
+
     bool isOk = false;
     for(int level = iterCounts.size() - 1; level >= 0; level--)
     {
+        OdometryStats::Level* levelStats = stats ? &stats->levels[level] : 0;
+
         const Mat& levelCameraMatrix = pyramidCameraMatrix[level];
         const Mat& levelCameraMatrix_inv = levelCameraMatrix.inv(DECOMP_SVD);
         const Mat& srcLevelDepth = srcFrame->pyramidDepth[level];
@@ -865,48 +1618,89 @@ bool RGBDICPOdometryImpl(Mat& Rt, const Mat& initRt,
 
         Mat AtA_rgbd, AtB_rgbd, AtA_icp, AtB_icp;
         Mat corresps_rgbd, corresps_icp;
+        double prevSigma_rgbd = -1, prevSigma_icp = -1;
+
+        // The selected pixels of the dst frame are the same for all the iterations of the level
+        if(method & RGBD_ODOMETRY)
+            buildSelectedPixels(dstFrame->pyramidTexturedMask[level], buffers.rgbdCorresps.selectedPixels);
+        if(method & ICP_ODOMETRY)
+            buildSelectedPixels(dstFrame->pyramidNormalsMask[level], buffers.icpCorresps.selectedPixels);
 
         // Run transformation search on current level iteratively.
         for(int iter = 0; iter < iterCounts[level]; iter ++)
         {
             Mat resultRt_inv = resultRt.inv(DECOMP_SVD);
 
+            int64 startTicks = getTickCount();
             if(method & RGBD_ODOMETRY)
                 computeCorresps(levelCameraMatrix, levelCameraMatrix_inv, resultRt_inv,
-                                srcLevelDepth, srcFrame->pyramidMask[level], dstLevelDepth, dstFrame->pyramidTexturedMask[level],
-                                maxDepthDiff, corresps_rgbd);
+                                srcLevelDepth, srcFrame->pyramidMask[level], dstLevelDepth, buffers.rgbdCorresps.selectedPixels,
+                                maxDepthDiff, corresps_rgbd, buffers.rgbdCorresps);
 
             if(method & ICP_ODOMETRY)
                 computeCorresps(levelCameraMatrix, levelCameraMatrix_inv, resultRt_inv,
-                                srcLevelDepth, srcFrame->pyramidMask[level], dstLevelDepth, dstFrame->pyramidNormalsMask[level],
-                                maxDepthDiff, corresps_icp);
+                                srcLevelDepth, srcFrame->pyramidMask[level], dstLevelDepth, buffers.icpCorresps.selectedPixels,
+                                maxDepthDiff, corresps_icp, buffers.icpCorresps);
+            if(stats)
+                stats->correspsTime += getElapsedMicroseconds(startTicks);
+
+            if(levelStats)
+            {
+                if(method & RGBD_ODOMETRY)
+                    levelStats->rgbdCorrespsCounts.push_back(corresps_rgbd.rows);
+                if(method & ICP_ODOMETRY)
+                    levelStats->icpCorrespsCounts.push_back(corresps_icp.rows);
+            }
 
             if(corresps_rgbd.rows < minCorrespsCount && corresps_icp.rows < minCorrespsCount)
+            {
+                if(levelStats)
+                    levelStats->stopReason = OdometryStats::STOP_CORRESPS;
                 break;
+            }
 
+            startTicks = getTickCount();
             Mat AtA(transformDim, transformDim, CV_64FC1, Scalar(0)), AtB(transformDim, 1, CV_64FC1, Scalar(0));
+            double sigma_rgbd = -1, sigma_icp = -1;
             if(corresps_rgbd.rows >= minCorrespsCount)
             {
-                calcRgbdLsmMatrices(srcFrame->pyramidImage[level], srcFrame->pyramidCloud[level], resultRt,
-                                    dstFrame->pyramidImage[level], dstFrame->pyramid_dI_dx[level], dstFrame->pyramid_dI_dy[level],
-                                    corresps_rgbd, fx, fy, sobelScale,
-                                    AtA_rgbd, AtB_rgbd, rgbdEquationFuncPtr, transformDim);
+                sigma_rgbd = calcRgbdLsmMatrices(srcFrame->pyramidImage[level], srcFrame->pyramidCloud[level], resultRt,
+                                                 dstFrame->pyramidImage[level], dstFrame->pyramid_dI_dx[level], dstFrame->pyramid_dI_dy[level],
+                                                 corresps_rgbd, fx, fy, sobelScale,
+                                                 AtA_rgbd, AtB_rgbd, transfromType, buffers.lsm);
 
                 AtA += AtA_rgbd;
                 AtB += AtB_rgbd;
             }
             if(corresps_icp.rows >= minCorrespsCount)
             {
-                calcICPLsmMatrices(srcFrame->pyramidCloud[level], resultRt,
-                                   dstFrame->pyramidCloud[level], dstFrame->pyramidNormals[level],
-                                   corresps_icp, AtA_icp, AtB_icp, icpEquationFuncPtr, transformDim);
+                sigma_icp = calcICPLsmMatrices(srcFrame->pyramidCloud[level], resultRt,
+                                               dstFrame->pyramidCloud[level], dstFrame->pyramidNormals[level],
+                                               corresps_icp, AtA_icp, AtB_icp, transfromType, buffers.lsm);
                 AtA += AtA_icp;
                 AtB += AtB_icp;
             }
+            if(stats)
+                stats->lsmTime += getElapsedMicroseconds(startTicks);
 
+            if(levelStats)
+            {
+                if(method & RGBD_ODOMETRY)
+                    levelStats->rgbdSigmas.push_back(sigma_rgbd);
+                if(method & ICP_ODOMETRY)
+                    levelStats->icpSigmas.push_back(sigma_icp);
+            }
+
+            startTicks = getTickCount();
             bool solutionExist = solveSystem(AtA, AtB, determinantThreshold, ksi);
+            if(stats)
+                stats->solveTime += getElapsedMicroseconds(startTicks);
             if(!solutionExist)
+            {
+                if(levelStats)
+                    levelStats->stopReason = OdometryStats::STOP_SOLVE;
                 break;
+            }
 
             if(transfromType == Odometry::ROTATION)
             {
@@ -924,6 +1718,23 @@ bool RGBDICPOdometryImpl(Mat& Rt, const Mat& initRt,
             computeProjectiveMatrix(ksi, currRt);
             resultRt = currRt * resultRt;
             isOk = true;
+
+            if(levelStats)
+                levelStats->iterations++;
+
+            // The level has converged if the pose increment or the change of the residuals is small enough
+            bool isConverged = norm(ksi) < minIncrement;
+            if(!isConverged && minResidualChange > 0 && iter > 0)
+                isConverged = isResidualChangeSmall(prevSigma_rgbd, sigma_rgbd, minResidualChange) &&
+                              isResidualChangeSmall(prevSigma_icp, sigma_icp, minResidualChange);
+            prevSigma_rgbd = sigma_rgbd;
+            prevSigma_icp = sigma_icp;
+            if(isConverged)
+            {
+                if(levelStats)
+                    levelStats->stopReason = OdometryStats::STOP_CONVERGED;
+                break;
+            }
         }
     }
     
@@ -943,6 +1754,143 @@ bool RGBDICPOdometryImpl(Mat& Rt, const Mat& initRt,
     return isOk;
 }
 
+/** Projects the pixels of some rows of a frame to the frame moved by Rt, without distortion. Every pixel gets the
+ * index of the pixel it lands on (-1 if it is masked, behind the camera or out of the image) and its new depth.
+ * The range of destination rows every source row lands on is also kept for the splatting.
+ */
+class WarpProjectInvoker : public ParallelLoopBody
+{
+public:
+    WarpProjectInvoker(const Mat& _depth, const Mat& _mask, const Matx33d& _K, const Matx44d& _Rt,
+                       Mat& _indices, Mat& _transformedDepth, int* _dstRowMin, int* _dstRowMax) :
+        depth(_depth), mask(_mask), K(_K), Rt(_Rt), indices(_indices), transformedDepth(_transformedDepth),
+        dstRowMin(_dstRowMin), dstRowMax(_dstRowMax)
+    {}
+
+    virtual void operator()(const Range& range) const
+    {
+        const int rows = depth.rows, cols = depth.cols;
+        const double fx = K(0,0), fy = K(1,1), cx = K(0,2), cy = K(1,2);
+        const double inv_fx = 1. / fx, inv_fy = 1. / fy;
+
+        for(int y = range.start; y < range.end; y++)
+        {
+            const float* depth_row = depth.ptr<float>(y);
+            const uchar* mask_row = mask.empty() ? 0 : mask.ptr<uchar>(y);
+            int* indices_row = indices.ptr<int>(y);
+            float* transformedDepth_row = transformedDepth.ptr<float>(y);
+            const double y_factor = (y - cy) * inv_fy;
+            int rowMin = rows, rowMax = -1;
+            for(int x = 0; x < cols; x++)
+            {
+                indices_row[x] = -1;
+                if(mask_row && !mask_row[x])
+                    continue;
+
+                // Same point as depthTo3d, moved by Rt and projected as projectPoints does
+                const double z = depth_row[x];
+                const double px = (x - cx) * inv_fx * z, py = y_factor * z;
+                const double tz = Rt(2,0) * px + Rt(2,1) * py + Rt(2,2) * z + Rt(2,3);
+                const float transformed_z = static_cast<float>(tz);
+                if(!(transformed_z > 0))
+                    continue;
+
+                const double inv_tz = 1. / tz;
+                const double u = fx * (Rt(0,0) * px + Rt(0,1) * py + Rt(0,2) * z + Rt(0,3)) * inv_tz + cx;
+                const double v = fy * (Rt(1,0) * px + Rt(1,1) * py + Rt(1,2) * z + Rt(1,3)) * inv_tz + cy;
+                if(!(u > -1 && u < cols && v > -1 && v < rows))
+                    continue;
+                const int u_dst = cvRound(u), v_dst = cvRound(v);
+                if(u_dst < 0 || u_dst >= cols || v_dst < 0 || v_dst >= rows)
+                    continue;
+
+                indices_row[x] = v_dst * cols + u_dst;
+                transformedDepth_row[x] = transformed_z;
+                rowMin = std::min(rowMin, v_dst);
+                rowMax = std::max(rowMax, v_dst);
+            }
+            dstRowMin[y] = rowMin;
+            dstRowMax[y] = rowMax;
+        }
+    }
+
+private:
+    WarpProjectInvoker& operator=(const WarpProjectInvoker&);
+
+    const Mat& depth;
+    const Mat& mask;
+    Matx33d K;
+    Matx44d Rt;
+    Mat& indices;
+    Mat& transformedDepth;
+    int* dstRowMin;
+    int* dstRowMax;
+};
+
+/** Splats the projected pixels of a frame into stripes of destination rows with a z-buffer. Every stripe goes
+ * over the source rows landing on it in the same order as a serial splatting, so that the nearest pixel wins and
+ * the first one wins the ties whatever the number of threads.
+ */
+template<class ImageElemType>
+class WarpSplatInvoker : public ParallelLoopBody
+{
+public:
+    WarpSplatInvoker(const Mat& _image, const Mat& _indices, const Mat& _transformedDepth,
+                     const int* _dstRowMin, const int* _dstRowMax, int _rowsPerStripe,
+                     Mat& _warpedImage, Mat& _zBuffer) :
+        image(_image), indices(_indices), transformedDepth(_transformedDepth),
+        dstRowMin(_dstRowMin), dstRowMax(_dstRowMax), rowsPerStripe(_rowsPerStripe),
+        warpedImage(_warpedImage), zBuffer(_zBuffer)
+    {}
+
+    virtual void operator()(const Range& range) const
+    {
+        const int rows = image.rows, cols = image.cols;
+        for(int stripe = range.start; stripe < range.end; stripe++)
+        {
+            const int dstRowStart = stripe * rowsPerStripe,
+                      dstRowEnd = std::min(dstRowStart + rowsPerStripe, rows);
+            const int indexStart = dstRowStart * cols, indexEnd = dstRowEnd * cols;
+
+            for(int y = 0; y < rows; y++)
+            {
+                if(dstRowMax[y] < dstRowStart || dstRowMin[y] >= dstRowEnd)
+                    continue;
+
+                const int* indices_row = indices.ptr<int>(y);
+                const float* transformedDepth_row = transformedDepth.ptr<float>(y);
+                const ImageElemType* image_row = image.ptr<ImageElemType>(y);
+                for(int x = 0; x < cols; x++)
+                {
+                    const int index = indices_row[x];
+                    if(index < indexStart || index >= indexEnd)
+                        continue;
+
+                    const int v_dst = index / cols, u_dst = index - v_dst * cols;
+                    float& z = zBuffer.ptr<float>(v_dst)[u_dst];
+                    if(z > transformedDepth_row[x])
+                    {
+                        warpedImage.ptr<ImageElemType>(v_dst)[u_dst] = image_row[x];
+                        z = transformedDepth_row[x];
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    WarpSplatInvoker& operator=(const WarpSplatInvoker&);
+
+    const Mat& image;
+    const Mat& indices;
+    const Mat& transformedDepth;
+    const int* dstRowMin;
+    const int* dstRowMax;
+    int rowsPerStripe;
+    Mat& warpedImage;
+    Mat& zBuffer;
+};
+
 template<class ImageElemType>
 static void
 warpFrameImpl(const cv::Mat& image, const Mat& depth, const Mat& mask,
@@ -950,52 +1898,171 @@ warpFrameImpl(const cv::Mat& image, const Mat& depth, const Mat& mask,
               Mat& warpedImage, Mat* warpedDepth, Mat* warpedMask)
 {
     CV_Assert(image.size() == depth.size());
-    
-    Mat cloud;
-    depthTo3d(depth, cameraMatrix, cloud);
-    
-    std::vector<Point2f> points2d;
-    Mat transformedCloud;
-    perspectiveTransform(cloud, transformedCloud, Rt);
-    projectPoints(transformedCloud.reshape(3, 1), Mat::eye(3, 3, CV_64FC1), Mat::zeros(3, 1, CV_64FC1), cameraMatrix,
-                distCoeff, points2d);
+    CV_Assert(Rt.size() == Size(4,4) && cameraMatrix.size() == Size(3,3));
 
-    warpedImage = Mat(image.size(), image.type(), Scalar::all(0));
+    // Where every pixel lands and its depth there
+    Mat indices(image.size(), CV_32SC1), transformedDepth(image.size(), CV_32FC1);
+    std::vector<int> dstRowMin(image.rows), dstRowMax(image.rows);
 
-    Mat zBuffer(image.size(), CV_32FC1, std::numeric_limits<float>::max());
-    const Rect rect = Rect(0, 0, image.cols, image.rows);
-    
-    for (int y = 0; y < image.rows; y++)
-    {
-        //const Point3f* cloud_row = cloud.ptr<Point3f>(y);
-        const Point3f* transformedCloud_row = transformedCloud.ptr<Point3f>(y);
-        const Point2f* points2d_row = &points2d[y*image.cols];
-        const ImageElemType* image_row = image.ptr<ImageElemType>(y);
-        const uchar* mask_row = mask.empty() ? 0 : mask.ptr<uchar>(y);
-        for (int x = 0; x < image.cols; x++)
+    if(distCoeff.empty() || countNonZero(distCoeff.reshape(1)) == 0)
+    {
+        // Project the pixels directly, without any intermediate cloud
+        Mat depthFloat = depth;
+        if(depth.type() != CV_32FC1)
+            rescaleDepth(depth, CV_32F, depthFloat);
+        Matx33d K;
+        Matx44d Rt_d;
+        cameraMatrix.convertTo(K, CV_64F);
+        Rt.convertTo(Rt_d, CV_64F);
+        parallel_for_(Range(0, image.rows),
+                      WarpProjectInvoker(depthFloat, mask, K, Rt_d, indices, transformedDepth, &dstRowMin[0],
+                                         &dstRowMax[0]));
+    }
+    else
+    {
+        // The distortion needs projectPoints
+        Mat cloud;
+        depthTo3d(depth, cameraMatrix, cloud);
+        if(cloud.depth() != CV_32F)
+            cloud.convertTo(cloud, CV_32F);
+
+        std::vector<Point2f> points2d;
+        Mat transformedCloud;
+        perspectiveTransform(cloud, transformedCloud, Rt);
+        projectPoints(transformedCloud.reshape(3, 1), Mat::eye(3, 3, CV_64FC1), Mat::zeros(3, 1, CV_64FC1), cameraMatrix,
+                    distCoeff, points2d);
+
+        const Rect rect = Rect(0, 0, image.cols, image.rows);
+        for (int y = 0; y < image.rows; y++)
         {
-            const float transformed_z = transformedCloud_row[x].z;
-            const Point2i p2d = points2d_row[x];
-            if((!mask_row || mask_row[x]) && transformed_z > 0 && rect.contains(p2d) && /*!cvIsNaN(cloud_row[x].z) && */zBuffer.at<float>(p2d) > transformed_z)
+            const Point3f* transformedCloud_row = transformedCloud.ptr<Point3f>(y);
+            const Point2f* points2d_row = &points2d[y*image.cols];
+            const uchar* mask_row = mask.empty() ? 0 : mask.ptr<uchar>(y);
+            int* indices_row = indices.ptr<int>(y);
+            float* transformedDepth_row = transformedDepth.ptr<float>(y);
+            dstRowMin[y] = image.rows;
+            dstRowMax[y] = -1;
+            for (int x = 0; x < image.cols; x++)
             {
-                warpedImage.at<ImageElemType>(p2d) = image_row[x];
-                zBuffer.at<float>(p2d) = transformed_z;
+                const float transformed_z = transformedCloud_row[x].z;
+                indices_row[x] = -1;
+                if(!((!mask_row || mask_row[x]) && transformed_z > 0))
+                    continue;
+                const Point2i p2d = points2d_row[x];
+                if(!rect.contains(p2d))
+                    continue;
+                indices_row[x] = p2d.y * image.cols + p2d.x;
+                transformedDepth_row[x] = transformed_z;
+                dstRowMin[y] = std::min(dstRowMin[y], p2d.y);
+                dstRowMax[y] = std::max(dstRowMax[y], p2d.y);
             }
         }
     }
 
-    if(warpedMask)
-        *warpedMask = zBuffer != std::numeric_limits<float>::max();
+    // Splat with a z-buffer, the warped depth being the z-buffer itself when it is asked for
+    if(warpedImage.data == image.data)
+        warpedImage.release();
+    warpedImage.create(image.size(), image.type());
+    warpedImage.setTo(Scalar::all(0));
 
+    Mat zBuffer;
     if(warpedDepth)
     {
-        zBuffer.setTo(std::numeric_limits<float>::quiet_NaN(), zBuffer == std::numeric_limits<float>::max());
-        *warpedDepth = zBuffer;
+        warpedDepth->create(image.size(), CV_32FC1);
+        zBuffer = *warpedDepth;
     }
+    else
+        zBuffer.create(image.size(), CV_32FC1);
+    zBuffer.setTo(std::numeric_limits<float>::max());
+
+    const int rowsPerStripe = 16;
+    const int stripesCount = (image.rows + rowsPerStripe - 1) / rowsPerStripe;
+    parallel_for_(Range(0, stripesCount),
+                  WarpSplatInvoker<ImageElemType>(image, indices, transformedDepth, &dstRowMin[0], &dstRowMax[0],
+                                                  rowsPerStripe, warpedImage, zBuffer));
+
+    if(warpedMask)
+        compare(zBuffer, std::numeric_limits<float>::max(), *warpedMask, CMP_NE);
+
+    if(warpedDepth)
+        zBuffer.setTo(std::numeric_limits<float>::quiet_NaN(), zBuffer == std::numeric_limits<float>::max());
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
+/** Prepares the caches of a frame of a sequence for both roles. The frame has to be read-only afterwards,
+ * as it is registered concurrently with its previous and its next frames: the mask is set from the pyramid
+ * here, otherwise both prepareFrameCache calls of the registrations would assign it.
+ */
+static
+void prepareSequenceFrame(const Odometry& odometry, Ptr<OdometryFrame>& frame)
+{
+    odometry.prepareFrameCache(frame, OdometryFrame::CACHE_ALL);
+    if(frame->mask.empty() && !frame->pyramidMask.empty())
+        frame->mask = frame->pyramidMask[0];
+}
+
+/** Gives the pyramids of a registered frame of a sequence to the workspace. The frame keeps its own data, except
+ * the mask taken from its pyramid that the next prepared frames would overwrite.
+ */
+static
+void recycleSequencePyramids(OdometryWorkspace& workspace, OdometryFrame& frame)
+{
+    if(!frame.pyramidMask.empty() && frame.mask.data == frame.pyramidMask[0].data)
+        frame.mask.release();
+
+    Ptr<OdometryFrame> pyramids(new OdometryFrame());
+    pyramids->pyramidImage.swap(frame.pyramidImage);
+    pyramids->pyramidDepth.swap(frame.pyramidDepth);
+    pyramids->pyramidMask.swap(frame.pyramidMask);
+    pyramids->pyramidCloud.swap(frame.pyramidCloud);
+    pyramids->pyramid_dI_dx.swap(frame.pyramid_dI_dx);
+    pyramids->pyramid_dI_dy.swap(frame.pyramid_dI_dy);
+    pyramids->pyramidTexturedMask.swap(frame.pyramidTexturedMask);
+    pyramids->pyramidNormals.swap(frame.pyramidNormals);
+    pyramids->pyramidNormalsMask.swap(frame.pyramidNormalsMask);
+    workspace.recycleFrame(pyramids);
+}
+
+/** Runs the registrations of some pairs of consecutive frames of a sequence together with the cache preparation
+ * of the next frames. The tasks are the registrations first (the index of the destination frame of a pair being
+ * in pairs), then the preparations (the index of a frame being in preparedFrames).
+ */
+class SequenceInvoker : public ParallelLoopBody
+{
+public:
+    SequenceInvoker(const Odometry& _odometry, std::vector<Ptr<OdometryFrame> >& _frames,
+                    const Range& _pairs, const Range& _preparedFrames, std::vector<Mat>& _Rts,
+                    std::vector<uchar>& _isComputed) :
+        odometry(_odometry), frames(_frames), pairs(_pairs), preparedFrames(_preparedFrames), Rts(_Rts),
+        isComputed(_isComputed)
+    {}
+
+    virtual void operator()(const Range& range) const
+    {
+        for(int task = range.start; task < range.end; task++)
+        {
+            if(task < pairs.size())
+            {
+                // Both frames were completed by prepareSequenceFrame, compute only checks their caches
+                const int i = pairs.start + task;
+                isComputed[i] = odometry.compute(frames[i-1], frames[i], Rts[i]);
+            }
+            else
+                prepareSequenceFrame(odometry, frames[preparedFrames.start + task - pairs.size()]);
+        }
+    }
+
+private:
+    SequenceInvoker& operator=(const SequenceInvoker&);
+
+    const Odometry& odometry;
+    std::vector<Ptr<OdometryFrame> >& frames;
+    Range pairs, preparedFrames;
+    std::vector<Mat>& Rts;
+    std::vector<uchar>& isComputed;
+};
+
 namespace cv
 {
 
@@ -1047,6 +2114,77 @@ void OdometryFrame::releasePyramids()
     pyramidNormalsMask.clear();
 }
 
+OdometryStats::Level::Level() :
+    iterations(0), stopReason(STOP_ITERATIONS)
+{}
+
+OdometryStats::OdometryStats()
+{
+    reset();
+}
+
+void OdometryStats::reset()
+{
+    levels.clear();
+    prepareSrcTime = prepareDstTime = 0;
+    correspsTime = lsmTime = solveTime = 0;
+    totalTime = 0;
+}
+
+OdometryWorkspace::OdometryWorkspace() : buffers_(new Buffers)
+{}
+
+OdometryWorkspace::~OdometryWorkspace()
+{
+    delete buffers_;
+}
+
+static inline
+void recyclePyramid(std::vector<Mat>& pyramid, std::vector<std::vector<Mat> >& recycled)
+{
+    // src and dst frames are prepared at the same time, a couple more pyramids are kept for the stream of frames
+    const size_t maxRecycledCount = 4;
+    if(!pyramid.empty() && recycled.size() < maxRecycledCount)
+    {
+        recycled.push_back(std::vector<Mat>());
+        recycled.back().swap(pyramid);
+    }
+}
+
+void OdometryWorkspace::recycleFrame(Ptr<OdometryFrame>& frame)
+{
+    if(frame.empty())
+        return;
+
+    // The first levels of the image and depth pyramids share the data of the user
+    if(!frame->pyramidImage.empty())
+        frame->pyramidImage[0].release();
+    if(!frame->pyramidDepth.empty())
+        frame->pyramidDepth[0].release();
+    // The normals are kept apart because they are computed at full resolution by RgbdNormals
+    if(!frame->pyramidNormals.empty())
+        frame->pyramidNormals[0].release();
+    if(!frame->normals.empty() && buffers_->recycledNormals.size() < 4)
+        buffers_->recycledNormals.push_back(frame->normals);
+
+    recyclePyramid(frame->pyramidImage, buffers_->recycledPyramids[Buffers::PYRAMID_IMAGE]);
+    recyclePyramid(frame->pyramidDepth, buffers_->recycledPyramids[Buffers::PYRAMID_DEPTH]);
+    recyclePyramid(frame->pyramidMask, buffers_->recycledPyramids[Buffers::PYRAMID_MASK]);
+    recyclePyramid(frame->pyramidCloud, buffers_->recycledPyramids[Buffers::PYRAMID_CLOUD]);
+    recyclePyramid(frame->pyramid_dI_dx, buffers_->recycledPyramids[Buffers::PYRAMID_DI_DX]);
+    recyclePyramid(frame->pyramid_dI_dy, buffers_->recycledPyramids[Buffers::PYRAMID_DI_DY]);
+    recyclePyramid(frame->pyramidTexturedMask, buffers_->recycledPyramids[Buffers::PYRAMID_TEXTURED_MASK]);
+    recyclePyramid(frame->pyramidNormals, buffers_->recycledPyramids[Buffers::PYRAMID_NORMALS]);
+    recyclePyramid(frame->pyramidNormalsMask, buffers_->recycledPyramids[Buffers::PYRAMID_NORMALS_MASK]);
+
+    frame->release();
+}
+
+void OdometryWorkspace::release()
+{
+    *buffers_ = Buffers();
+}
+
 bool Odometry::compute(const Mat& srcImage, const Mat& srcDepth, const Mat& srcMask,
                        const Mat& dstImage, const Mat& dstDepth, const Mat& dstMask,
                        Mat& Rt, const Mat& initRt) const
@@ -1054,20 +2192,118 @@ bool Odometry::compute(const Mat& srcImage, const Mat& srcDepth, const Mat& srcM
     Ptr<OdometryFrame> srcFrame(new OdometryFrame(srcImage, srcDepth, srcMask));
     Ptr<OdometryFrame> dstFrame(new OdometryFrame(dstImage, dstDepth, dstMask));
 
-    return compute(srcFrame, dstFrame, Rt, initRt);
+    bool isOk = compute(srcFrame, dstFrame, Rt, initRt);
+
+    // The frames were created here, so their buffers can be reused by the next call
+    if(!workspace.empty())
+    {
+        workspace->recycleFrame(srcFrame);
+        workspace->recycleFrame(dstFrame);
+    }
+
+    return isOk;
 }
 
 bool Odometry::compute(Ptr<OdometryFrame>& srcFrame, Ptr<OdometryFrame>& dstFrame, Mat& Rt, const Mat& initRt) const
 {
     checkParams();
 
+    const int64 startTicks = getTickCount();
+    if(!stats.empty())
+        stats->reset();
+
     Size srcSize = prepareFrameCache(srcFrame, OdometryFrame::CACHE_SRC);
+    const int64 srcPreparedTicks = getTickCount();
     Size dstSize = prepareFrameCache(dstFrame, OdometryFrame::CACHE_DST);
+    const int64 dstPreparedTicks = getTickCount();
 
     if(srcSize != dstSize)
         CV_Error(CV_StsBadSize, "srcFrame and dstFrame have to have the same size (resolution).");
 
-    return computeImpl(srcFrame, dstFrame, Rt, initRt);
+    bool isOk = computeImpl(srcFrame, dstFrame, Rt, initRt);
+
+    if(!stats.empty())
+    {
+        const double ticksToMicroseconds = 1e6 / getTickFrequency();
+        stats->prepareSrcTime = (srcPreparedTicks - startTicks) * ticksToMicroseconds;
+        stats->prepareDstTime = (dstPreparedTicks - srcPreparedTicks) * ticksToMicroseconds;
+        stats->totalTime = (getTickCount() - startTicks) * ticksToMicroseconds;
+    }
+
+    return isOk;
+}
+
+bool Odometry::computeSequence(std::vector<Ptr<OdometryFrame> >& frames, std::vector<Mat>& poses) const
+{
+    checkParams();
+
+    const int framesCount = static_cast<int>(frames.size());
+    for(int i = 0; i < framesCount; i++)
+    {
+        if(frames[i].empty())
+            CV_Error(CV_StsBadArg, "Null frame pointer.");
+        // The frames share the normals computer of the odometry, that can not be created again concurrently
+        if(!frames[i]->depth.empty() && !frames[0]->depth.empty() && frames[i]->depth.size() != frames[0]->depth.size())
+            CV_Error(CV_StsBadSize, "The frames of the sequence have to have the same size (resolution).");
+    }
+
+    poses.resize(framesCount);
+    if(framesCount == 0)
+        return true;
+    poses[0] = Mat::eye(4, 4, CV_64FC1);
+
+    std::vector<Mat> Rts(framesCount);
+    std::vector<uchar> isComputed(framesCount, 0);
+
+    if(!workspace.empty() || !stats.empty())
+    {
+        // The frames are prepared as the destination frames, then completed as the source frames by the next call
+        for(int i = 1; i < framesCount; i++)
+        {
+            isComputed[i] = compute(frames[i-1], frames[i], Rts[i]);
+            if(!workspace.empty())
+                recycleSequencePyramids(*workspace, *frames[i-1]);
+            else
+                frames[i-1]->releasePyramids();
+        }
+    }
+    else
+    {
+        // The first frame creates the shared data of the odometry (e.g. the normals computer) for the other ones
+        prepareSequenceFrame(*this, frames[0]);
+
+        const int batchSize = std::max(2 * getNumThreads(), 2);
+        // The pairs whose destination frames are in [pairsStart, preparedEnd) are ready to be registered
+        int pairsStart = 1, preparedEnd = 1;
+        while(pairsStart < framesCount)
+        {
+            const Range pairs(pairsStart, preparedEnd);
+            const Range preparedFrames(preparedEnd, std::min(preparedEnd + batchSize, framesCount));
+            parallel_for_(Range(0, pairs.size() + preparedFrames.size()),
+                          SequenceInvoker(*this, frames, pairs, preparedFrames, Rts, isComputed));
+
+            // The source frames of the registered pairs are not needed any more
+            for(int i = pairs.start; i < pairs.end; i++)
+                frames[i-1]->releasePyramids();
+
+            pairsStart = pairs.end;
+            preparedEnd = preparedFrames.end;
+        }
+    }
+
+    bool isOk = true;
+    for(int i = 1; i < framesCount; i++)
+    {
+        if(isComputed[i])
+            poses[i] = poses[i-1] * Rts[i].inv(DECOMP_SVD);
+        else
+        {
+            poses[i] = poses[i-1].clone();
+            isOk = false;
+        }
+    }
+
+    return isOk;
 }
 
 Size Odometry::prepareFrameCache(Ptr<OdometryFrame> &frame, int /*cacheType*/) const
@@ -1078,6 +2314,26 @@ Size Odometry::prepareFrameCache(Ptr<OdometryFrame> &frame, int /*cacheType*/) c
     return Size();
 }
 
+void Odometry::setStats(const Ptr<OdometryStats>& _stats)
+{
+    stats = _stats;
+}
+
+Ptr<OdometryStats> Odometry::getStats() const
+{
+    return stats;
+}
+
+void Odometry::setWorkspace(const Ptr<OdometryWorkspace>& _workspace)
+{
+    workspace = _workspace;
+}
+
+Ptr<OdometryWorkspace> Odometry::getWorkspace() const
+{
+    return workspace;
+}
+
 //
 RgbdOdometry::RgbdOdometry() :
     minDepth(DEFAULT_MIN_DEPTH()),
@@ -1086,7 +2342,8 @@ RgbdOdometry::RgbdOdometry() :
     maxPointsPart(DEFAULT_MAX_POINTS_PART()),
     transformType(Odometry::RIGID_BODY_MOTION),
     maxTranslation(DEFAULT_MAX_TRANSLATION()),
-    maxRotation(DEFAULT_MAX_ROTATION())
+    maxRotation(DEFAULT_MAX_ROTATION()),
+    minIncrement(DEFAULT_MIN_INCREMENT()), minResidualChange(DEFAULT_MIN_RESIDUAL_CHANGE())
 
 {
     setDefaultIterCounts(iterCounts);
@@ -1104,7 +2361,8 @@ RgbdOdometry::RgbdOdometry(const Mat& _cameraMatrix,
                            minGradientMagnitudes(Mat(_minGradientMagnitudes).clone()),
                            maxPointsPart(_maxPointsPart),
                            cameraMatrix(_cameraMatrix), transformType(_transformType),
-                           maxTranslation(DEFAULT_MAX_TRANSLATION()), maxRotation(DEFAULT_MAX_ROTATION())
+                           maxTranslation(DEFAULT_MAX_TRANSLATION()), maxRotation(DEFAULT_MAX_ROTATION()),
+                           minIncrement(DEFAULT_MIN_INCREMENT()), minResidualChange(DEFAULT_MIN_RESIDUAL_CHANGE())
 {
     if(iterCounts.empty() || minGradientMagnitudes.empty())
     {
@@ -1117,6 +2375,8 @@ Size RgbdOdometry::prepareFrameCache(Ptr<OdometryFrame>& frame, int cacheType) c
 {
     Odometry::prepareFrameCache(frame, cacheType);
 
+    OdometryWorkspace::Buffers* buffers = workspace.empty() ? 0 : workspace->buffers();
+
     if(frame->image.empty())
     {
         if(!frame->pyramidImage.empty())
@@ -1146,23 +2406,17 @@ Size RgbdOdometry::prepareFrameCache(Ptr<OdometryFrame>& frame, int cacheType) c
         frame->mask = frame->pyramidMask[0];
     checkMask(frame->mask, frame->image.size());
 
-    preparePyramidImage(frame->image, frame->pyramidImage, iterCounts.total());
-
-    preparePyramidDepth(frame->depth, frame->pyramidDepth, iterCounts.total());
-
-    preparePyramidMask(frame->mask, frame->pyramidDepth, minDepth, maxDepth,
-                       frame->pyramidNormals, frame->pyramidMask);
+    const bool isDst = (cacheType & OdometryFrame::CACHE_DST) != 0;
+    ImagePyramidChain imageChain(*frame, iterCounts.total(), isDst, buffers);
+    DepthPyramidChain depthChain(*frame, iterCounts.total(), cameraMatrix, minDepth, maxDepth, maxPointsPart,
+                                 (cacheType & OdometryFrame::CACHE_SRC) != 0, false, 0, buffers);
+    const FrameCacheChain* chains[] = {&imageChain, &depthChain};
+    runFrameCacheChains(chains, 2);
 
-    if(cacheType & OdometryFrame::CACHE_SRC)
-        preparePyramidCloud(frame->pyramidDepth, cameraMatrix, frame->pyramidCloud);
-
-    if(cacheType & OdometryFrame::CACHE_DST)
-    {
-        preparePyramidSobel(frame->pyramidImage, 1, 0, frame->pyramid_dI_dx);
-        preparePyramidSobel(frame->pyramidImage, 0, 1, frame->pyramid_dI_dy);
+    // The textured mask needs the gradients of the image chain and the mask of the depth chain
+    if(isDst)
         preparePyramidTexturedMask(frame->pyramid_dI_dx, frame->pyramid_dI_dy, minGradientMagnitudes,
-                                   frame->pyramidMask, maxPointsPart, frame->pyramidTexturedMask);
-    }
+                                   frame->pyramidMask, maxPointsPart, frame->pyramidTexturedMask, buffers);
 
     return frame->image.size();
 }
@@ -1176,14 +2430,18 @@ void RgbdOdometry::checkParams() const
 
 bool RgbdOdometry::computeImpl(const Ptr<OdometryFrame>& srcFrame, const Ptr<OdometryFrame>& dstFrame, Mat& Rt, const Mat& initRt) const
 {
-    return RGBDICPOdometryImpl(Rt, initRt, srcFrame, dstFrame, cameraMatrix, maxDepthDiff, iterCounts, maxTranslation, maxRotation, RGBD_ODOMETRY, transformType);
+    return RGBDICPOdometryImpl(Rt, initRt, srcFrame, dstFrame, cameraMatrix, maxDepthDiff, iterCounts, maxTranslation, maxRotation,
+                               minIncrement, minResidualChange, RGBD_ODOMETRY, transformType,
+                               workspace.empty() ? 0 : workspace->buffers(),
+                               stats.get());
 }
 
 //
 ICPOdometry::ICPOdometry() :
     minDepth(DEFAULT_MIN_DEPTH()), maxDepth(DEFAULT_MAX_DEPTH()),
     maxDepthDiff(DEFAULT_MAX_DEPTH_DIFF()), maxPointsPart(DEFAULT_MAX_POINTS_PART()), transformType(Odometry::RIGID_BODY_MOTION),
-    maxTranslation(DEFAULT_MAX_TRANSLATION()), maxRotation(DEFAULT_MAX_ROTATION())
+    maxTranslation(DEFAULT_MAX_TRANSLATION()), maxRotation(DEFAULT_MAX_ROTATION()),
+    minIncrement(DEFAULT_MIN_INCREMENT()), minResidualChange(DEFAULT_MIN_RESIDUAL_CHANGE())
 {
     setDefaultIterCounts(iterCounts);
 }
@@ -1195,7 +2453,8 @@ ICPOdometry::ICPOdometry(const Mat& _cameraMatrix,
                          minDepth(_minDepth), maxDepth(_maxDepth), maxDepthDiff(_maxDepthDiff),
                          maxPointsPart(_maxPointsPart), iterCounts(Mat(_iterCounts).clone()),
                          cameraMatrix(_cameraMatrix), transformType(_transformType),
-                         maxTranslation(DEFAULT_MAX_TRANSLATION()), maxRotation(DEFAULT_MAX_ROTATION())
+                         maxTranslation(DEFAULT_MAX_TRANSLATION()), maxRotation(DEFAULT_MAX_ROTATION()),
+                         minIncrement(DEFAULT_MIN_INCREMENT()), minResidualChange(DEFAULT_MIN_RESIDUAL_CHANGE())
 {
     if(iterCounts.empty())
         setDefaultIterCounts(iterCounts);
@@ -1205,6 +2464,8 @@ Size ICPOdometry::prepareFrameCache(Ptr<OdometryFrame>& frame, int cacheType) co
 {
     Odometry::prepareFrameCache(frame, cacheType);
 
+    OdometryWorkspace::Buffers* buffers = workspace.empty() ? 0 : workspace->buffers();
+
     if(frame->depth.empty())
     {
         if(!frame->pyramidDepth.empty())
@@ -1225,39 +2486,10 @@ Size ICPOdometry::prepareFrameCache(Ptr<OdometryFrame>& frame, int cacheType) co
         frame->mask = frame->pyramidMask[0];
     checkMask(frame->mask, frame->depth.size());
 
-    preparePyramidDepth(frame->depth, frame->pyramidDepth, iterCounts.total());
-
-    preparePyramidCloud(frame->pyramidDepth, cameraMatrix, frame->pyramidCloud);
-
-    if(cacheType & OdometryFrame::CACHE_DST)
-    {
-        if(frame->normals.empty())
-        {
-            if(!frame->pyramidNormals.empty())
-                frame->normals = frame->pyramidNormals[0];
-            else
-            {
-                if(normalsComputer.empty() ||
-                   normalsComputer->get<int>("rows") != frame->depth.rows ||
-                   normalsComputer->get<int>("cols") != frame->depth.cols ||
-                   cv::norm(normalsComputer->get<Mat>("K"), cameraMatrix) > FLT_EPSILON)
-                   normalsComputer = cv::Ptr<cv::RgbdNormals>(new RgbdNormals(frame->depth.rows, frame->depth.cols, frame->depth.depth(), cameraMatrix, normalWinSize, normalMethod));
-
-                (*normalsComputer)(frame->pyramidCloud[0], frame->normals);
-            }
-        }
-        checkNormals(frame->normals, frame->depth.size());
-
-        preparePyramidNormals(frame->normals, frame->pyramidDepth, frame->pyramidNormals);
-
-        preparePyramidMask(frame->mask, frame->pyramidDepth, minDepth, maxDepth,
-                           frame->pyramidNormals, frame->pyramidMask);
-
-        preparePyramidNormalsMask(frame->pyramidNormals, frame->pyramidMask, maxPointsPart, frame->pyramidNormalsMask);
-    }
-    else
-        preparePyramidMask(frame->mask, frame->pyramidDepth, minDepth, maxDepth,
-                           frame->pyramidNormals, frame->pyramidMask);
+    // ICP does not use the image, the depth chain is the only one
+    DepthPyramidChain depthChain(*frame, iterCounts.total(), cameraMatrix, minDepth, maxDepth, maxPointsPart,
+                                 true, (cacheType & OdometryFrame::CACHE_DST) != 0, &normalsComputer, buffers);
+    depthChain.run();
 
     return frame->depth.size();
 }
@@ -1270,14 +2502,18 @@ void ICPOdometry::checkParams() const
 
 bool ICPOdometry::computeImpl(const Ptr<OdometryFrame>& srcFrame, const Ptr<OdometryFrame>& dstFrame, Mat& Rt, const Mat& initRt) const
 {
-    return RGBDICPOdometryImpl(Rt, initRt, srcFrame, dstFrame, cameraMatrix, maxDepthDiff, iterCounts, maxTranslation, maxRotation, ICP_ODOMETRY, transformType);
+    return RGBDICPOdometryImpl(Rt, initRt, srcFrame, dstFrame, cameraMatrix, maxDepthDiff, iterCounts, maxTranslation, maxRotation,
+                               minIncrement, minResidualChange, ICP_ODOMETRY, transformType,
+                               workspace.empty() ? 0 : workspace->buffers(),
+                               stats.get());
 }
 
 //
 RgbdICPOdometry::RgbdICPOdometry() :
     minDepth(DEFAULT_MIN_DEPTH()), maxDepth(DEFAULT_MAX_DEPTH()),
     maxDepthDiff(DEFAULT_MAX_DEPTH_DIFF()), maxPointsPart(DEFAULT_MAX_POINTS_PART()), transformType(Odometry::RIGID_BODY_MOTION),
-    maxTranslation(DEFAULT_MAX_TRANSLATION()), maxRotation(DEFAULT_MAX_ROTATION())
+    maxTranslation(DEFAULT_MAX_TRANSLATION()), maxRotation(DEFAULT_MAX_ROTATION()),
+    minIncrement(DEFAULT_MIN_INCREMENT()), minResidualChange(DEFAULT_MIN_RESIDUAL_CHANGE())
 {
     setDefaultIterCounts(iterCounts);
     setDefaultMinGradientMagnitudes(minGradientMagnitudes);
@@ -1292,7 +2528,8 @@ RgbdICPOdometry::RgbdICPOdometry(const Mat& _cameraMatrix,
                                  maxPointsPart(_maxPointsPart), iterCounts(Mat(_iterCounts).clone()),
                                  minGradientMagnitudes(Mat(_minGradientMagnitudes).clone()),
                                  cameraMatrix(_cameraMatrix), transformType(_transformType),
-                                 maxTranslation(DEFAULT_MAX_TRANSLATION()), maxRotation(DEFAULT_MAX_ROTATION())
+                                 maxTranslation(DEFAULT_MAX_TRANSLATION()), maxRotation(DEFAULT_MAX_ROTATION()),
+                                 minIncrement(DEFAULT_MIN_INCREMENT()), minResidualChange(DEFAULT_MIN_RESIDUAL_CHANGE())
 {
     if(iterCounts.empty() || minGradientMagnitudes.empty())
     {
@@ -1303,6 +2540,8 @@ RgbdICPOdometry::RgbdICPOdometry(const Mat& _cameraMatrix,
 
 Size RgbdICPOdometry::prepareFrameCache(Ptr<OdometryFrame>& frame, int cacheType) const
 {
+    OdometryWorkspace::Buffers* buffers = workspace.empty() ? 0 : workspace->buffers();
+
     if(frame->image.empty())
     {
         if(!frame->pyramidImage.empty())
@@ -1332,47 +2571,18 @@ Size RgbdICPOdometry::prepareFrameCache(Ptr<OdometryFrame>& frame, int cacheType
         frame->mask = frame->pyramidMask[0];
     checkMask(frame->mask, frame->image.size());
 
-    preparePyramidImage(frame->image, frame->pyramidImage, iterCounts.total());
-
-    preparePyramidDepth(frame->depth, frame->pyramidDepth, iterCounts.total());
-
-    preparePyramidCloud(frame->pyramidDepth, cameraMatrix, frame->pyramidCloud);
-
-    if(cacheType & OdometryFrame::CACHE_DST)
-    {
-        if(frame->normals.empty())
-        {
-            if(!frame->pyramidNormals.empty())
-                frame->normals = frame->pyramidNormals[0];
-            else
-            {
-                if(normalsComputer.empty() ||
-                   normalsComputer->get<int>("rows") != frame->depth.rows ||
-                   normalsComputer->get<int>("cols") != frame->depth.cols ||
-                   cv::norm(normalsComputer->get<Mat>("K"), cameraMatrix) > FLT_EPSILON)
-                   normalsComputer = cv::Ptr<cv::RgbdNormals>(new RgbdNormals(frame->depth.rows, frame->depth.cols, frame->depth.depth(), cameraMatrix, normalWinSize, normalMethod));
-
-                (*normalsComputer)(frame->pyramidCloud[0], frame->normals);
-            }
-        }
-        checkNormals(frame->normals, frame->depth.size());
-
-        preparePyramidNormals(frame->normals, frame->pyramidDepth, frame->pyramidNormals);
-
-        preparePyramidMask(frame->mask, frame->pyramidDepth, minDepth, maxDepth,
-                           frame->pyramidNormals, frame->pyramidMask);
+    const bool isDst = (cacheType & OdometryFrame::CACHE_DST) != 0;
+    ImagePyramidChain imageChain(*frame, iterCounts.total(), isDst, buffers);
+    DepthPyramidChain depthChain(*frame, iterCounts.total(), cameraMatrix, minDepth, maxDepth, maxPointsPart,
+                                 true, isDst, &normalsComputer, buffers);
+    const FrameCacheChain* chains[] = {&imageChain, &depthChain};
+    runFrameCacheChains(chains, 2);
 
-        preparePyramidSobel(frame->pyramidImage, 1, 0, frame->pyramid_dI_dx);
-        preparePyramidSobel(frame->pyramidImage, 0, 1, frame->pyramid_dI_dy);
+    // The textured mask needs the gradients of the image chain and the mask of the depth chain
+    if(isDst)
         preparePyramidTexturedMask(frame->pyramid_dI_dx, frame->pyramid_dI_dy,
                                    minGradientMagnitudes, frame->pyramidMask,
-                                   maxPointsPart, frame->pyramidTexturedMask);
-
-        preparePyramidNormalsMask(frame->pyramidNormals, frame->pyramidMask, maxPointsPart, frame->pyramidNormalsMask);
-    }
-    else
-        preparePyramidMask(frame->mask, frame->pyramidDepth, minDepth, maxDepth,
-                           frame->pyramidNormals, frame->pyramidMask);
+                                   maxPointsPart, frame->pyramidTexturedMask, buffers);
 
     return frame->image.size();
 }
@@ -1386,7 +2596,145 @@ void RgbdICPOdometry::checkParams() const
 
 bool RgbdICPOdometry::computeImpl(const Ptr<OdometryFrame>& srcFrame, const Ptr<OdometryFrame>& dstFrame, Mat& Rt, const Mat& initRt) const
 {
-    return RGBDICPOdometryImpl(Rt, initRt, srcFrame, dstFrame, cameraMatrix, maxDepthDiff, iterCounts,  maxTranslation, maxRotation, MERGED_ODOMETRY, transformType);
+    return RGBDICPOdometryImpl(Rt, initRt, srcFrame, dstFrame, cameraMatrix, maxDepthDiff, iterCounts,  maxTranslation, maxRotation,
+                               minIncrement, minResidualChange, MERGED_ODOMETRY, transformType,
+                               workspace.empty() ? 0 : workspace->buffers(),
+                               stats.get());
+}
+
+//
+OdometryStream::OdometryStream()
+{}
+
+OdometryStream::OdometryStream(const Ptr<Odometry>& _odometry) : odometry(_odometry)
+{}
+
+bool OdometryStream::push(const Ptr<OdometryFrame>& frame, Mat& Rt, const Mat& initRt)
+{
+    if(odometry.empty())
+        CV_Error(CV_StsBadArg, "The odometry of the stream is not set.");
+    if(frame.empty())
+        CV_Error(CV_StsBadArg, "Null frame pointer.");
+
+    Rt = Mat::eye(4, 4, CV_64FC1);
+
+    Ptr<OdometryFrame> srcFrame = lastFrame, dstFrame = frame;
+    lastFrame = frame;
+
+    if(srcFrame.empty())
+        return false;
+
+    // The caches the source frame got as the destination frame of the previous call are reused,
+    // Odometry::prepareFrameCache only adds the missing ones
+    bool isOk = odometry->compute(srcFrame, dstFrame, Rt, initRt);
+    if(!isOk)
+        Rt = Mat::eye(4, 4, CV_64FC1);
+
+    return isOk;
+}
+
+void OdometryStream::reset()
+{
+    lastFrame.release();
+}
+
+void OdometryStream::setOdometry(const Ptr<Odometry>& _odometry)
+{
+    odometry = _odometry;
+    reset();
+}
+
+//
+KeyframeOdometry::KeyframeOdometry() :
+    odometry(new RgbdICPOdometry()), minOverlap(DEFAULT_MIN_OVERLAP())
+{}
+
+KeyframeOdometry::KeyframeOdometry(const Ptr<Odometry>& _odometry, float _minOverlap) :
+    odometry(_odometry), minOverlap(_minOverlap)
+{}
+
+/** Computes the part of the valid pixels of dstFrame that have a correspondence in srcFrame.
+ * It is done on the coarsest pyramid level, the overlap does not need the full resolution.
+ */
+static
+double computeFramesOverlap(const Odometry& odometry, const Ptr<OdometryFrame>& srcFrame,
+                            const Ptr<OdometryFrame>& dstFrame, const Mat& Rt)
+{
+    const int level = static_cast<int>(std::min(srcFrame->pyramidDepth.size(), dstFrame->pyramidDepth.size())) - 1;
+    CV_Assert(level >= 0);
+
+    const Mat& dstMask = dstFrame->pyramidMask[level];
+    const int validCount = countNonZero(dstMask);
+    if(validCount == 0)
+        return 0.;
+
+    std::vector<Mat> pyramidCameraMatrix;
+    buildPyramidCameraMatrix(odometry.get<Mat>("cameraMatrix"), level + 1, pyramidCameraMatrix);
+    const Mat& levelCameraMatrix = pyramidCameraMatrix[level];
+
+    Mat corresps;
+    CorrespsBuffers buffers;
+    buildSelectedPixels(dstMask, buffers.selectedPixels);
+    computeCorresps(levelCameraMatrix, levelCameraMatrix.inv(DECOMP_SVD), Rt.inv(DECOMP_SVD),
+                    srcFrame->pyramidDepth[level], srcFrame->pyramidMask[level], dstFrame->pyramidDepth[level], buffers.selectedPixels,
+                    static_cast<float>(odometry.get<double>("maxDepthDiff")), corresps, buffers);
+
+    return static_cast<double>(corresps.rows) / validCount;
+}
+
+bool KeyframeOdometry::push(const Ptr<OdometryFrame>& frame, Mat& pose)
+{
+    if(odometry.empty())
+        CV_Error(CV_StsBadArg, "The odometry is not set.");
+    if(frame.empty())
+        CV_Error(CV_StsBadArg, "Null frame pointer.");
+
+    bool isOk = true, isNewKeyframe = false;
+    if(keyframe.empty())
+    {
+        pose = Mat::eye(4, 4, CV_64FC1);
+        isNewKeyframe = true;
+    }
+    else
+    {
+        Ptr<OdometryFrame> srcFrame = keyframe, dstFrame = frame;
+        Mat Rt;
+        // The motion from the keyframe to the previous frame is the initial guess
+        isOk = odometry->compute(srcFrame, dstFrame, Rt, lastRt);
+        if(isOk)
+        {
+            pose = keyframePose * Rt.inv(DECOMP_SVD);
+            lastRt = Rt;
+            isNewKeyframe = computeFramesOverlap(*odometry, keyframe, frame, Rt) < minOverlap;
+        }
+        else
+        {
+            // The frame can not be registered against the keyframe, the tracking restarts from it
+            pose = trajectory.back().clone();
+            isNewKeyframe = true;
+        }
+    }
+
+    trajectory.push_back(pose.clone());
+
+    if(isNewKeyframe)
+    {
+        keyframe = frame;
+        keyframePose = trajectory.back();
+        lastRt = Mat::eye(4, 4, CV_64FC1);
+        keyframeIndices.push_back(static_cast<int>(trajectory.size()) - 1);
+    }
+
+    return isOk;
+}
+
+void KeyframeOdometry::reset()
+{
+    keyframe.release();
+    keyframePose.release();
+    lastRt.release();
+    trajectory.clear();
+    keyframeIndices.clear();
 }
 
 //
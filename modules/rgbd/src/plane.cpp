@@ -43,11 +43,25 @@
  * Houxiang Zhang and Hans Petter Hildre
  */
 
+#include <algorithm>
+#include <limits>
 #include <list>
 #include <set>
 
+#include <opencv2/core/utility.hpp>
 #include <opencv2/rgbd.hpp>
 
+/** Compute point*point.t(). It is cheaper than storing it for every pixel and reading it back
+ * @param point
+ * @return
+ */
+inline cv::Matx33f
+pointPointT(const cv::Vec3f & point)
+{
+  const float xy = point[0] * point[1], xz = point[0] * point[2], yz = point[1] * point[2];
+  return cv::Matx33f(point[0] * point[0], xy, xz, xy, point[1] * point[1], yz, xz, yz, point[2] * point[2]);
+}
+
 /** Structure defining a plane. The notations are from the second paper */
 class PlaneBase
 {
@@ -119,10 +133,10 @@ public:
   /** Update the different sum of point and sum of point*point.t()
    */
   void
-  UpdateStatistics(const cv::Vec3f & point, const cv::Matx33f & Q_local)
+  UpdateStatistics(const cv::Vec3f & point)
   {
     m_sum_ += point;
-    Q_ += Q_local;
+    Q_ += pointPointT(point);
     ++K_;
   }
 
@@ -221,12 +235,89 @@ private:
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+/** An organized cloud of 3d points, either interleaved in a 3-channel matrix or split in 3 planes x, y and z.
+ * The points are read where they are, whatever the layout
+ */
+class PointCloud
+{
+public:
+  PointCloud(const cv::Mat_<cv::Vec3f> & points3d)
+      :
+        rows(points3d.rows),
+        cols(points3d.cols),
+        stride_(3)
+  {
+    for (int i = 0; i < 3; ++i)
+    {
+      planes_[i] = points3d;
+      offsets_[i] = i;
+    }
+  }
+
+  PointCloud(const std::vector<cv::Mat_<float> > & planes)
+      :
+        rows(planes[0].rows),
+        cols(planes[0].cols),
+        stride_(1)
+  {
+    for (int i = 0; i < 3; ++i)
+    {
+      planes_[i] = planes[i];
+      offsets_[i] = 0;
+    }
+  }
+
+  /** Get the coordinates of a point: the ones of the next points in the row are stride() floats further
+   * @param y the row of the point
+   * @param x the column of the point
+   * @param xs the x coordinate
+   * @param ys the y coordinate
+   * @param zs the z coordinate
+   */
+  inline void
+  ptr(int y, int x, const float *& xs, const float *& ys, const float *& zs) const
+  {
+    xs = planes_[0].ptr<float>(y) + x * stride_ + offsets_[0];
+    ys = planes_[1].ptr<float>(y) + x * stride_ + offsets_[1];
+    zs = planes_[2].ptr<float>(y) + x * stride_ + offsets_[2];
+  }
+
+  inline int
+  stride() const
+  {
+    return stride_;
+  }
+
+  cv::Size
+  size() const
+  {
+    return cv::Size(cols, rows);
+  }
+
+  int rows, cols;
+private:
+  /** The matrices holding x, y and z, the same 3-channel one for interleaved points */
+  cv::Mat planes_[3];
+  /** The offset of every coordinate in an element */
+  int offsets_[3];
+  /** The number of floats between two consecutive points */
+  int stride_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 /** The PlaneGrid contains statistic about the individual tiles
  */
 class PlaneGrid
 {
 public:
-  PlaneGrid(const cv::Mat_<cv::Vec3f> & points3d, int block_size)
+  /** Compute the statistics of the tiles
+   * @param points3d the 3d points
+   * @param labels the labels of the points, only the ones labeled no_plane are considered
+   * @param no_plane the label of the points that belong to no plane
+   * @param block_size the size of the tiles
+   */
+  PlaneGrid(const PointCloud & points3d, const cv::Mat_<int> & labels, int no_plane, int block_size)
       :
         block_size_(block_size)
   {
@@ -239,71 +330,104 @@ public:
     if (points3d.cols % block_size != 0)
       ++mini_cols;
 
-    // Compute all the interesting quantities
+    // Compute all the interesting quantities, the tiles being independent
     m_.create(mini_rows, mini_cols);
     n_.create(mini_rows, mini_cols);
-    Q_.create(points3d.rows, points3d.cols);
     mse_.create(mini_rows, mini_cols);
-    for (int y = 0; y < mini_rows; ++y)
-      for (int x = 0; x < mini_cols; ++x)
-      {
-        // Update the tiles
-        cv::Matx33f Q = cv::Matx33f::zeros();
-        cv::Vec3f m = cv::Vec3f(0, 0, 0);
-        int K = 0;
-        for (int j = y * block_size; j < std::min((y + 1) * block_size, points3d.rows); ++j)
-        {
-          const cv::Vec3f * vec = points3d.ptr < cv::Vec3f > (j, x * block_size), *vec_end;
-          float * pointpointt = reinterpret_cast<float*>(Q_.ptr < cv::Vec<float, 9> > (j, x * block_size));
-          if (x == mini_cols - 1)
-            vec_end = points3d.ptr < cv::Vec3f > (j, points3d.cols - 1) + 1;
-          else
-            vec_end = vec + block_size;
-          for (; vec != vec_end; ++vec, pointpointt += 9)
-          {
-            if (cvIsNaN(vec->val[0]))
-              continue;
-            // Fill point*point.t()
-            *pointpointt = vec->val[0] * vec->val[0];
-            *(pointpointt + 1) = vec->val[0] * vec->val[1];
-            *(pointpointt + 2) = vec->val[0] * vec->val[2];
-            *(pointpointt + 3) = *(pointpointt + 1);
-            *(pointpointt + 4) = vec->val[1] * vec->val[1];
-            *(pointpointt + 5) = vec->val[1] * vec->val[2];
-            *(pointpointt + 6) = *(pointpointt + 2);
-            *(pointpointt + 7) = *(pointpointt + 5);
-            *(pointpointt + 8) = vec->val[2] * vec->val[2];
-
-            Q += *reinterpret_cast<cv::Matx33f*>(pointpointt);
-            m += (*vec);
-            ++K;
-          }
-        }
-        if (K == 0)
-        {
-          mse_(y, x) = std::numeric_limits<float>::max();
-          continue;
-        }
-
-        m /= K;
-        m_(y, x) = m;
-
-        // Compute C
-        cv::Matx33f C = Q - K * m * m.t();
-
-        // Compute n
-        cv::SVD svd(C);
-        n_(y, x) = cv::Vec3f(svd.vt.at<float>(2, 0), svd.vt.at<float>(2, 1), svd.vt.at<float>(2, 2));
-        mse_(y, x) = svd.w.at<float>(2) / K;
-      }
+    cv::parallel_for_(cv::Range(0, mini_rows * mini_cols), TilesInvoker(*this, points3d, labels, no_plane));
   }
 
   /** The size of the block */
   int block_size_;
   cv::Mat_<cv::Vec3f> m_;
   cv::Mat_<cv::Vec3f> n_;
-  cv::Mat_<cv::Vec<float, 9> > Q_;
   cv::Mat_<float> mse_;
+
+private:
+  /** Compute the statistics of a range of tiles, numbered in row-major order
+   */
+  class TilesInvoker: public cv::ParallelLoopBody
+  {
+  public:
+    TilesInvoker(PlaneGrid & plane_grid, const PointCloud & points3d, const cv::Mat_<int> & labels, int no_plane)
+        :
+          plane_grid_(plane_grid),
+          points3d_(points3d),
+          labels_(labels),
+          no_plane_(no_plane)
+    {
+    }
+
+    virtual void
+    operator()(const cv::Range &tiles) const
+    {
+      for (int tile = tiles.start; tile < tiles.end; ++tile)
+        plane_grid_.computeTile(points3d_, labels_, no_plane_, tile / plane_grid_.mse_.cols,
+                                tile % plane_grid_.mse_.cols);
+    }
+
+  private:
+    TilesInvoker& operator=(const TilesInvoker&);
+
+    PlaneGrid & plane_grid_;
+    const PointCloud & points3d_;
+    const cv::Mat_<int> & labels_;
+    int no_plane_;
+  };
+  friend class TilesInvoker;
+
+  /** Compute the mean, the normal and the MSE of a tile
+   * @param points3d the 3d points
+   * @param labels the labels of the points
+   * @param no_plane the label of the points to consider
+   * @param y the row of the tile
+   * @param x the column of the tile
+   */
+  void
+  computeTile(const PointCloud & points3d, const cv::Mat_<int> & labels, int no_plane, int y, int x)
+  {
+    const int block_size = block_size_, mini_cols = mse_.cols;
+    cv::Matx33f Q = cv::Matx33f::zeros();
+    cv::Vec3f m = cv::Vec3f(0, 0, 0);
+    int K = 0;
+    const int stride = points3d.stride();
+    for (int j = y * block_size; j < std::min((y + 1) * block_size, points3d.rows); ++j)
+    {
+      const float *xs, *ys, *zs;
+      points3d.ptr(j, x * block_size, xs, ys, zs);
+      const int * label = labels[j] + x * block_size;
+      int n_points;
+      if (x == mini_cols - 1)
+        n_points = points3d.cols - x * block_size;
+      else
+        n_points = block_size;
+      for (int i = 0; i < n_points; ++i, xs += stride, ys += stride, zs += stride)
+      {
+        if (cvIsNaN(*xs) || (label[i] != no_plane))
+          continue;
+        const cv::Vec3f vec(*xs, *ys, *zs);
+        Q += pointPointT(vec);
+        m += vec;
+        ++K;
+      }
+    }
+    if (K == 0)
+    {
+      mse_(y, x) = std::numeric_limits<float>::max();
+      return;
+    }
+
+    m /= K;
+    m_(y, x) = m;
+
+    // Compute C
+    cv::Matx33f C = Q - K * m * m.t();
+
+    // Compute n
+    cv::SVD svd(C);
+    n_(y, x) = cv::Vec3f(svd.vt.at<float>(2, 0), svd.vt.at<float>(2, 1), svd.vt.at<float>(2, 2));
+    mse_(y, x) = svd.w.at<float>(2) / K;
+  }
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -370,6 +494,12 @@ public:
   {
     done_tiles_(y, x) = 1;
   }
+
+  bool
+  done(int y, int x) const
+  {
+    return done_tiles_(y, x) != 0;
+  }
 private:
   /** The list of tiles ordered from most planar to least */
   std::list<PlaneTile> tiles_;
@@ -379,23 +509,25 @@ private:
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+
 class InlierFinder
 {
 public:
-  InlierFinder(float err, const cv::Mat_<cv::Vec3f> & points3d, const cv::Mat_<cv::Vec3f> & normals,
-               unsigned char plane_index, int block_size)
+  InlierFinder(float err, const PointCloud & points3d, const cv::Mat_<cv::Vec3f> & normals,
+               int plane_index, int no_plane, int block_size)
       :
         err_(err),
         points3d_(points3d),
         normals_(normals),
         plane_index_(plane_index),
+        no_plane_(no_plane),
         block_size_(block_size)
   {
   }
 
   void
   Find(const PlaneGrid &plane_grid, cv::Ptr<PlaneBase> & plane, TileQueue & tile_queue,
-       std::set<TileQueue::PlaneTile> & neighboring_tiles, cv::Mat_<unsigned char> & overall_mask,
+       std::set<TileQueue::PlaneTile> & neighboring_tiles, cv::Mat_<int> & overall_mask,
        cv::Mat_<unsigned char> & plane_mask)
   {
     // Do not use reference as we pop the from later on
@@ -416,31 +548,32 @@ public:
       range_y = cv::Range(y, y + block_size_);
 
     int n_valid_points = 0;
+    const int stride = points3d_.stride();
     for (int yy = range_y.start; yy != range_y.end; ++yy)
     {
-      uchar* data = overall_mask.ptr(yy, range_x.start), *data_end = data + range_x.size();
-      const cv::Vec3f* point = points3d_.ptr < cv::Vec3f > (yy, range_x.start);
-      const cv::Matx33f* Q_local = reinterpret_cast<const cv::Matx33f *>(plane_grid.Q_.ptr < cv::Vec<float, 9>
-          > (yy, range_x.start));
+      int* data = overall_mask[yy] + range_x.start, *data_end = data + range_x.size();
+      const float *xs, *ys, *zs;
+      points3d_.ptr(yy, range_x.start, xs, ys, zs);
 
       // Depending on whether you have a normal, check it
       if (!normals_.empty())
       {
         const cv::Vec3f* normal = normals_.ptr < cv::Vec3f > (yy, range_x.start);
-        for (; data != data_end; ++data, ++point, ++normal, ++Q_local)
+        for (; data != data_end; ++data, xs += stride, ys += stride, zs += stride, ++normal)
         {
           // Don't do anything if the point already belongs to another plane
-          if (cvIsNaN(point->val[0]) || ((*data) != 255))
+          if (cvIsNaN(*xs) || ((*data) != no_plane_))
             continue;
 
           // If the point is close enough to the plane
-          if (plane->distance(*point) < err_)
+          const cv::Vec3f point(*xs, *ys, *zs);
+          if (plane->distance(point) < err_)
           {
             // make sure the normals are similar to the plane
             if (std::abs(plane->n().dot(*normal)) > 0.3)
             {
               // The point now belongs to the plane
-              plane->UpdateStatistics(*point, *Q_local);
+              plane->UpdateStatistics(point);
               *data = plane_index_;
               ++n_valid_points;
             }
@@ -449,17 +582,18 @@ public:
       }
       else
       {
-        for (; data != data_end; ++data, ++point, ++Q_local)
+        for (; data != data_end; ++data, xs += stride, ys += stride, zs += stride)
         {
           // Don't do anything if the point already belongs to another plane
-          if (cvIsNaN(point->val[0]) || ((*data) != 255))
+          if (cvIsNaN(*xs) || ((*data) != no_plane_))
             continue;
 
           // If the point is close enough to the plane
-          if (plane->distance(*point) < err_)
+          const cv::Vec3f point(*xs, *ys, *zs);
+          if (plane->distance(point) < err_)
           {
             // The point now belongs to the plane
-            plane->UpdateStatistics(*point, *Q_local);
+            plane->UpdateStatistics(point);
             *data = plane_index_;
             ++n_valid_points;
           }
@@ -476,34 +610,35 @@ public:
     neighboring_tiles.erase(neighboring_tiles.begin());
 
     // Add potential neighbors of the tile
+    const size_t step = overall_mask.step1();
     std::vector<std::pair<int, int> > pairs;
     if (tile.x_ > 0)
-      for (unsigned char * val = overall_mask.ptr<unsigned char>(range_y.start, range_x.start), *val_end = val
-          + range_y.size() * overall_mask.step; val != val_end; val += overall_mask.step)
+      for (const int * val = overall_mask[range_y.start] + range_x.start, *val_end = val + range_y.size() * step;
+          val != val_end; val += step)
         if (*val == plane_index_)
         {
           pairs.push_back(std::pair<int, int>(tile.x_ - 1, tile.y_));
           break;
         }
     if (tile.x_ < plane_mask.cols - 1)
-      for (unsigned char * val = overall_mask.ptr<unsigned char>(range_y.start, range_x.end - 1), *val_end = val
-          + range_y.size() * overall_mask.step; val != val_end; val += overall_mask.step)
+      for (const int * val = overall_mask[range_y.start] + range_x.end - 1, *val_end = val + range_y.size() * step;
+          val != val_end; val += step)
         if (*val == plane_index_)
         {
           pairs.push_back(std::pair<int, int>(tile.x_ + 1, tile.y_));
           break;
         }
     if (tile.y_ > 0)
-      for (unsigned char * val = overall_mask.ptr<unsigned char>(range_y.start, range_x.start), *val_end = val
-          + range_x.size(); val != val_end; ++val)
+      for (const int * val = overall_mask[range_y.start] + range_x.start, *val_end = val + range_x.size();
+          val != val_end; ++val)
         if (*val == plane_index_)
         {
           pairs.push_back(std::pair<int, int>(tile.x_, tile.y_ - 1));
           break;
         }
     if (tile.y_ < plane_mask.rows - 1)
-      for (unsigned char * val = overall_mask.ptr<unsigned char>(range_y.end - 1, range_x.start), *val_end = val
-          + range_x.size(); val != val_end; ++val)
+      for (const int * val = overall_mask[range_y.end - 1] + range_x.start, *val_end = val + range_x.size();
+          val != val_end; ++val)
         if (*val == plane_index_)
         {
           pairs.push_back(std::pair<int, int>(tile.x_, tile.y_ + 1));
@@ -518,9 +653,11 @@ public:
 
 private:
   float err_;
-  const cv::Mat_<cv::Vec3f> & points3d_;
+  const PointCloud & points3d_;
   const cv::Mat_<cv::Vec3f> & normals_;
-  unsigned char plane_index_;
+  int plane_index_;
+  /** The label of the points that belong to no plane */
+  int no_plane_;
   /** THe block size as defined in the main algorithm */
   int block_size_;
 }
@@ -528,6 +665,80 @@ private:
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+/** Label every tile with the plane most of its pixels belong to in a mask
+ * @param mask a mask as computed by RgbdPlane, converted to int
+ * @param grid_size the number of tiles
+ * @param block_size the size of the tiles
+ * @return the label of every tile, -1 if no label covers more than half of its pixels
+ */
+cv::Mat_<int>
+computeTileLabels(const cv::Mat_<int> & mask, const cv::Size & grid_size, int block_size)
+{
+  cv::Mat_<int> tile_labels(grid_size);
+  for (int y = 0; y < grid_size.height; ++y)
+    for (int x = 0; x < grid_size.width; ++x)
+    {
+      const int y_end = std::min((y + 1) * block_size, mask.rows), x_end = std::min((x + 1) * block_size, mask.cols);
+
+      // Find the only label that can be the majority one with a Boyer-Moore vote, whatever the number of labels
+      int candidate = -1, votes = 0;
+      for (int yy = y * block_size; yy < y_end; ++yy)
+        for (const int * data = mask[yy] + x * block_size, *data_end = mask[yy] + x_end; data != data_end; ++data)
+        {
+          if (votes == 0)
+            candidate = *data;
+          votes += (*data == candidate) ? 1 : -1;
+        }
+
+      // Check that it is
+      int count = 0;
+      for (int yy = y * block_size; yy < y_end; ++yy)
+        count += int(std::count(mask[yy] + x * block_size, mask[yy] + x_end, candidate));
+      tile_labels(y, x) = (2 * count > (y_end - y * block_size) * (x_end - x * block_size)) ? candidate : -1;
+    }
+  return tile_labels;
+}
+
+/** Find the tile to grow a plane of a previous frame from: the most planar tile whose own plane matches the
+ * previous plane moved to the current frame, and which belonged to the previous plane if its mask is known
+ * @param plane_grid the statistics of the tiles
+ * @param plane_queue the tiles still available
+ * @param tile_labels the labels of the tiles in the previous frame, or empty
+ * @param previous_index the index of the plane in the previous frame
+ * @param plane the coefficients of the previous plane, moved to the current frame
+ * @param threshold the distance a tile mean can be from the plane
+ * @param mse_max the maximum MSE of a seed tile
+ * @param seed the resulting seed tile
+ * @return true if a seed tile was found
+ */
+bool
+findTrackedSeed(const PlaneGrid & plane_grid, const TileQueue & plane_queue, const cv::Mat_<int> & tile_labels,
+                int previous_index, const cv::Vec4f & plane, float threshold, float mse_max,
+                TileQueue::PlaneTile & seed)
+{
+  // The normals of a tile and of the plane must be within about 18 degrees
+  const float min_normal_dot = 0.95f;
+  const cv::Vec3f n(plane[0], plane[1], plane[2]);
+  bool found = false;
+  for (int y = 0; y < plane_grid.mse_.rows; ++y)
+    for (int x = 0; x < plane_grid.mse_.cols; ++x)
+    {
+      const float mse = plane_grid.mse_(y, x);
+      if ((mse > mse_max) || (found && (mse >= seed.mse_)) || plane_queue.done(y, x))
+        continue;
+      if (!tile_labels.empty() && (tile_labels(y, x) != previous_index))
+        continue;
+      if ((std::abs(n.dot(plane_grid.n_(y, x))) < min_normal_dot)
+          || (std::abs(n.dot(plane_grid.m_(y, x)) + plane[3]) > threshold))
+        continue;
+      seed = TileQueue::PlaneTile(x, y, mse);
+      found = true;
+    }
+  return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 namespace cv
 {
   void
@@ -540,11 +751,41 @@ namespace cv
   RgbdPlane::operator()(InputArray points3d_in, InputArray normals_in, OutputArray mask_out,
                         OutputArray plane_coefficients_out)
   {
-    cv::Mat_<cv::Vec3f> points3d, normals;
-    if (points3d_in.depth() == CV_32F)
-      points3d = points3d_in.getMat();
+    track(points3d_in, normals_in, cv::Mat(), cv::Mat(), cv::Mat(), mask_out, plane_coefficients_out);
+  }
+
+  void
+  RgbdPlane::track(InputArray points3d_in, InputArray normals_in, InputArray previous_mask_in,
+                   InputArray previous_plane_coefficients_in, InputArray Rt_in, OutputArray mask_out,
+                   OutputArray plane_coefficients_out, OutputArray previous_indices_out)
+  {
+    CV_Assert(mask_type_ == CV_8U || mask_type_ == CV_16U || mask_type_ == CV_32S);
+    CV_Assert(block_size_ > 0 && block_levels_ > 0);
+
+    // The points are either interleaved or given as 3 planes x, y and z, used as they are
+    cv::Mat_<cv::Vec3f> points3d_interleaved, normals;
+    std::vector<cv::Mat_<float> > points3d_planes;
+    if (points3d_in.kind() == _InputArray::STD_VECTOR_MAT)
+    {
+      std::vector<cv::Mat> planes;
+      points3d_in.getMatVector(planes);
+      CV_Assert(planes.size() == 3);
+      points3d_planes.resize(3);
+      for (int i = 0; i < 3; ++i)
+      {
+        CV_Assert(planes[i].dims == 2 && planes[i].channels() == 1 && planes[i].size() == planes[0].size());
+        if (planes[i].depth() == CV_32F)
+          points3d_planes[i] = planes[i];
+        else
+          planes[i].convertTo(points3d_planes[i], CV_32F);
+      }
+    }
+    else if (points3d_in.depth() == CV_32F)
+      points3d_interleaved = points3d_in.getMat();
     else
-      points3d_in.getMat().convertTo(points3d, CV_32F);
+      points3d_in.getMat().convertTo(points3d_interleaved, CV_32F);
+    const PointCloud points3d = points3d_planes.empty() ? PointCloud(points3d_interleaved) :
+                                                          PointCloud(points3d_planes);
     if (!normals_in.empty())
     {
       if (normals_in.depth() == CV_32F)
@@ -553,80 +794,167 @@ namespace cv
         normals_in.getMat().convertTo(normals, CV_32F);
     }
 
-    // Pre-computations
-    mask_out.create(points3d.size(), CV_8U);
+    // Pre-computations: the labels are ints, written to the mask directly if it is CV_32S
+    const int no_plane = (mask_type_ == CV_8U) ? int(std::numeric_limits<unsigned char>::max()) :
+                         (mask_type_ == CV_16U) ? int(std::numeric_limits<unsigned short>::max()) :
+                                                  std::numeric_limits<int>::max();
+    mask_out.create(points3d.size(), mask_type_);
     cv::Mat mask_out_mat = mask_out.getMat();
-    cv::Mat_<unsigned char> mask_out_uc = (cv::Mat_<unsigned char>&) mask_out_mat;
-    mask_out_uc.setTo(255);
-    PlaneGrid plane_grid(points3d, block_size_);
-    TileQueue plane_queue(plane_grid);
-    size_t index_plane = 0;
+    cv::Mat_<int> labels;
+    if (mask_type_ == CV_32S)
+      labels = mask_out_mat;
+    else
+      labels.create(points3d.size());
+    labels.setTo(no_plane);
+    int index_plane = 0;
 
     std::vector<cv::Vec4f> plane_coefficients;
+    std::vector<int> previous_indices;
     float mse_min = threshold_ * threshold_;
 
-    while (!plane_queue.empty())
+    // Move the planes of the previous frame to the current one: if dst_p = R * src_p + t, n' = R * n, d' = d - n'.t
+    std::vector<cv::Vec4f> previous_planes;
+    cv::Mat_<int> previous_labels;
+    if (!previous_plane_coefficients_in.empty())
     {
-      // Get the first tile if it's good enough
-      const TileQueue::PlaneTile front_tile = plane_queue.front();
-      if (front_tile.mse_ > mse_min)
+      cv::Mat previous_plane_coefficients = previous_plane_coefficients_in.getMat();
+      CV_Assert(previous_plane_coefficients.total() * previous_plane_coefficients.channels() % 4 == 0);
+      previous_plane_coefficients.reshape(4, 1).convertTo(previous_planes, CV_32F);
+
+      cv::Matx44d Rt = cv::Matx44d::eye();
+      if (!Rt_in.empty())
+      {
+        CV_Assert(Rt_in.size() == cv::Size(4, 4) && Rt_in.channels() == 1);
+        Rt_in.getMat().convertTo(Rt, CV_64F);
+      }
+      for (size_t i = 0; i < previous_planes.size(); ++i)
+      {
+        const cv::Vec4f & plane = previous_planes[i];
+        cv::Vec3d n;
+        for (int j = 0; j < 3; ++j)
+          n[j] = Rt(j, 0) * plane[0] + Rt(j, 1) * plane[1] + Rt(j, 2) * plane[2];
+        const double d = plane[3] - (n[0] * Rt(0, 3) + n[1] * Rt(1, 3) + n[2] * Rt(2, 3));
+        previous_planes[i] = cv::Vec4f(n[0], n[1], n[2], d);
+      }
+
+      if (!previous_mask_in.empty())
+      {
+        const int previous_type = previous_mask_in.type();
+        CV_Assert(previous_mask_in.size() == points3d.size());
+        CV_Assert(previous_type == CV_8UC1 || previous_type == CV_16UC1 || previous_type == CV_32SC1);
+        previous_mask_in.getMat().convertTo(previous_labels, CV_32S);
+      }
+    }
+
+    // Look for planes with tiles of decreasing sizes: the smaller tiles are only made of the points the bigger ones
+    // could not explain
+    for (int level = 0; (level < block_levels_) && (index_plane < no_plane); ++level)
+    {
+      const int block_size = block_size_ >> level;
+      if (block_size < 2)
         break;
 
-      InlierFinder inlier_finder(threshold_, points3d, normals, index_plane, block_size_);
+      PlaneGrid plane_grid(points3d, labels, no_plane, block_size);
+      TileQueue plane_queue(plane_grid);
 
-      // Construct the plane for the first tile
-      int x = front_tile.x_, y = front_tile.y_;
-      const cv::Vec3f & n = plane_grid.n_(y, x);
-      cv::Ptr<PlaneBase> plane;
-      if ((sensor_error_a_ == 0) && (sensor_error_b_ == 0) && (sensor_error_c_ == 0))
-        plane = cv::Ptr<PlaneBase>(new Plane(plane_grid.m_(y, x), n, index_plane));
-      else
-        plane = cv::Ptr<PlaneBase>(new PlaneABC(plane_grid.m_(y, x), n, index_plane, sensor_error_a_, sensor_error_b_, sensor_error_c_));
+      // The planes of the previous frame are grown first, from the biggest tiles, in their order
+      size_t index_previous = previous_planes.size();
+      cv::Mat_<int> tile_labels;
+      if (level == 0)
+      {
+        index_previous = 0;
+        if (!previous_labels.empty())
+          tile_labels = computeTileLabels(previous_labels, plane_grid.mse_.size(), block_size);
+      }
+
+      // Then new ones from the most planar tiles left
+      while (index_plane < no_plane)
+      {
+        TileQueue::PlaneTile front_tile(0, 0, 0);
+        int previous_index = -1;
+        if (index_previous < previous_planes.size())
+        {
+          const size_t i = index_previous++;
+          previous_index = int(i);
+          if (!findTrackedSeed(plane_grid, plane_queue, tile_labels, int(i), previous_planes[i], threshold_, mse_min,
+                               front_tile))
+            continue;
+        }
+        else
+        {
+          // Get the first tile if it's good enough
+          if (plane_queue.empty())
+            break;
+          front_tile = plane_queue.front();
+          if (front_tile.mse_ > mse_min)
+            break;
+        }
 
-      cv::Mat_<unsigned char> plane_mask = cv::Mat_<unsigned char>::zeros(points3d.rows / block_size_,
-                                                                          points3d.cols / block_size_);
-      std::set<TileQueue::PlaneTile> neighboring_tiles;
-      neighboring_tiles.insert(front_tile);
-      plane_queue.remove(front_tile.y_, front_tile.x_);
+        InlierFinder inlier_finder(threshold_, points3d, normals, index_plane, no_plane, block_size);
 
-      // Process all the neighboring tiles
-      while (!neighboring_tiles.empty())
-        inlier_finder.Find(plane_grid, plane, plane_queue, neighboring_tiles, mask_out_uc, plane_mask);
+        // Construct the plane for the first tile
+        int x = front_tile.x_, y = front_tile.y_;
+        const cv::Vec3f & n = plane_grid.n_(y, x);
+        cv::Ptr<PlaneBase> plane;
+        if ((sensor_error_a_ == 0) && (sensor_error_b_ == 0) && (sensor_error_c_ == 0))
+          plane = cv::Ptr<PlaneBase>(new Plane(plane_grid.m_(y, x), n, index_plane));
+        else
+          plane = cv::Ptr<PlaneBase>(new PlaneABC(plane_grid.m_(y, x), n, index_plane, sensor_error_a_, sensor_error_b_, sensor_error_c_));
 
-      // Don't record the plane if it's empty
-      if (plane->empty())
-        continue;
-      // Don't record the plane if it's smaller than asked
-      if (plane->K() < min_size_) {
-        // Reset the plane index in the mask
-        for (y = 0; y < plane_mask.rows; ++y)
-          for (x = 0; x < plane_mask.cols; ++x) {
-            if (!plane_mask(y, x))
-              continue;
-            // Go over the tile
-            for (int yy = y * block_size_;
-                yy < std::min((y + 1) * block_size_, mask_out_uc.rows); ++yy) {
-              uchar* data = mask_out_uc.ptr(yy, x * block_size_);
-              uchar* data_end = data
-                  + std::min(block_size_,
-                      mask_out_uc.cols - x * block_size_);
-              for (; data != data_end; ++data) {
-                if (*data == index_plane)
-                  *data = 255;
+        cv::Mat_<unsigned char> plane_mask = cv::Mat_<unsigned char>::zeros(plane_grid.mse_.rows, plane_grid.mse_.cols);
+        std::set<TileQueue::PlaneTile> neighboring_tiles;
+        neighboring_tiles.insert(front_tile);
+        plane_queue.remove(front_tile.y_, front_tile.x_);
+
+        // Process all the neighboring tiles
+        while (!neighboring_tiles.empty())
+          inlier_finder.Find(plane_grid, plane, plane_queue, neighboring_tiles, labels, plane_mask);
+
+        // Don't record the plane if it's empty
+        if (plane->empty())
+          continue;
+        // Don't record the plane if it's smaller than asked
+        if (plane->K() < min_size_) {
+          // Reset the plane index in the mask
+          for (y = 0; y < plane_mask.rows; ++y)
+            for (x = 0; x < plane_mask.cols; ++x) {
+              if (!plane_mask(y, x))
+                continue;
+              // Go over the tile
+              for (int yy = y * block_size;
+                  yy < std::min((y + 1) * block_size, labels.rows); ++yy) {
+                int* data = labels[yy] + x * block_size;
+                int* data_end = data
+                    + std::min(block_size,
+                        labels.cols - x * block_size);
+                for (; data != data_end; ++data) {
+                  if (*data == index_plane)
+                    *data = no_plane;
+                }
               }
             }
-          }
-        continue;
+          continue;
+        }
+
+        ++index_plane;
+        cv::Vec4f coeffs(plane->n()[0], plane->n()[1], plane->n()[2], plane->d());
+        if (coeffs(2) > 0)
+          coeffs = -coeffs;
+        plane_coefficients.push_back(coeffs);
+        previous_indices.push_back(previous_index);
       }
+    }
 
-      ++index_plane;
-      if (index_plane >= 255)
-        break;
-      cv::Vec4f coeffs(plane->n()[0], plane->n()[1], plane->n()[2], plane->d());
-      if (coeffs(2) > 0)
-        coeffs = -coeffs;
-      plane_coefficients.push_back(coeffs);
-    };
+    if (mask_type_ != CV_32S)
+      labels.convertTo(mask_out_mat, mask_type_);
+
+    if (previous_indices_out.needed())
+    {
+      if (previous_indices.empty())
+        previous_indices_out.release();
+      else
+        cv::Mat(previous_indices).copyTo(previous_indices_out);
+    }
 
     // Fill the plane coefficients
     if (plane_coefficients.empty())
@@ -51,7 +51,8 @@ namespace cv
       obj.info()->addParam(obj, "window_size", obj.window_size_);
       obj.info()->addParam(obj, "depth", obj.depth_);
       obj.info()->addParam(obj, "K", obj.K_);
-      obj.info()->addParam(obj, "method", obj.method_))
+      obj.info()->addParam(obj, "method", obj.method_);
+      obj.info()->addParam(obj, "fals_m_inv", obj.fals_m_inv_))
 
   CV_INIT_ALGORITHM(RgbdPlane, "RGBD.RgbdPlane",
       obj.info()->addParam(obj, "block_size", obj.block_size_);
@@ -60,7 +61,9 @@ namespace cv
       obj.info()->addParam(obj, "threshold", obj.threshold_);
       obj.info()->addParam(obj, "sensor_error_a", obj.sensor_error_a_);
       obj.info()->addParam(obj, "sensor_error_b", obj.sensor_error_b_);
-      obj.info()->addParam(obj, "sensor_error_c", obj.sensor_error_c_))
+      obj.info()->addParam(obj, "sensor_error_c", obj.sensor_error_c_);
+      obj.info()->addParam(obj, "mask_type", obj.mask_type_);
+      obj.info()->addParam(obj, "block_levels", obj.block_levels_))
 
   CV_INIT_ALGORITHM(RgbdOdometry, "RGBD.RgbdOdometry",
       obj.info()->addParam(obj, "cameraMatrix", obj.cameraMatrix);
@@ -72,7 +75,9 @@ namespace cv
       obj.info()->addParam(obj, "maxPointsPart", obj.maxPointsPart);
       obj.info()->addParam(obj, "transformType", obj.transformType);
       obj.info()->addParam(obj, "maxTranslation", obj.maxTranslation);
-      obj.info()->addParam(obj, "maxRotation", obj.maxRotation);)
+      obj.info()->addParam(obj, "maxRotation", obj.maxRotation);
+      obj.info()->addParam(obj, "minIncrement", obj.minIncrement);
+      obj.info()->addParam(obj, "minResidualChange", obj.minResidualChange);)
 
   CV_INIT_ALGORITHM(ICPOdometry, "RGBD.ICPOdometry",
       obj.info()->addParam(obj, "cameraMatrix", obj.cameraMatrix);
@@ -84,6 +89,8 @@ namespace cv
       obj.info()->addParam(obj, "transformType", obj.transformType);
       obj.info()->addParam(obj, "maxTranslation", obj.maxTranslation);
       obj.info()->addParam(obj, "maxRotation", obj.maxRotation);
+      obj.info()->addParam(obj, "minIncrement", obj.minIncrement);
+      obj.info()->addParam(obj, "minResidualChange", obj.minResidualChange);
       obj.info()->addParam(obj, "normalsComputer", obj.normalsComputer, true);)
 
   CV_INIT_ALGORITHM(RgbdICPOdometry, "RGBD.RgbdICPOdometry",
@@ -97,6 +104,8 @@ namespace cv
       obj.info()->addParam(obj, "transformType", obj.transformType);
       obj.info()->addParam(obj, "maxTranslation", obj.maxTranslation);
       obj.info()->addParam(obj, "maxRotation", obj.maxRotation);
+      obj.info()->addParam(obj, "minIncrement", obj.minIncrement);
+      obj.info()->addParam(obj, "minResidualChange", obj.minResidualChange);
       obj.info()->addParam(obj, "normalsComputer", obj.normalsComputer, true);)
 
   bool
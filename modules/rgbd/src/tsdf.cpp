@@ -0,0 +1,821 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2012, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of Willow Garage, Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/rgbd.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+using namespace cv;
+
+/** Splits a pose (camera to world) into the rotation and translation from the world to the camera */
+static
+void invertPose(const Mat& pose, Matx33d& R, Vec3d& t)
+{
+    CV_Assert(pose.size() == Size(4,4) && (pose.type() == CV_32FC1 || pose.type() == CV_64FC1));
+    Matx44d pose_d;
+    pose.convertTo(pose_d, CV_64F);
+
+    // The inverse of a rigid body motion is [R^T, -R^T t]
+    for(int i = 0; i < 3; i++)
+        for(int j = 0; j < 3; j++)
+            R(i,j) = pose_d(j,i);
+    t = -(R * Vec3d(pose_d(0,3), pose_d(1,3), pose_d(2,3)));
+}
+
+/** Updates voxels with the depth of the pixel their center projects to, the centers being given in the
+ * camera coordinates */
+class VoxelIntegrator
+{
+public:
+    VoxelIntegrator(const Mat& _depth, const Mat& _mask, const Matx33d& K, float _truncationDistance, int maxWeight) :
+        depth(_depth), mask(_mask), fx(K(0,0)), fy(K(1,1)), cx(K(0,2)), cy(K(1,2)),
+        maxU(_depth.cols - 0.5), maxV(_depth.rows - 0.5), truncationDistance(_truncationDistance),
+        invTruncationDistance(1.f / _truncationDistance), weightLimit(static_cast<float>(maxWeight))
+    {}
+
+    inline void operator()(const Vec3d& p, Vec2f& voxel) const
+    {
+        if(p[2] <= 0)
+            return;
+
+        const double invZ = 1. / p[2];
+        const double u = fx * p[0] * invZ + cx, v = fy * p[1] * invZ + cy;
+        if(!(u > -0.5 && u < maxU && v > -0.5 && v < maxV))
+            return;
+        const int u_px = cvRound(u), v_px = cvRound(v);
+        if(!mask.empty() && !mask.at<uchar>(v_px, u_px))
+            return;
+
+        // NaN and missing depths fail the test
+        const float d = depth.at<float>(v_px, u_px);
+        if(!(d > 0))
+            return;
+
+        const float sdf = d - static_cast<float>(p[2]);
+        if(sdf < -truncationDistance)
+            return;
+
+        const float tsdf = std::min(1.f, sdf * invTruncationDistance);
+        const float weight = voxel[1];
+        voxel[0] = (voxel[0] * weight + tsdf) / (weight + 1.f);
+        voxel[1] = std::min(weight + 1.f, weightLimit);
+    }
+
+private:
+    VoxelIntegrator& operator=(const VoxelIntegrator&);
+
+    const Mat& depth;
+    const Mat& mask;
+    double fx, fy, cx, cy;
+    double maxU, maxV;
+    float truncationDistance, invTruncationDistance;
+    float weightLimit;
+};
+
+/** Fuses a depth image into some slabs of constant z of a TSDF volume */
+class TsdfIntegrateInvoker : public ParallelLoopBody
+{
+public:
+    TsdfIntegrateInvoker(const VoxelIntegrator& _integrator, const Matx33d& _R, const Vec3d& _t,
+                         const Vec3i& _resolution, float _voxelSize, const Vec3f& _origin, Mat& _volume) :
+        integrator(_integrator), R(_R), t(_t), resolution(_resolution), voxelSize(_voxelSize), origin(_origin),
+        volume(_volume)
+    {}
+
+    virtual void operator()(const Range& range) const
+    {
+        // The camera coordinates of a voxel move by a column of R at every step along x
+        const Vec3d step = Vec3d(R(0,0), R(1,0), R(2,0)) * voxelSize;
+
+        for(int z = range.start; z < range.end; z++)
+        {
+            for(int y = 0; y < resolution[1]; y++)
+            {
+                const Vec3d firstVoxel(origin[0] + 0.5 * voxelSize,
+                                       origin[1] + (y + 0.5) * voxelSize,
+                                       origin[2] + (z + 0.5) * voxelSize);
+                const Vec3d firstPoint = R * firstVoxel + t;
+                Vec2f* voxels = volume.ptr<Vec2f>(z * resolution[1] + y);
+                for(int x = 0; x < resolution[0]; x++)
+                    integrator(firstPoint + step * x, voxels[x]);
+            }
+        }
+    }
+
+private:
+    TsdfIntegrateInvoker& operator=(const TsdfIntegrateInvoker&);
+
+    VoxelIntegrator integrator;
+    Matx33d R;
+    Vec3d t;
+    Vec3i resolution;
+    float voxelSize;
+    Vec3f origin;
+    Mat& volume;
+};
+
+/** Trilinear interpolation of the TSDF at a point given in voxels (the voxel centers are at integer coordinates).
+ * It fails if the point is out of the volume or if one of the voxels around it was never observed.
+ */
+static inline
+bool interpolateTsdf(const Vec2f* voxels, const Vec3i& resolution, const Vec3d& p, float& value)
+{
+    if(!(p[0] >= 0 && p[0] <= resolution[0] - 1 && p[1] >= 0 && p[1] <= resolution[1] - 1 &&
+         p[2] >= 0 && p[2] <= resolution[2] - 1))
+        return false;
+
+    const int x = std::min(cvFloor(p[0]), resolution[0] - 2),
+              y = std::min(cvFloor(p[1]), resolution[1] - 2),
+              z = std::min(cvFloor(p[2]), resolution[2] - 2);
+    const float tx = static_cast<float>(p[0] - x), ty = static_cast<float>(p[1] - y), tz = static_cast<float>(p[2] - z);
+
+    const int dy = resolution[0], dz = resolution[0] * resolution[1];
+    const Vec2f* v = voxels + z * dz + y * dy + x;
+    if(v[0][1] == 0 || v[1][1] == 0 || v[dy][1] == 0 || v[dy + 1][1] == 0 ||
+       v[dz][1] == 0 || v[dz + 1][1] == 0 || v[dz + dy][1] == 0 || v[dz + dy + 1][1] == 0)
+        return false;
+
+    const float v00 = v[0][0] + tx * (v[1][0] - v[0][0]);
+    const float v10 = v[dy][0] + tx * (v[dy + 1][0] - v[dy][0]);
+    const float v01 = v[dz][0] + tx * (v[dz + 1][0] - v[dz][0]);
+    const float v11 = v[dz + dy][0] + tx * (v[dz + dy + 1][0] - v[dz + dy][0]);
+    const float v0 = v00 + ty * (v10 - v00), v1 = v01 + ty * (v11 - v01);
+    value = v0 + tz * (v1 - v0);
+    return true;
+}
+
+/** Casts the rays of some rows of a frame into a TSDF volume, and keeps the first crossing of the surface
+ * from the front */
+class TsdfRaycastInvoker : public ParallelLoopBody
+{
+public:
+    TsdfRaycastInvoker(const Mat& _volume, const Matx33d& _K, const Matx44d& _pose,
+                       const Vec3i& _resolution, float _voxelSize, const Vec3f& _origin, float _truncationDistance,
+                       Mat& _depth, Mat& _cloud, Mat& _normals) :
+        volume(_volume), K(_K), pose(_pose), resolution(_resolution), voxelSize(_voxelSize), origin(_origin),
+        truncationDistance(_truncationDistance), depth(_depth), cloud(_cloud), normals(_normals)
+    {}
+
+    virtual void operator()(const Range& range) const
+    {
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        const double fx = K(0,0), fy = K(1,1), cx = K(0,2), cy = K(1,2);
+        const Vec2f* voxels = volume.ptr<Vec2f>();
+        const Matx33d R(pose(0,0), pose(0,1), pose(0,2),
+                        pose(1,0), pose(1,1), pose(1,2),
+                        pose(2,0), pose(2,1), pose(2,2));
+        const double invVoxelSize = 1. / voxelSize;
+
+        // The rays are parametrized by the depth: the point of depth t is at cameraCenter + t * R * (x', y', 1),
+        // and everything is done in voxels
+        const Vec3d cameraCenter = (Vec3d(pose(0,3), pose(1,3), pose(2,3)) - Vec3d(origin)) * invVoxelSize -
+                                   Vec3d(0.5, 0.5, 0.5);
+        // Far from the surface the steps are almost the truncation distance, near it they are half a voxel
+        const double farStep = 0.8 * truncationDistance * invVoxelSize, nearStep = 0.5;
+
+        for(int y = range.start; y < range.end; y++)
+        {
+            float* depth_row = depth.ptr<float>(y);
+            Vec3f* cloud_row = cloud.ptr<Vec3f>(y);
+            Vec3f* normals_row = normals.ptr<Vec3f>(y);
+            for(int x = 0; x < depth.cols; x++)
+            {
+                depth_row[x] = nan;
+                cloud_row[x] = Vec3f(nan, nan, nan);
+                normals_row[x] = Vec3f(nan, nan, nan);
+
+                const Vec3d cameraDir((x - cx) / fx, (y - cy) / fy, 1.);
+                const Vec3d dir = R * cameraDir * invVoxelSize;
+                const double invDirNorm = 1. / norm(dir);
+
+                // Clip the ray to the box of the voxel centers
+                double tMin = 0, tMax = std::numeric_limits<double>::max();
+                bool isInside = true;
+                for(int i = 0; i < 3 && isInside; i++)
+                {
+                    if(std::abs(dir[i]) < std::numeric_limits<double>::epsilon())
+                        isInside = cameraCenter[i] >= 0 && cameraCenter[i] <= resolution[i] - 1;
+                    else
+                    {
+                        const double t0 = -cameraCenter[i] / dir[i], t1 = (resolution[i] - 1 - cameraCenter[i]) / dir[i];
+                        tMin = std::max(tMin, std::min(t0, t1));
+                        tMax = std::min(tMax, std::max(t0, t1));
+                    }
+                }
+                if(!isInside || tMin >= tMax)
+                    continue;
+
+                // March until the TSDF changes from positive to negative, any other sign change stops the ray
+                double t = tMin, tPrev = 0;
+                float value = 0, valuePrev = 0;
+                bool isPrevValid = false, isHit = false;
+                while(t <= tMax)
+                {
+                    const bool isValid = interpolateTsdf(voxels, resolution, cameraCenter + dir * t, value);
+                    if(isValid)
+                    {
+                        if(value <= 0)
+                        {
+                            isHit = isPrevValid;
+                            break;
+                        }
+                        isPrevValid = true;
+                        valuePrev = value;
+                        tPrev = t;
+                        t += std::max(value * farStep, nearStep) * invDirNorm;
+                    }
+                    else
+                    {
+                        isPrevValid = false;
+                        t += farStep * invDirNorm;
+                    }
+                }
+                if(!isHit)
+                    continue;
+
+                // Linear interpolation of the zero crossing
+                const double tHit = tPrev + (t - tPrev) * valuePrev / (valuePrev - value);
+                const Vec3d p = cameraCenter + dir * tHit;
+
+                // The normal is the gradient of the TSDF, rotated to the camera coordinates
+                float g[6];
+                bool isNormalValid = true;
+                for(int i = 0; i < 3 && isNormalValid; i++)
+                {
+                    Vec3d delta;
+                    delta[i] = 1;
+                    isNormalValid = interpolateTsdf(voxels, resolution, p + delta, g[2*i]) &&
+                                    interpolateTsdf(voxels, resolution, p - delta, g[2*i + 1]);
+                }
+
+                depth_row[x] = static_cast<float>(tHit);
+                cloud_row[x] = Vec3f(cameraDir * tHit);
+                if(isNormalValid)
+                {
+                    const Vec3d n = R.t() * Vec3d(g[0] - g[1], g[2] - g[3], g[4] - g[5]);
+                    const double n_norm = norm(n);
+                    if(n_norm > 0)
+                        normals_row[x] = Vec3f(n * (1. / n_norm));
+                }
+            }
+        }
+    }
+
+private:
+    TsdfRaycastInvoker& operator=(const TsdfRaycastInvoker&);
+
+    const Mat& volume;
+    Matx33d K;
+    Matx44d pose;
+    Vec3i resolution;
+    float voxelSize;
+    Vec3f origin;
+    float truncationDistance;
+    Mat& depth;
+    Mat& cloud;
+    Mat& normals;
+};
+
+/** Hash of the coordinates of a block, from the voxel hashing paper */
+static inline
+size_t hashBlockCoords(const Vec3i& b)
+{
+    return static_cast<size_t>((static_cast<unsigned>(b[0]) * 73856093u) ^ (static_cast<unsigned>(b[1]) * 19349669u) ^
+                               (static_cast<unsigned>(b[2]) * 83492791u));
+}
+
+/** Finds the index of a block, -1 if it is not allocated */
+static inline
+int findBlock(const std::vector<int>& hashTable, const std::vector<Vec3i>& blockCoords, const Vec3i& b)
+{
+    if(hashTable.empty())
+        return -1;
+
+    // The table is never more than half full, so a free entry ends the probing
+    const size_t mask = hashTable.size() - 1;
+    for(size_t i = hashBlockCoords(b) & mask; ; i = (i + 1) & mask)
+    {
+        const int index = hashTable[i];
+        if(index < 0 || blockCoords[index] == b)
+            return index;
+    }
+}
+
+static inline
+void insertBlockIndex(std::vector<int>& hashTable, const Vec3i& b, int index)
+{
+    const size_t mask = hashTable.size() - 1;
+    size_t i = hashBlockCoords(b) & mask;
+    while(hashTable[i] >= 0)
+        i = (i + 1) & mask;
+    hashTable[i] = index;
+}
+
+/** Returns the index of a block, allocating it if needed */
+static
+int allocateBlock(std::vector<int>& hashTable, std::vector<Vec3i>& blockCoords, std::vector<Vec2f>& voxels,
+                  int blockVoxelsCount, const Vec3i& b)
+{
+    int index = findBlock(hashTable, blockCoords, b);
+    if(index >= 0)
+        return index;
+
+    if(2 * (blockCoords.size() + 1) > hashTable.size())
+    {
+        hashTable.assign(std::max(hashTable.size() * 2, size_t(1024)), -1);
+        for(size_t i = 0; i < blockCoords.size(); i++)
+            insertBlockIndex(hashTable, blockCoords[i], static_cast<int>(i));
+    }
+
+    index = static_cast<int>(blockCoords.size());
+    blockCoords.push_back(b);
+    insertBlockIndex(hashTable, b, index);
+    // The distance of the voxels that were never observed does not matter, their weight is 0
+    voxels.resize(voxels.size() + blockVoxelsCount, Vec2f(1.f, 0.f));
+    return index;
+}
+
+struct BlockCoordsLess
+{
+    bool operator()(const Vec3i& a, const Vec3i& b) const
+    {
+        if(a[2] != b[2])
+            return a[2] < b[2];
+        if(a[1] != b[1])
+            return a[1] < b[1];
+        return a[0] < b[0];
+    }
+};
+
+static inline
+int floorDiv(int a, int b)
+{
+    return a >= 0 ? a / b : -((-a - 1) / b) - 1;
+}
+
+/** Finds the blocks crossed by the truncation band around the points of some stripes of rows of a cloud */
+class HashTsdfAllocateInvoker : public ParallelLoopBody
+{
+public:
+    HashTsdfAllocateInvoker(const Mat& _points3d, const Matx33d& _R, const Vec3d& _t, float _blockSide,
+                            float _voxelSize, float _truncationDistance, int _rowsPerStripe,
+                            std::vector<std::vector<Vec3i> >& _stripeBlocks) :
+        points3d(_points3d), R(_R), t(_t), blockSide(_blockSide), voxelSize(_voxelSize),
+        truncationDistance(_truncationDistance), rowsPerStripe(_rowsPerStripe), stripeBlocks(_stripeBlocks)
+    {}
+
+    virtual void operator()(const Range& range) const
+    {
+        const double invBlockSide = 1. / blockSide;
+        // The band is sampled every voxel along the ray, the distances being along the camera axis as in the voxels
+        const int samplesCount = cvCeil(truncationDistance / voxelSize);
+        const double sampleStep = truncationDistance / samplesCount;
+
+        for(int stripe = range.start; stripe < range.end; stripe++)
+        {
+            std::vector<Vec3i>& blocks = stripeBlocks[stripe];
+            blocks.clear();
+
+            const int rowEnd = std::min((stripe + 1) * rowsPerStripe, points3d.rows);
+            for(int y = stripe * rowsPerStripe; y < rowEnd; y++)
+            {
+                const Vec3f* points_row = points3d.ptr<Vec3f>(y);
+                for(int x = 0; x < points3d.cols; x++)
+                {
+                    const Vec3d p = points_row[x];
+                    // NaN points fail the test
+                    if(!(p[2] > 0))
+                        continue;
+
+                    const Vec3d point = R * p + t, dir = R * p * (1. / p[2]);
+                    Vec3i previousBlock(std::numeric_limits<int>::max(), 0, 0);
+                    for(int i = -samplesCount; i <= samplesCount; i++)
+                    {
+                        const Vec3d sample = point + dir * (i * sampleStep);
+                        const Vec3i block(cvFloor(sample[0] * invBlockSide), cvFloor(sample[1] * invBlockSide),
+                                          cvFloor(sample[2] * invBlockSide));
+                        if(block != previousBlock)
+                        {
+                            blocks.push_back(block);
+                            previousBlock = block;
+                        }
+                    }
+                }
+            }
+
+            std::sort(blocks.begin(), blocks.end(), BlockCoordsLess());
+            blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+        }
+    }
+
+private:
+    HashTsdfAllocateInvoker& operator=(const HashTsdfAllocateInvoker&);
+
+    const Mat& points3d;
+    Matx33d R;
+    Vec3d t;
+    float blockSide, voxelSize, truncationDistance;
+    int rowsPerStripe;
+    std::vector<std::vector<Vec3i> >& stripeBlocks;
+};
+
+/** Fuses a depth image into some blocks of a hashed TSDF */
+class HashTsdfIntegrateInvoker : public ParallelLoopBody
+{
+public:
+    HashTsdfIntegrateInvoker(const VoxelIntegrator& _integrator, const Matx33d& _R, const Vec3d& _t,
+                             const std::vector<int>& _blockIndices, const std::vector<Vec3i>& _blockCoords,
+                             int _blockSize, float _voxelSize, Vec2f* _voxels) :
+        integrator(_integrator), R(_R), t(_t), blockIndices(_blockIndices), blockCoords(_blockCoords),
+        blockSize(_blockSize), voxelSize(_voxelSize), voxels(_voxels)
+    {}
+
+    virtual void operator()(const Range& range) const
+    {
+        const Vec3d step = Vec3d(R(0,0), R(1,0), R(2,0)) * voxelSize;
+
+        for(int i = range.start; i < range.end; i++)
+        {
+            const int index = blockIndices[i];
+            const Vec3i firstVoxel = blockCoords[index] * blockSize;
+            Vec2f* blockVoxels = voxels + static_cast<size_t>(index) * blockSize * blockSize * blockSize;
+            for(int z = 0; z < blockSize; z++)
+            {
+                for(int y = 0; y < blockSize; y++, blockVoxels += blockSize)
+                {
+                    const Vec3d firstCenter((firstVoxel[0] + 0.5) * voxelSize,
+                                            (firstVoxel[1] + y + 0.5) * voxelSize,
+                                            (firstVoxel[2] + z + 0.5) * voxelSize);
+                    const Vec3d firstPoint = R * firstCenter + t;
+                    for(int x = 0; x < blockSize; x++)
+                        integrator(firstPoint + step * x, blockVoxels[x]);
+                }
+            }
+        }
+    }
+
+private:
+    HashTsdfIntegrateInvoker& operator=(const HashTsdfIntegrateInvoker&);
+
+    VoxelIntegrator integrator;
+    Matx33d R;
+    Vec3d t;
+    const std::vector<int>& blockIndices;
+    const std::vector<Vec3i>& blockCoords;
+    int blockSize;
+    float voxelSize;
+    Vec2f* voxels;
+};
+
+/** Extracts the zero crossings of the TSDF between the voxels of some blocks and their next neighbors */
+class HashTsdfSurfaceInvoker : public ParallelLoopBody
+{
+public:
+    HashTsdfSurfaceInvoker(const std::vector<int>& _hashTable, const std::vector<Vec3i>& _blockCoords,
+                           const std::vector<Vec2f>& _voxels, int _blockSize, float _voxelSize, int _firstBlock,
+                           std::vector<std::vector<Vec3f> >& _blockPoints,
+                           std::vector<std::vector<Vec3f> >& _blockNormals) :
+        hashTable(_hashTable), blockCoords(_blockCoords), voxels(_voxels), blockSize(_blockSize),
+        voxelSize(_voxelSize), firstBlock(_firstBlock), blockPoints(_blockPoints), blockNormals(_blockNormals)
+    {}
+
+    virtual void operator()(const Range& range) const
+    {
+        for(int i = range.start; i < range.end; i++)
+        {
+            const int index = firstBlock + i;
+            const Vec3i firstVoxel = blockCoords[index] * blockSize;
+            std::vector<Vec3f>& points = blockPoints[i];
+            std::vector<Vec3f>& normals = blockNormals[i];
+            points.clear();
+            normals.clear();
+
+            const Vec2f* blockVoxels = &voxels[static_cast<size_t>(index) * blockSize * blockSize * blockSize];
+            for(int z = 0; z < blockSize; z++)
+            {
+                for(int y = 0; y < blockSize; y++)
+                {
+                    for(int x = 0; x < blockSize; x++)
+                    {
+                        const Vec3i g = firstVoxel + Vec3i(x, y, z);
+                        const Vec2f& voxel = blockVoxels[(z * blockSize + y) * blockSize + x];
+                        // The crossings with the truncated distances are the borders of the observed space
+                        const float value = voxel[0];
+                        if(voxel[1] == 0 || !(std::abs(value) < 1.f))
+                            continue;
+
+                        bool isNormalComputed = false;
+                        Vec3f normal;
+                        for(int axis = 0; axis < 3; axis++)
+                        {
+                            Vec3i delta;
+                            delta[axis] = 1;
+                            const Vec2f* neighbor = findVoxel(index, firstVoxel, g + delta);
+                            if(!neighbor || (*neighbor)[1] == 0 || !(std::abs((*neighbor)[0]) < 1.f) ||
+                               (value > 0) == ((*neighbor)[0] > 0))
+                                continue;
+
+                            if(!isNormalComputed)
+                            {
+                                normal = computeNormal(index, firstVoxel, g);
+                                isNormalComputed = true;
+                            }
+                            Vec3f point((g[0] + 0.5f) * voxelSize, (g[1] + 0.5f) * voxelSize, (g[2] + 0.5f) * voxelSize);
+                            point[axis] += voxelSize * value / (value - (*neighbor)[0]);
+                            points.push_back(point);
+                            normals.push_back(normal);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    HashTsdfSurfaceInvoker& operator=(const HashTsdfSurfaceInvoker&);
+
+    /** The voxel of global coordinates g, 0 if its block is not allocated. The blocks of the neighbors are looked
+     * for only if they are not in the block of the given first voxel */
+    inline const Vec2f* findVoxel(int index, const Vec3i& firstVoxel, const Vec3i& g) const
+    {
+        Vec3i local = g - firstVoxel;
+        if(local[0] < 0 || local[0] >= blockSize || local[1] < 0 || local[1] >= blockSize ||
+           local[2] < 0 || local[2] >= blockSize)
+        {
+            const Vec3i b(floorDiv(g[0], blockSize), floorDiv(g[1], blockSize), floorDiv(g[2], blockSize));
+            index = ::findBlock(hashTable, blockCoords, b);
+            if(index < 0)
+                return 0;
+            local = g - b * blockSize;
+        }
+        return &voxels[((static_cast<size_t>(index) * blockSize + local[2]) * blockSize + local[1]) * blockSize +
+                       local[0]];
+    }
+
+    /** The normalized gradient of the TSDF at a voxel, by central differences, NaN if a neighbor was not observed */
+    inline Vec3f computeNormal(int index, const Vec3i& firstVoxel, const Vec3i& g) const
+    {
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        Vec3f gradient;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            Vec3i delta;
+            delta[axis] = 1;
+            const Vec2f* next = findVoxel(index, firstVoxel, g + delta);
+            const Vec2f* previous = findVoxel(index, firstVoxel, g - delta);
+            if(!next || !previous || (*next)[1] == 0 || (*previous)[1] == 0)
+                return Vec3f(nan, nan, nan);
+            gradient[axis] = (*next)[0] - (*previous)[0];
+        }
+        const float gradientNorm = static_cast<float>(norm(gradient));
+        if(gradientNorm == 0)
+            return Vec3f(nan, nan, nan);
+        return gradient * (1.f / gradientNorm);
+    }
+
+    const std::vector<int>& hashTable;
+    const std::vector<Vec3i>& blockCoords;
+    const std::vector<Vec2f>& voxels;
+    int blockSize;
+    float voxelSize;
+    int firstBlock;
+    std::vector<std::vector<Vec3f> >& blockPoints;
+    std::vector<std::vector<Vec3f> >& blockNormals;
+};
+
+namespace cv
+{
+
+TsdfVolume::TsdfVolume() :
+    resolution(), voxelSize(0.f), origin(), truncationDistance(DEFAULT_TRUNCATION_DISTANCE()),
+    maxWeight(DEFAULT_MAX_WEIGHT())
+{}
+
+TsdfVolume::TsdfVolume(const Vec3i& _resolution, float _voxelSize, const Vec3f& _origin,
+                       float _truncationDistance, int _maxWeight) :
+    resolution(_resolution), voxelSize(_voxelSize), origin(_origin), truncationDistance(_truncationDistance),
+    maxWeight(_maxWeight)
+{
+    // The interpolation needs 2 voxels along every axis
+    CV_Assert(resolution[0] >= 2 && resolution[1] >= 2 && resolution[2] >= 2);
+    CV_Assert(voxelSize > 0 && truncationDistance > 0 && maxWeight > 0);
+    reset();
+}
+
+void TsdfVolume::integrate(const RgbdFrame& frame, const Mat& cameraMatrix, const Mat& pose)
+{
+    if(volume.empty())
+        CV_Error(CV_StsBadArg, "The volume is not allocated.");
+    if(frame.depth.empty())
+        CV_Error(CV_StsBadSize, "Depth is empty.");
+    if(!frame.mask.empty() && (frame.mask.size() != frame.depth.size() || frame.mask.type() != CV_8UC1))
+        CV_Error(CV_StsBadSize, "Mask has to be of CV_8UC1 type and of the depth size.");
+    CV_Assert(cameraMatrix.size() == Size(3,3));
+
+    Mat depth = frame.depth;
+    if(depth.type() != CV_32FC1)
+        rescaleDepth(frame.depth, CV_32F, depth);
+
+    Matx33d K, R;
+    Vec3d t;
+    cameraMatrix.convertTo(K, CV_64F);
+    invertPose(pose, R, t);
+
+    parallel_for_(Range(0, resolution[2]),
+                  TsdfIntegrateInvoker(VoxelIntegrator(depth, frame.mask, K, truncationDistance, maxWeight),
+                                       R, t, resolution, voxelSize, origin, volume));
+}
+
+void TsdfVolume::raycast(const Mat& cameraMatrix, const Mat& pose, const Size& frameSize, int levelsCount,
+                         OdometryFrame& frame) const
+{
+    if(volume.empty())
+        CV_Error(CV_StsBadArg, "The volume is not allocated.");
+    CV_Assert(cameraMatrix.size() == Size(3,3));
+    CV_Assert(pose.size() == Size(4,4) && (pose.type() == CV_32FC1 || pose.type() == CV_64FC1));
+    CV_Assert(frameSize.area() > 0 && levelsCount > 0);
+
+    Matx33d K;
+    Matx44d pose_d;
+    cameraMatrix.convertTo(K, CV_64F);
+    pose.convertTo(pose_d, CV_64F);
+
+    frame.release();
+    frame.pyramidDepth.resize(levelsCount);
+    frame.pyramidCloud.resize(levelsCount);
+    frame.pyramidNormals.resize(levelsCount);
+
+    // The levels have the sizes of pyrDown and the camera matrices of the Odometry pyramids
+    Size levelSize = frameSize;
+    for(int level = 0; level < levelsCount; level++)
+    {
+        if(level > 0)
+        {
+            levelSize = Size((levelSize.width + 1) / 2, (levelSize.height + 1) / 2);
+            K = K * 0.5;
+            K(2,2) = 1.;
+        }
+
+        Mat& levelDepth = frame.pyramidDepth[level];
+        Mat& levelCloud = frame.pyramidCloud[level];
+        Mat& levelNormals = frame.pyramidNormals[level];
+        levelDepth.create(levelSize, CV_32FC1);
+        levelCloud.create(levelSize, CV_32FC3);
+        levelNormals.create(levelSize, CV_32FC3);
+
+        parallel_for_(Range(0, levelSize.height),
+                      TsdfRaycastInvoker(volume, K, pose_d, resolution, voxelSize, origin, truncationDistance,
+                                         levelDepth, levelCloud, levelNormals));
+    }
+
+    frame.depth = frame.pyramidDepth[0];
+    frame.normals = frame.pyramidNormals[0];
+}
+
+void TsdfVolume::reset()
+{
+    if(resolution[0] <= 0 || resolution[1] <= 0 || resolution[2] <= 0)
+    {
+        volume.release();
+        return;
+    }
+
+    // The distance of the voxels that were never observed does not matter, their weight is 0
+    volume.create(resolution[2] * resolution[1], resolution[0], CV_32FC2);
+    volume.setTo(Scalar(1.f, 0.f));
+}
+
+HashTsdfVolume::HashTsdfVolume() :
+    voxelSize(0.f), truncationDistance(TsdfVolume::DEFAULT_TRUNCATION_DISTANCE()),
+    maxWeight(TsdfVolume::DEFAULT_MAX_WEIGHT()), blockSize(DEFAULT_BLOCK_SIZE())
+{}
+
+HashTsdfVolume::HashTsdfVolume(float _voxelSize, float _truncationDistance, int _maxWeight, int _blockSize) :
+    voxelSize(_voxelSize), truncationDistance(_truncationDistance), maxWeight(_maxWeight), blockSize(_blockSize)
+{
+    CV_Assert(voxelSize > 0 && truncationDistance > 0 && maxWeight > 0 && blockSize > 0);
+}
+
+void HashTsdfVolume::integrate(const Mat& points3d, const Mat& cameraMatrix, const Mat& pose)
+{
+    if(voxelSize <= 0)
+        CV_Error(CV_StsBadArg, "The voxel size is not set.");
+    if(points3d.empty() || points3d.type() != CV_32FC3)
+        CV_Error(CV_StsBadSize, "points3d has to be an organized cloud of CV_32FC3 type.");
+    CV_Assert(cameraMatrix.size() == Size(3,3));
+    CV_Assert(pose.size() == Size(4,4) && (pose.type() == CV_32FC1 || pose.type() == CV_64FC1));
+
+    Matx44d pose_d;
+    pose.convertTo(pose_d, CV_64F);
+    const Matx33d cameraToWorldR(pose_d(0,0), pose_d(0,1), pose_d(0,2),
+                                 pose_d(1,0), pose_d(1,1), pose_d(1,2),
+                                 pose_d(2,0), pose_d(2,1), pose_d(2,2));
+    const Vec3d cameraToWorldT(pose_d(0,3), pose_d(1,3), pose_d(2,3));
+
+    // Find the blocks of the truncation band of every stripe of rows in parallel
+    const int rowsPerStripe = 16;
+    const int stripesCount = (points3d.rows + rowsPerStripe - 1) / rowsPerStripe;
+    std::vector<std::vector<Vec3i> > stripeBlocks(stripesCount);
+    parallel_for_(Range(0, stripesCount),
+                  HashTsdfAllocateInvoker(points3d, cameraToWorldR, cameraToWorldT, voxelSize * blockSize, voxelSize,
+                                          truncationDistance, rowsPerStripe, stripeBlocks));
+
+    // Only the insertion in the hash table is sequential, on the blocks found by the stripes
+    std::vector<Vec3i> frameBlocks;
+    for(int stripe = 0; stripe < stripesCount; stripe++)
+        frameBlocks.insert(frameBlocks.end(), stripeBlocks[stripe].begin(), stripeBlocks[stripe].end());
+    std::sort(frameBlocks.begin(), frameBlocks.end(), BlockCoordsLess());
+    frameBlocks.erase(std::unique(frameBlocks.begin(), frameBlocks.end()), frameBlocks.end());
+    if(frameBlocks.empty())
+        return;
+
+    const int blockVoxelsCount = blockSize * blockSize * blockSize;
+    std::vector<int> frameBlockIndices(frameBlocks.size());
+    for(size_t i = 0; i < frameBlocks.size(); i++)
+        frameBlockIndices[i] = allocateBlock(hashTable, blockCoords, voxels, blockVoxelsCount, frameBlocks[i]);
+
+    // Update the voxels of the blocks seen by the frame
+    Mat depth;
+    extractChannel(points3d, depth, 2);
+    Matx33d K, R;
+    Vec3d t;
+    cameraMatrix.convertTo(K, CV_64F);
+    invertPose(pose, R, t);
+
+    parallel_for_(Range(0, static_cast<int>(frameBlockIndices.size())),
+                  HashTsdfIntegrateInvoker(VoxelIntegrator(depth, Mat(), K, truncationDistance, maxWeight), R, t,
+                                           frameBlockIndices, blockCoords, blockSize, voxelSize, &voxels[0]));
+}
+
+void HashTsdfVolume::exportSurface(int firstBlock, int blocksCount, Mat& points, Mat& normals) const
+{
+    CV_Assert(firstBlock >= 0 && firstBlock <= getBlocksCount());
+    if(blocksCount < 0 || firstBlock + blocksCount > getBlocksCount())
+        blocksCount = getBlocksCount() - firstBlock;
+
+    std::vector<std::vector<Vec3f> > blockPoints(blocksCount), blockNormals(blocksCount);
+    parallel_for_(Range(0, blocksCount),
+                  HashTsdfSurfaceInvoker(hashTable, blockCoords, voxels, blockSize, voxelSize, firstBlock,
+                                         blockPoints, blockNormals));
+
+    int pointsCount = 0;
+    for(int i = 0; i < blocksCount; i++)
+        pointsCount += static_cast<int>(blockPoints[i].size());
+
+    points.create(1, pointsCount, CV_32FC3);
+    normals.create(1, pointsCount, CV_32FC3);
+    Vec3f* points_ptr = points.ptr<Vec3f>();
+    Vec3f* normals_ptr = normals.ptr<Vec3f>();
+    for(int i = 0; i < blocksCount; i++)
+    {
+        std::copy(blockPoints[i].begin(), blockPoints[i].end(), points_ptr);
+        std::copy(blockNormals[i].begin(), blockNormals[i].end(), normals_ptr);
+        points_ptr += blockPoints[i].size();
+        normals_ptr += blockNormals[i].size();
+    }
+}
+
+void HashTsdfVolume::reset()
+{
+    std::vector<Vec3i>().swap(blockCoords);
+    std::vector<int>().swap(hashTable);
+    std::vector<Vec2f>().swap(voxels);
+}
+
+} // namespace cv
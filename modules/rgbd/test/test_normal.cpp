@@ -176,9 +176,10 @@ protected:
     try
     {
       cv::Mat_<unsigned char> plane_mask;
-      for (unsigned char i = 0; i < 3; ++i)
+      for (unsigned char i = 0; i < 4; ++i)
       {
         cv::RgbdNormals::RGBD_NORMALS_METHOD method;
+        int fals_m_inv = cv::RgbdNormals::RGBD_NORMALS_FALS_M_INV_FULL;
         // inner vector: whether it's 1 plane or 3 planes
         // outer vector: float or double
         std::vector<std::vector<float> > errors(2);
@@ -210,6 +211,15 @@ protected:
             errors[1][0] = 0.02;
             errors[1][1] = 0.04;
             break;
+          case 3:
+            method = cv::RgbdNormals::RGBD_NORMALS_METHOD_FALS;
+            fals_m_inv = cv::RgbdNormals::RGBD_NORMALS_FALS_M_INV_RECOMPUTE;
+            std::cout << std::endl << "*** FALS, M_inv recomputed" << std::endl;
+            errors[0][0] = 0.006;
+            errors[0][1] = 0.03;
+            errors[1][0] = 0.00008;
+            errors[1][1] = 0.02;
+            break;
         }
 
         for (unsigned char j = 0; j < 2; ++j)
@@ -221,6 +231,7 @@ protected:
             std::cout << "* double" << std::endl;
 
           cv::RgbdNormals normals_computer(H, W, depth, K, 5, method);
+          normals_computer.set("fals_m_inv", fals_m_inv);
           normals_computer.initialize();
 
           std::vector<Plane> plane_params;
@@ -413,3 +424,160 @@ TEST(Rgbd_Plane, compute)
   CV_RgbdPlaneTest test;
   test.safe_run();
 }
+
+TEST(Rgbd_Plane, planar_points)
+{
+  std::vector<Plane> planes;
+  cv::Mat points3d, ground_normals;
+  cv::Mat_<unsigned char> plane_mask;
+  gen_points_3d(planes, plane_mask, points3d, ground_normals, 3);
+  std::vector<cv::Mat> points3d_planes;
+  cv::split(points3d, points3d_planes);
+
+  // The normals of the planar points are the ones of the interleaved points
+  cv::RgbdNormals normals_computer(H, W, CV_32F, K, 5, cv::RgbdNormals::RGBD_NORMALS_METHOD_FALS);
+  cv::Mat normals, normals_planar;
+  normals_computer(points3d, normals);
+  normals_computer(points3d_planes, normals_planar);
+  ASSERT_EQ(cv::norm(normals, normals_planar, cv::NORM_INF), 0);
+
+  // And so are the planes
+  cv::RgbdPlane plane_computer;
+  cv::Mat mask, mask_planar;
+  std::vector<cv::Vec4f> coefficients, coefficients_planar;
+  plane_computer(points3d, normals, mask, coefficients);
+  plane_computer(points3d_planes, normals, mask_planar, coefficients_planar);
+  ASSERT_EQ(cv::countNonZero(mask != mask_planar), 0);
+  ASSERT_EQ(coefficients.size(), coefficients_planar.size());
+  for (size_t i = 0; i < coefficients.size(); ++i)
+    EXPECT_EQ(coefficients[i], coefficients_planar[i]);
+}
+
+TEST(Rgbd_Plane, track)
+{
+  std::vector<Plane> planes;
+  cv::Mat points3d, ground_normals;
+  cv::Mat_<unsigned char> plane_mask;
+  gen_points_3d(planes, plane_mask, points3d, ground_normals, 3);
+
+  cv::RgbdPlane plane_computer;
+  cv::Mat mask;
+  std::vector<cv::Vec4f> coefficients;
+  plane_computer(points3d, ground_normals, mask, coefficients);
+  const int n_planes = int(coefficients.size());
+  ASSERT_GT(n_planes, 1);
+
+  // Give the planes to the tracker in the reverse order: they must be found again in that order
+  std::vector<cv::Vec4f> previous_coefficients(coefficients.rbegin(), coefficients.rend());
+  cv::Mat previous_mask = mask.clone();
+  for (int i = 0; i < n_planes; ++i)
+    previous_mask.setTo(n_planes - 1 - i, mask == i);
+
+  cv::Mat tracked_mask;
+  std::vector<cv::Vec4f> tracked_coefficients;
+  plane_computer.track(points3d, ground_normals, previous_mask, previous_coefficients, cv::Mat::eye(4, 4, CV_64F),
+                       tracked_mask, tracked_coefficients);
+  ASSERT_EQ(tracked_coefficients.size(), coefficients.size());
+  for (int i = 0; i < n_planes; ++i)
+  {
+    cv::Vec3f n(tracked_coefficients[i][0], tracked_coefficients[i][1], tracked_coefficients[i][2]);
+    cv::Vec3f n_previous(previous_coefficients[i][0], previous_coefficients[i][1], previous_coefficients[i][2]);
+    EXPECT_GE(std::abs(n.dot(n_previous)), 0.99);
+    EXPECT_LE(cv::countNonZero((tracked_mask == i) != (previous_mask == i)), int(tracked_mask.total() / 1000));
+  }
+
+  // Moving the camera moves the planes: translating it along the normal of a plane changes d only
+  cv::Matx44d Rt = cv::Matx44d::eye();
+  Rt(2, 3) = 0.5;
+  cv::Mat moved_points = points3d + cv::Scalar(0, 0, 0.5);
+  plane_computer.track(moved_points, ground_normals, previous_mask, previous_coefficients, cv::Mat(Rt),
+                       tracked_mask, tracked_coefficients);
+  ASSERT_EQ(tracked_coefficients.size(), coefficients.size());
+  for (int i = 0; i < n_planes; ++i)
+    EXPECT_LE(cv::countNonZero((tracked_mask == i) != (previous_mask == i)), int(tracked_mask.total() / 1000));
+}
+
+TEST(Rgbd_Plane, track_lost_and_new)
+{
+  std::vector<Plane> planes;
+  cv::Mat points3d, ground_normals;
+  cv::Mat_<unsigned char> plane_mask;
+  gen_points_3d(planes, plane_mask, points3d, ground_normals, 3);
+
+  cv::RgbdPlane plane_computer;
+  cv::Mat mask;
+  std::vector<cv::Vec4f> coefficients;
+  plane_computer(points3d, ground_normals, mask, coefficients);
+  const int n_planes = int(coefficients.size());
+  ASSERT_GT(n_planes, 2);
+
+  // The first plane leaves the scene: the next ones are found again, but one index lower
+  const int lost = 0;
+  cv::Mat current_points = points3d.clone(), current_normals = ground_normals.clone();
+  current_points.setTo(cv::Scalar::all(std::numeric_limits<float>::quiet_NaN()), mask == lost);
+  current_normals.setTo(cv::Scalar::all(std::numeric_limits<float>::quiet_NaN()), mask == lost);
+
+  // And the last one was not in the previous frame
+  const int added = n_planes - 1;
+  std::vector<cv::Vec4f> previous_coefficients(coefficients.begin(), coefficients.begin() + added);
+  cv::Mat previous_mask = mask.clone();
+  previous_mask.setTo(255, mask == added);
+
+  cv::Mat tracked_mask;
+  std::vector<cv::Vec4f> tracked_coefficients;
+  std::vector<int> previous_indices;
+  plane_computer.track(current_points, current_normals, previous_mask, previous_coefficients, cv::Mat(),
+                       tracked_mask, tracked_coefficients, previous_indices);
+  ASSERT_EQ(tracked_coefficients.size(), size_t(n_planes - 1));
+  ASSERT_EQ(previous_indices.size(), tracked_coefficients.size());
+
+  // The tracked planes come first, in their previous order, then the new one
+  for (int i = 0; i < n_planes - 2; ++i)
+  {
+    EXPECT_EQ(previous_indices[i], i + 1);
+    EXPECT_LE(cv::countNonZero((tracked_mask == i) != (mask == previous_indices[i])), int(tracked_mask.total() / 1000));
+  }
+  EXPECT_EQ(previous_indices[n_planes - 2], -1);
+  EXPECT_LE(cv::countNonZero((tracked_mask == n_planes - 2) != (mask == added)), int(tracked_mask.total() / 1000));
+}
+
+TEST(Rgbd_Plane, mask_type_and_levels)
+{
+  std::vector<Plane> planes;
+  cv::Mat points3d, ground_normals;
+  cv::Mat_<unsigned char> plane_mask;
+  gen_points_3d(planes, plane_mask, points3d, ground_normals, 3);
+
+  cv::RgbdPlane plane_computer;
+  cv::Mat mask;
+  std::vector<cv::Vec4f> coefficients;
+  plane_computer(points3d, ground_normals, mask, coefficients);
+  ASSERT_EQ(mask.type(), CV_8UC1);
+
+  // Wider labels give the same planes, the points of no plane being labeled with the maximum of the type
+  const int types[] = { CV_16U, CV_32S };
+  const double no_plane[] = { 65535, std::numeric_limits<int>::max() };
+  for (int i = 0; i < 2; ++i)
+  {
+    plane_computer.set("mask_type", types[i]);
+    cv::Mat wide_mask;
+    std::vector<cv::Vec4f> wide_coefficients;
+    plane_computer(points3d, ground_normals, wide_mask, wide_coefficients);
+    ASSERT_EQ(wide_mask.type(), types[i]);
+    ASSERT_EQ(wide_coefficients.size(), coefficients.size());
+    cv::Mat expected_mask;
+    mask.convertTo(expected_mask, types[i]);
+    expected_mask.setTo(no_plane[i], mask == 255);
+    EXPECT_EQ(cv::countNonZero(wide_mask != expected_mask), 0);
+  }
+
+  // Smaller tiles only add planes made of the points the bigger ones left
+  plane_computer.set("mask_type", CV_8U);
+  plane_computer.set("block_levels", 3);
+  cv::Mat multi_scale_mask;
+  std::vector<cv::Vec4f> multi_scale_coefficients;
+  plane_computer(points3d, ground_normals, multi_scale_mask, multi_scale_coefficients);
+  ASSERT_GE(multi_scale_coefficients.size(), coefficients.size());
+  for (size_t i = 0; i < coefficients.size(); ++i)
+    EXPECT_EQ(cv::countNonZero((multi_scale_mask == i) != (mask == i)), 0);
+}
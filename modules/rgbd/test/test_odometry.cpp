@@ -325,6 +325,119 @@ void CV_OdometryTest::run(int)
         ts->printf(cvtest::TS::LOG, "\nIncorrect count of accurate poses [2nd case]: %f / %f", static_cast<double>(better_5times_count), maxError5 * static_cast<double>(iterCount));
         ts->set_failed_test_info(cvtest::TS::FAIL_BAD_ACCURACY);
     }
+
+    // 3. The buffers kept by a workspace between the calls must not change the results.
+    Ptr<OdometryWorkspace> workspace(new OdometryWorkspace());
+    for(int iter = 0; iter < 3; iter++)
+    {
+        Mat rvec, tvec;
+        generateRandomTransformation(rvec, tvec);
+        Mat warpedImage, warpedDepth;
+        warpFrame(image, depth, rvec, tvec, K, warpedImage, warpedDepth);
+        dilateFrame(warpedImage, warpedDepth);
+
+        odometry->setWorkspace(Ptr<OdometryWorkspace>());
+        Mat refRt;
+        bool isRefComputed = odometry->compute(image, depth, Mat(), warpedImage, warpedDepth, Mat(), refRt);
+
+        odometry->setWorkspace(workspace);
+        for(int i = 0; i < 2; i++)
+        {
+            isComputed = odometry->compute(image, depth, Mat(), warpedImage, warpedDepth, Mat(), calcRt);
+            if(isComputed != isRefComputed || norm(calcRt, refRt, NORM_INF) > 0)
+            {
+                ts->printf(cvtest::TS::LOG, "\nThe results with a workspace differ from the results without it");
+                ts->set_failed_test_info(cvtest::TS::FAIL_INVALID_OUTPUT);
+            }
+        }
+    }
+    odometry->setWorkspace(Ptr<OdometryWorkspace>());
+
+    // The statistics are gathered for every pyramid level.
+    {
+        Ptr<OdometryStats> stats(new OdometryStats());
+        odometry->setStats(stats);
+        odometry->compute(image, depth, Mat(), image, depth, Mat(), calcRt);
+        odometry->setStats(Ptr<OdometryStats>());
+
+        Mat iterCounts = odometry->get<Mat>("iterCounts");
+        if(stats->levels.size() != iterCounts.total() || stats->levels[0].iterations <= 0 ||
+           stats->totalTime < stats->prepareSrcTime + stats->prepareDstTime)
+        {
+            ts->printf(cvtest::TS::LOG, "\nIncorrect odometry statistics");
+            ts->set_failed_test_info(cvtest::TS::FAIL_INVALID_OUTPUT);
+        }
+
+        // every increment is small enough: the levels stop after the first iteration
+        odometry->set("minIncrement", 1e10);
+        odometry->setStats(stats);
+        odometry->compute(image, depth, Mat(), image, depth, Mat(), calcRt);
+        odometry->setStats(Ptr<OdometryStats>());
+        odometry->set("minIncrement", static_cast<double>(Odometry::DEFAULT_MIN_INCREMENT()));
+
+        if(stats->levels[0].iterations != 1 || stats->levels[0].stopReason != OdometryStats::STOP_CONVERGED)
+        {
+            ts->printf(cvtest::TS::LOG, "\nThe iterations did not stop on convergence");
+            ts->set_failed_test_info(cvtest::TS::FAIL_INVALID_OUTPUT);
+        }
+    }
+
+    // 4. A stream registers every frame against the previous one, reusing the caches of the previous frame.
+    {
+        Mat rvec, tvec;
+        generateRandomTransformation(rvec, tvec);
+        Mat warpedImage, warpedDepth;
+        warpFrame(image, depth, rvec, tvec, K, warpedImage, warpedDepth);
+        dilateFrame(warpedImage, warpedDepth);
+
+        Mat refRt;
+        bool isRefComputed = odometry->compute(image, depth, Mat(), warpedImage, warpedDepth, Mat(), refRt);
+
+        OdometryStream stream(odometry);
+        if(stream.push(Ptr<OdometryFrame>(new OdometryFrame(image, depth)), calcRt))
+        {
+            ts->printf(cvtest::TS::LOG, "\nThe first frame of a stream can not be registered");
+            ts->set_failed_test_info(cvtest::TS::FAIL_INVALID_OUTPUT);
+        }
+        isComputed = stream.push(Ptr<OdometryFrame>(new OdometryFrame(warpedImage, warpedDepth)), calcRt);
+        if(isComputed != isRefComputed || norm(calcRt, refRt, NORM_INF) > 0)
+        {
+            ts->printf(cvtest::TS::LOG, "\nThe result of the stream differs from the result of Odometry::compute");
+            ts->set_failed_test_info(cvtest::TS::FAIL_INVALID_OUTPUT);
+        }
+        // the warped frame is the source frame now
+        isComputed = stream.push(Ptr<OdometryFrame>(new OdometryFrame(image, depth)), calcRt);
+        if(isComputed && isRefComputed && norm(calcRt * refRt, Mat::eye(4,4,CV_64FC1)) > 0.05)
+        {
+            ts->printf(cvtest::TS::LOG, "\nIncorrect inverse transformation computed by the stream");
+            ts->set_failed_test_info(cvtest::TS::FAIL_BAD_ACCURACY);
+        }
+
+        // 5. The frames are registered against the keyframe, which is kept while the overlap is large enough.
+        const float minOverlaps[] = {0.f, 1.1f};
+        const size_t keyframesCounts[] = {1, 3};
+        for(int i = 0; i < 2; i++)
+        {
+            KeyframeOdometry keyframeOdometry(odometry, minOverlaps[i]);
+            Mat pose;
+            keyframeOdometry.push(Ptr<OdometryFrame>(new OdometryFrame(image, depth)), pose);
+            isComputed = keyframeOdometry.push(Ptr<OdometryFrame>(new OdometryFrame(warpedImage, warpedDepth)), pose);
+            bool isLastComputed = keyframeOdometry.push(Ptr<OdometryFrame>(new OdometryFrame(image, depth)), pose);
+
+            if(keyframeOdometry.getTrajectory().size() != 3 ||
+               (isComputed && isLastComputed && keyframeOdometry.getKeyframeIndices().size() != keyframesCounts[i]))
+            {
+                ts->printf(cvtest::TS::LOG, "\nIncorrect trajectory or keyframes of the keyframe odometry");
+                ts->set_failed_test_info(cvtest::TS::FAIL_INVALID_OUTPUT);
+            }
+            if(isComputed && isRefComputed &&
+               norm(keyframeOdometry.getTrajectory()[1] * refRt, Mat::eye(4,4,CV_64FC1)) > 0.05)
+            {
+                ts->printf(cvtest::TS::LOG, "\nIncorrect pose computed by the keyframe odometry");
+                ts->set_failed_test_info(cvtest::TS::FAIL_BAD_ACCURACY);
+            }
+        }
+    }
 }
 
 /****************************************************************************************\
@@ -348,3 +461,332 @@ TEST(RGBD_Odometry_RgbdICP, algorithmic)
     CV_OdometryTest test(Algorithm::create<Odometry>("RGBD.RgbdICPOdometry"), 0.99, 0.99);
     test.safe_run();
 }
+
+TEST(RGBD_WarpFrame, zbuffer)
+{
+    Mat K = (Mat_<double>(3,3) << 525., 0., 319.5, 0., 525., 239.5, 0., 0., 1.);
+
+    // A wall at 2 m with a square at 1 m in front of it, some pixels having no depth
+    RNG rng(0);
+    Mat image(480, 640, CV_8UC3), depth(480, 640, CV_32FC1, Scalar(2.f));
+    rng.fill(image, RNG::UNIFORM, 0, 256);
+    depth(Rect(200, 150, 100, 100)).setTo(1.f);
+    for(int i = 0; i < 1000; i++)
+        depth.at<float>(rng.uniform(0, 100), rng.uniform(0, depth.cols)) = std::numeric_limits<float>::quiet_NaN();
+    Mat mask = depth == depth;
+
+    // The identity gives the frame back
+    Mat warpedImage, warpedDepth, warpedMask;
+    warpFrame(image, depth, mask, Mat::eye(4, 4, CV_64FC1), K, Mat(), warpedImage, &warpedDepth, &warpedMask);
+    ASSERT_EQ(warpedImage.type(), image.type());
+    EXPECT_EQ(countNonZero(warpedMask != mask), 0);
+    Mat expectedImage(image.size(), image.type(), Scalar::all(0));
+    image.copyTo(expectedImage, mask);
+    EXPECT_EQ(countNonZero((warpedImage != expectedImage).reshape(1)), 0);
+    EXPECT_EQ(countNonZero((warpedDepth != depth) & mask), 0);
+
+    // Moving the camera to the right: the square hides a part of the wall, whatever the number of threads
+    Mat Rt = Mat::eye(4, 4, CV_64FC1);
+    Rt.at<double>(0,3) = -0.4;
+    warpFrame(image, depth, mask, Rt, K, Mat(), warpedImage, &warpedDepth, &warpedMask);
+    // The square moves by 210 pixels, the wall by 105 pixels only
+    EXPECT_EQ(warpedDepth.at<float>(200, 260 - 210), 1.f);
+    EXPECT_EQ(warpedDepth.at<float>(200, 405 - 105), 2.f);
+
+    const int threads = getNumThreads();
+    setNumThreads(1);
+    Mat serialImage, serialDepth, serialMask;
+    warpFrame(image, depth, mask, Rt, K, Mat(), serialImage, &serialDepth, &serialMask);
+    setNumThreads(threads);
+    EXPECT_EQ(countNonZero((serialImage != warpedImage).reshape(1)), 0);
+    EXPECT_EQ(countNonZero(serialMask != warpedMask), 0);
+    EXPECT_EQ(countNonZero((serialDepth != warpedDepth) & serialMask), 0);
+}
+
+/** Renders the depth of a sphere of radius 0.25 m at (0, 0, 1) in front of a wall at z = 1.5 m (in the world
+ * coordinates), seen by a camera of the given pose (world_p = pose * camera_p) */
+static
+void renderSphereAndWall(const Mat& K, const Size& size, const Mat& pose, Mat& depth)
+{
+    const Matx33d R = Mat(pose(Rect(0,0,3,3)));
+    const Vec3d center(pose.at<double>(0,3), pose.at<double>(1,3), pose.at<double>(2,3));
+    const Vec3d sphereCenter(0, 0, 1);
+    const double sphereRadius = 0.25, wallZ = 1.5;
+
+    depth.create(size, CV_32FC1);
+    for(int y = 0; y < size.height; y++)
+    {
+        for(int x = 0; x < size.width; x++)
+        {
+            // The points of the ray are center + t * dir, t being their depth
+            const Vec3d dir = R * Vec3d((x - K.at<double>(0,2)) / K.at<double>(0,0),
+                                        (y - K.at<double>(1,2)) / K.at<double>(1,1), 1.);
+            double t = (wallZ - center[2]) / dir[2];
+
+            const Vec3d oc = center - sphereCenter;
+            const double a = dir.dot(dir), b = oc.dot(dir), c = oc.dot(oc) - sphereRadius * sphereRadius;
+            if(b * b - a * c >= 0)
+                t = std::min(t, (-b - std::sqrt(b * b - a * c)) / a);
+
+            depth.at<float>(y, x) = static_cast<float>(t);
+        }
+    }
+}
+
+TEST(RGBD_TsdfVolume, raycast)
+{
+    const Size size(320, 240);
+    Mat K = (Mat_<double>(3,3) << 262.5, 0., 159.5, 0., 262.5, 119.5, 0., 0., 1.);
+
+    TsdfVolume volume(Vec3i(128, 128, 96), 0.02f, Vec3f(-1.28f, -1.28f, 0.2f), 0.06f);
+
+    // Fuse the scene seen from 3 poses
+    for(int i = -1; i <= 1; i++)
+    {
+        Mat pose = Mat::eye(4, 4, CV_64FC1), depth;
+        pose.at<double>(0,3) = 0.05 * i;
+        renderSphereAndWall(K, size, pose, depth);
+        volume.integrate(RgbdFrame(Mat(), depth), K, pose);
+    }
+
+    // The raycast from another pose gives the depth and the normals of the scene
+    Mat pose = Mat::eye(4, 4, CV_64FC1), depth;
+    pose.at<double>(1,3) = 0.03;
+    renderSphereAndWall(K, size, pose, depth);
+
+    OdometryFrame frame;
+    volume.raycast(K, pose, size, 3, frame);
+    ASSERT_EQ(frame.pyramidDepth.size(), 3u);
+    ASSERT_EQ(frame.pyramidCloud.size(), 3u);
+    ASSERT_EQ(frame.pyramidNormals.size(), 3u);
+    ASSERT_EQ(frame.pyramidDepth[2].size(), Size(80, 60));
+    ASSERT_EQ(frame.depth.size(), size);
+
+    int validCount = 0, normalsCount = 0, frontNormalsCount = 0, wallCount = 0, wallNormalsCount = 0;
+    double errorSum = 0;
+    for(int y = 0; y < size.height; y++)
+    {
+        for(int x = 0; x < size.width; x++)
+        {
+            const float d = frame.depth.at<float>(y, x);
+            if(cvIsNaN(d))
+                continue;
+            validCount++;
+            errorSum += std::abs(d - depth.at<float>(y, x));
+            EXPECT_NEAR(frame.pyramidCloud[0].at<Vec3f>(y, x)[2], d, 1e-5);
+
+            // The normals point towards the camera, the ones of the wall are along the camera axis
+            const Vec3f n = frame.normals.at<Vec3f>(y, x);
+            if(cvIsNaN(n[0]))
+                continue;
+            normalsCount++;
+            if(n.dot(frame.pyramidCloud[0].at<Vec3f>(y, x)) < 0)
+                frontNormalsCount++;
+            if(std::abs(depth.at<float>(y, x) - 1.5f) < 1e-3f)
+            {
+                wallCount++;
+                if(n[2] < -0.95f)
+                    wallNormalsCount++;
+            }
+        }
+    }
+    EXPECT_GT(validCount, static_cast<int>(0.9 * size.area()));
+    EXPECT_LT(errorSum / validCount, 0.005);
+    EXPECT_GT(normalsCount, static_cast<int>(0.9 * validCount));
+    EXPECT_GT(frontNormalsCount, static_cast<int>(0.99 * normalsCount));
+    EXPECT_GT(wallNormalsCount, static_cast<int>(0.95 * wallCount));
+}
+
+TEST(RGBD_TsdfVolume, tracking)
+{
+    const Size size(320, 240);
+    Mat K = (Mat_<double>(3,3) << 262.5, 0., 159.5, 0., 262.5, 119.5, 0., 0., 1.);
+
+    TsdfVolume volume(Vec3i(128, 128, 96), 0.02f, Vec3f(-1.28f, -1.28f, 0.2f), 0.06f);
+    Mat pose = Mat::eye(4, 4, CV_64FC1), depth;
+    renderSphereAndWall(K, size, pose, depth);
+    volume.integrate(RgbdFrame(Mat(), depth), K, pose);
+
+    // Register a new frame against the model raycast from the pose of the first one
+    Mat newPose = Mat::eye(4, 4, CV_64FC1), newDepth;
+    newPose.at<double>(0,3) = 0.02;
+    newPose.at<double>(2,3) = -0.01;
+    renderSphereAndWall(K, size, newPose, newDepth);
+
+    Ptr<Odometry> odometry = Algorithm::create<Odometry>("RGBD.ICPOdometry");
+    odometry->set("cameraMatrix", K);
+    Ptr<OdometryFrame> modelFrame(new OdometryFrame());
+    volume.raycast(K, pose, size, static_cast<int>(odometry->get<Mat>("iterCounts").total()), *modelFrame);
+    Ptr<OdometryFrame> frame(new OdometryFrame(Mat(), newDepth));
+
+    Mat Rt;
+    ASSERT_TRUE(odometry->compute(frame, modelFrame, Rt));
+    Mat computedPose = pose * Rt;
+    EXPECT_LT(norm(computedPose(Rect(3,0,1,3)), newPose(Rect(3,0,1,3))), 0.005);
+    EXPECT_LT(norm(computedPose(Rect(0,0,3,3)), Mat::eye(3, 3, CV_64FC1)), 0.01);
+}
+
+TEST(RGBD_HashTsdfVolume, exportSurface)
+{
+    const Size size(320, 240);
+    Mat K = (Mat_<double>(3,3) << 262.5, 0., 159.5, 0., 262.5, 119.5, 0., 0., 1.);
+
+    HashTsdfVolume volume(0.01f, 0.03f);
+    for(int i = 0; i < 2; i++)
+    {
+        Mat pose = Mat::eye(4, 4, CV_64FC1), depth, points3d;
+        pose.at<double>(0,3) = 0.05 * i;
+        renderSphereAndWall(K, size, pose, depth);
+        depthTo3d(depth, K, points3d);
+        volume.integrate(points3d, K, pose);
+    }
+
+    // Only the blocks around the surfaces are allocated, far less than the blocks of their bounding box
+    const int blockSize = volume.getBlockSize();
+    const double blockSide = volume.getVoxelSize() * blockSize;
+    const double boxBlocksCount = (2 * 0.95 / blockSide) * (2 * 0.72 / blockSide) * (0.8 / blockSide);
+    EXPECT_LT(volume.getBlocksCount(), 0.5 * boxBlocksCount);
+
+    Mat points, normals;
+    volume.exportSurface(points, normals);
+    ASSERT_EQ(points.type(), CV_32FC3);
+    ASSERT_EQ(normals.type(), CV_32FC3);
+    ASSERT_EQ(points.size(), normals.size());
+    ASSERT_GT(points.cols, 10000);
+
+    // The points are on the sphere or on the wall, with their normals
+    const Vec3d sphereCenter(0, 0, 1);
+    int closePointsCount = 0, normalsCount = 0, goodNormalsCount = 0;
+    for(int i = 0; i < points.cols; i++)
+    {
+        const Vec3d p = points.at<Vec3f>(0, i);
+        const Vec3d toCenter = p - sphereCenter;
+        const double sphereDistance = norm(toCenter) - 0.25, wallDistance = p[2] - 1.5;
+        const bool isOnSphere = std::abs(sphereDistance) < std::abs(wallDistance);
+        if(std::min(std::abs(sphereDistance), std::abs(wallDistance)) < 0.005)
+            closePointsCount++;
+
+        const Vec3d n = normals.at<Vec3f>(0, i);
+        if(cvIsNaN(n[0]))
+            continue;
+        normalsCount++;
+        const Vec3d expectedNormal = isOnSphere ? toCenter * (1. / norm(toCenter)) : Vec3d(0, 0, -1);
+        if(n.dot(expectedNormal) > 0.9)
+            goodNormalsCount++;
+    }
+    EXPECT_GT(closePointsCount, static_cast<int>(0.98 * points.cols));
+    EXPECT_GT(normalsCount, static_cast<int>(0.9 * points.cols));
+    EXPECT_GT(goodNormalsCount, static_cast<int>(0.95 * normalsCount));
+
+    // The surface can be streamed by ranges of blocks
+    Mat firstPoints, firstNormals, lastPoints, lastNormals;
+    const int half = volume.getBlocksCount() / 2;
+    volume.exportSurface(0, half, firstPoints, firstNormals);
+    volume.exportSurface(half, -1, lastPoints, lastNormals);
+    EXPECT_EQ(firstPoints.cols + lastPoints.cols, points.cols);
+    EXPECT_EQ(countNonZero((firstPoints != points.colRange(0, firstPoints.cols)).reshape(1)), 0);
+}
+
+TEST(RGBD_Odometry, computeSequence)
+{
+    const Size size(320, 240);
+    Mat K = (Mat_<double>(3,3) << 262.5, 0., 159.5, 0., 262.5, 119.5, 0., 0., 1.);
+
+    // A camera moving along x and z
+    const int framesCount = 12;
+    std::vector<Mat> truePoses(framesCount);
+    std::vector<Ptr<OdometryFrame> > frames(framesCount), serialFrames(framesCount);
+    for(int i = 0; i < framesCount; i++)
+    {
+        truePoses[i] = Mat::eye(4, 4, CV_64FC1);
+        truePoses[i].at<double>(0,3) = 0.01 * i;
+        truePoses[i].at<double>(2,3) = -0.005 * i;
+        Mat depth;
+        renderSphereAndWall(K, size, truePoses[i], depth);
+        frames[i] = new OdometryFrame(Mat(), depth);
+        serialFrames[i] = new OdometryFrame(Mat(), depth.clone());
+    }
+
+    Ptr<Odometry> odometry = Algorithm::create<Odometry>("RGBD.ICPOdometry");
+    odometry->set("cameraMatrix", K);
+    std::vector<Mat> poses;
+    ASSERT_TRUE(odometry->computeSequence(frames, poses));
+    ASSERT_EQ(poses.size(), truePoses.size());
+    for(int i = 0; i < framesCount; i++)
+        EXPECT_LT(norm(poses[i], truePoses[i]), 0.01) << "frame " << i;
+
+    // Only the last frame keeps its caches
+    EXPECT_TRUE(frames[0]->pyramidDepth.empty());
+    EXPECT_FALSE(frames[framesCount-1]->pyramidDepth.empty());
+
+    // The statistics make the registrations sequential, with the same results
+    odometry->setStats(new OdometryStats());
+    std::vector<Mat> serialPoses;
+    ASSERT_TRUE(odometry->computeSequence(serialFrames, serialPoses));
+    for(int i = 0; i < framesCount; i++)
+        EXPECT_LT(norm(poses[i], serialPoses[i]), 1e-6) << "frame " << i;
+
+    // So does a workspace, which gets the pyramids of the used frames
+    odometry->setStats(Ptr<OdometryStats>());
+    odometry->setWorkspace(new OdometryWorkspace());
+    std::vector<Ptr<OdometryFrame> > recycledFrames(framesCount);
+    for(int i = 0; i < framesCount; i++)
+        recycledFrames[i] = new OdometryFrame(Mat(), frames[i]->depth);
+    std::vector<Mat> recycledPoses;
+    ASSERT_TRUE(odometry->computeSequence(recycledFrames, recycledPoses));
+    for(int i = 0; i < framesCount; i++)
+        EXPECT_LT(norm(poses[i], recycledPoses[i]), 1e-6) << "frame " << i;
+    EXPECT_TRUE(recycledFrames[0]->pyramidDepth.empty());
+    EXPECT_FALSE(recycledFrames[0]->depth.empty());
+}
+
+TEST(RGBD_Odometry, computeSequenceThreads)
+{
+    const Size size(320, 240);
+    Mat K = (Mat_<double>(3,3) << 262.5, 0., 159.5, 0., 262.5, 119.5, 0., 0., 1.);
+
+    // Enough frames without masks for several batches of pairs registered concurrently
+    const int framesCount = 24;
+    std::vector<Mat> depths(framesCount);
+    for(int i = 0; i < framesCount; i++)
+    {
+        Mat pose = Mat::eye(4, 4, CV_64FC1);
+        pose.at<double>(0,3) = 0.005 * i;
+        pose.at<double>(1,3) = -0.003 * i;
+        renderSphereAndWall(K, size, pose, depths[i]);
+    }
+
+    Ptr<Odometry> odometry = Algorithm::create<Odometry>("RGBD.ICPOdometry");
+    odometry->set("cameraMatrix", K);
+
+    std::vector<Ptr<OdometryFrame> > serialFrames(framesCount);
+    for(int i = 0; i < framesCount; i++)
+        serialFrames[i] = new OdometryFrame(Mat(), depths[i]);
+    odometry->setStats(new OdometryStats());
+    std::vector<Mat> serialPoses;
+    ASSERT_TRUE(odometry->computeSequence(serialFrames, serialPoses));
+    odometry->setStats(Ptr<OdometryStats>());
+
+    const int threads = getNumThreads();
+    setNumThreads(4);
+    for(int run = 0; run < 3; run++)
+    {
+        std::vector<Ptr<OdometryFrame> > frames(framesCount);
+        for(int i = 0; i < framesCount; i++)
+            frames[i] = new OdometryFrame(Mat(), depths[i]);
+        std::vector<Mat> poses;
+        // No assertion until the number of threads is restored
+        EXPECT_TRUE(odometry->computeSequence(frames, poses));
+
+        for(int i = 0; i < framesCount && i < static_cast<int>(poses.size()); i++)
+        {
+            EXPECT_LT(norm(poses[i], serialPoses[i]), 1e-6) << "run " << run << ", frame " << i;
+            // The mask was set once, before the registrations of the frame
+            EXPECT_EQ(frames[i]->mask.size(), size) << "frame " << i;
+        }
+        EXPECT_FALSE(frames[framesCount-1]->pyramidMask.empty());
+        if(!frames[framesCount-1]->pyramidMask.empty())
+            EXPECT_EQ(frames[framesCount-1]->mask.data, frames[framesCount-1]->pyramidMask[0].data);
+    }
+    setNumThreads(threads);
+}
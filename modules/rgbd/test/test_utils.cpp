@@ -59,3 +59,131 @@ TEST(Rgbd_DepthTo3d, compute)
   CV_RgbdDepthTo3dTest test;
   test.safe_run();
 }
+
+TEST(Rgbd_DepthTo3d, millimeters_and_planar)
+{
+  cv::Mat K = (cv::Mat_<float>(3, 3) << 525., 0., 319.5, 0., 525., 239.5, 0., 0., 1.);
+
+  // A random depth image in millimeters, with some missing depths; 637 columns test the non vectorized end of a row
+  cv::RNG rng;
+  cv::Mat_<unsigned short> depth(480, 637);
+  rng.fill(depth, cv::RNG::UNIFORM, 0, 5000);
+  for (int i = 0; i < 1000; ++i)
+    depth(rng.uniform(0, depth.rows), rng.uniform(0, depth.cols)) = 0;
+
+  // The direct scaling of CV_16U depths must match rescaleDepth
+  cv::Mat depth_meters, points3d_ref, points3d;
+  cv::rescaleDepth(depth, CV_32F, depth_meters);
+  cv::depthTo3d(depth_meters, K, points3d_ref);
+  cv::depthTo3d(depth, K, points3d);
+  ASSERT_EQ(points3d.type(), CV_32FC3);
+  cv::Mat values = points3d.reshape(1), values_ref = points3d_ref.reshape(1);
+  // NaN are different from themselves
+  EXPECT_EQ(cv::countNonZero((values != values_ref) & (values_ref == values_ref)), 0);
+  EXPECT_EQ(cv::countNonZero((values == values) != (values_ref == values_ref)), 0);
+
+  // The planes hold the same coordinates
+  std::vector<cv::Mat> planes, planes_ref;
+  cv::depthTo3dPlanar(depth, K, planes);
+  cv::split(points3d_ref, planes_ref);
+  ASSERT_EQ(planes.size(), 3u);
+  for (int i = 0; i < 3; ++i)
+  {
+    ASSERT_EQ(planes[i].type(), CV_32FC1);
+    EXPECT_EQ(cv::countNonZero((planes[i] != planes_ref[i]) & (planes_ref[i] == planes_ref[i])), 0);
+    EXPECT_EQ(cv::countNonZero((planes[i] == planes[i]) != (planes_ref[i] == planes_ref[i])), 0);
+  }
+}
+
+TEST(Rgbd_DepthCleaner, bilateral)
+{
+  // Two noisy planes at 1 m and 2 m with a hole: the filter must not mix them, nor fill the hole
+  cv::Mat_<unsigned short> depth(48, 64);
+  cv::RNG rng(0);
+  for (int y = 0; y < depth.rows; ++y)
+    for (int x = 0; x < depth.cols; ++x)
+      depth(y, x) = static_cast<unsigned short>(((x < depth.cols / 2) ? 1000 : 2000) + rng.uniform(-3, 4));
+  depth(10, 10) = 0;
+
+  cv::DepthCleaner cleaner(CV_16U, 5, cv::DepthCleaner::DEPTH_CLEANER_BILATERAL);
+  cv::Mat_<unsigned short> cleaned;
+  cleaner(depth, cleaned);
+
+  ASSERT_EQ(cleaned.size(), depth.size());
+  EXPECT_EQ(cleaned(10, 10), 0);
+  for (int y = 0; y < depth.rows; ++y)
+    for (int x = 0; x < depth.cols; ++x)
+      if ((y != 10) || (x != 10))
+        EXPECT_LE(std::abs(cleaned(y, x) - ((x < depth.cols / 2) ? 1000 : 2000)), 3) << "at " << x << ", " << y;
+
+  // The noise goes down on both planes, more at 2 m where the sensor noise (the range sigma) is larger
+  cv::Mat_<uchar> valid(depth.size(), 255);
+  valid(10, 10) = 0;
+  const int half_cols = depth.cols / 2;
+  const double max_ratios[2] = { 0.8, 0.5 };
+  for (int i = 0; i < 2; ++i)
+  {
+    const cv::Rect half(i * half_cols, 0, half_cols, depth.rows);
+    cv::Scalar mean_in, stddev_in, mean_out, stddev_out;
+    cv::meanStdDev(depth(half), mean_in, stddev_in, valid(half));
+    cv::meanStdDev(cleaned(half), mean_out, stddev_out, valid(half));
+    EXPECT_LT(stddev_out[0], max_ratios[i] * stddev_in[0]) << "plane " << i;
+  }
+
+  // The columns along the discontinuity are smoothed with their own plane only
+  for (int i = 0; i < 2; ++i)
+  {
+    const int x = half_cols - 1 + i;
+    cv::Scalar mean_in, stddev_in, mean_out, stddev_out;
+    cv::meanStdDev(depth.col(x), mean_in, stddev_in);
+    cv::meanStdDev(cleaned.col(x), mean_out, stddev_out);
+    EXPECT_NEAR(mean_out[0], (i == 0) ? 1000 : 2000, 1) << "column " << x;
+    EXPECT_LT(stddev_out[0], ((i == 0) ? 0.85 : 0.6) * stddev_in[0]) << "column " << x;
+  }
+}
+
+TEST(Rgbd_DepthCleaner, temporal)
+{
+  for (int i = 0; i < 2; ++i)
+  {
+    const int method = (i == 0) ? cv::DepthCleaner::DEPTH_CLEANER_TEMPORAL_MEDIAN :
+                                  cv::DepthCleaner::DEPTH_CLEANER_TEMPORAL_MEAN;
+    cv::DepthCleaner cleaner(CV_16U, 3, method);
+
+    // The hole of the last frame is filled from the previous ones
+    cv::Mat_<unsigned short> depth(16, 16), cleaned;
+    depth = 1000;
+    cleaner(depth, cleaned);
+    depth = 1002;
+    cleaner(depth, cleaned);
+    depth = 1001;
+    depth(5, 5) = 0;
+    cleaner(depth, cleaned);
+
+    EXPECT_EQ(cv::countNonZero(cleaned != 1001), 0) << "method " << method;
+  }
+}
+
+TEST(Rgbd_DepthCleaner, in_place)
+{
+  // A noisy slanted plane in millimeters with some holes
+  cv::Mat_<unsigned short> depth(60, 80);
+  cv::RNG rng(1);
+  for (int y = 0; y < depth.rows; ++y)
+    for (int x = 0; x < depth.cols; ++x)
+      depth(y, x) = static_cast<unsigned short>(1000 + 10 * x + rng.uniform(-5, 6));
+  for (int i = 0; i < 50; ++i)
+    depth(rng.uniform(0, depth.rows), rng.uniform(0, depth.cols)) = 0;
+
+  for (int method = cv::DepthCleaner::DEPTH_CLEANER_NIL; method <= cv::DepthCleaner::DEPTH_CLEANER_BILATERAL; ++method)
+  {
+    cv::DepthCleaner cleaner(CV_16U, 5, method);
+    cv::Mat expected;
+    cleaner(depth, expected);
+
+    // The cleaned pixels must not be read as the neighbours of the next ones
+    cv::Mat in_place = depth.clone();
+    cleaner(in_place, in_place);
+    EXPECT_EQ(cv::countNonZero(in_place != expected), 0) << "method " << method;
+  }
+}